@@ -0,0 +1,249 @@
+/*
+================================================================================
+                        BASIC-BLOCK VECTORS AND PHASE CLUSTERING
+================================================================================
+
+Picks simulation points for the sampling mode (mips_sampling.h) in the style
+of SimPoint:
+
+1. PROFILE: the BbvTrace policy splits the run into fixed-size intervals of
+   N instructions and, for every interval, counts how many instructions were
+   executed in each basic block. That "basic-block vector" (BBV) is a
+   fingerprint of what the program was doing during the interval.
+   A basic block starts at the first instruction, at every branch target and
+   right after every branch, so it always runs from top to bottom.
+
+2. CLUSTER: intervals with similar BBVs behave alike. Every BBV is
+   normalized, shrunk to 15 numbers with a fixed random projection and
+   grouped with k-means.
+
+3. PICK: from every cluster we keep the interval closest to the cluster's
+   center as its representative; its weight is the fraction of all intervals
+   that belong to the cluster.
+
+The BBVs are written in the SimPoint text format, one interval per line:
+    T:<block>:<count> :<block>:<count> ...
+================================================================================
+*/
+#ifndef MIPS_BBV_H
+#define MIPS_BBV_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mips_cpu.h"
+
+// Numbers every instruction of a loaded program with the basic block it belongs to
+inline std::vector<uint32_t> basicBlockIds(const Machine& m) {
+    size_t n = m.text.size();
+    std::vector<bool> leader(n, false);
+    leader[0] = true;
+    for (size_t pc = 0; pc < n; pc++) {
+        if (isBranch(m.text[pc].op)) {
+            leader[m.text[pc].target] = true;
+            if (pc + 1 < n) leader[pc + 1] = true;
+        }
+    }
+    std::vector<uint32_t> ids(n);
+    uint32_t id = 0;
+    for (size_t pc = 0; pc < n; pc++) {
+        if (leader[pc] && pc > 0) id++;
+        ids[pc] = id;
+    }
+    return ids;
+}
+
+// One interval's basic-block vector, stored sparsely as (block, count) pairs
+typedef std::vector<std::pair<uint32_t, uint32_t>> Bbv;
+
+/*
+BbvTrace: a trace policy that builds one Bbv per interval. Call setup() after
+the program is loaded; finish() closes the last (partial) interval.
+*/
+struct BbvTrace {
+    static constexpr const char* name = "BbvTrace";
+    static constexpr bool enabled = true;
+
+    uint64_t interval = 100000;           // instructions per interval
+    std::vector<Bbv> vectors;             // finished intervals
+
+    void setup(const Machine& m) {
+        blockOf = basicBlockIds(m);
+        counts.assign(blockOf.back() + 1, 0);
+    }
+
+    void record(const Machine&, const Decoded&, const InstrEvent& ev) {
+        uint32_t block = blockOf[ev.pc];
+        if (counts[block]++ == 0) {
+            touched.push_back(block);
+        }
+        if (++inInterval == interval) {
+            finish();
+        }
+    }
+
+    // Turns the counts gathered so far into a Bbv and starts a new interval
+    void finish() {
+        if (inInterval == 0) return;
+        Bbv v;
+        for (uint32_t block : touched) {
+            v.push_back({block, counts[block]});
+            counts[block] = 0;
+        }
+        touched.clear();
+        inInterval = 0;
+        vectors.push_back(v);
+    }
+
+    size_t blocks() const { return counts.size(); }
+
+private:
+    std::vector<uint32_t> blockOf;        // basic block of each instruction
+    std::vector<uint32_t> counts;         // instructions per block in the current interval
+    std::vector<uint32_t> touched;        // blocks with a nonzero count
+    uint64_t inInterval = 0;
+};
+
+// Writes the vectors in the SimPoint .bb format (block numbers start at 1 there)
+inline bool writeBbvFile(const std::string& path, const std::vector<Bbv>& vectors) {
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) return false;
+    for (const Bbv& v : vectors) {
+        fputc('T', out);
+        for (const auto& entry : v) {
+            fprintf(out, ":%u:%u ", entry.first + 1, entry.second);
+        }
+        fputc('\n', out);
+    }
+    fclose(out);
+    return true;
+}
+
+// One representative interval picked by the clustering
+struct SimPoint {
+    size_t interval;     // interval number
+    size_t members;      // how many intervals its cluster holds
+    double weight;       // members / total intervals
+};
+
+/*
+k-means over the projected vectors. Starting centers are chosen with the
+k-means++ rule (each new center far from the ones already picked) and a fixed
+seed, so the same profile always gives the same simulation points.
+*/
+inline std::vector<SimPoint> clusterBbvs(const std::vector<Bbv>& vectors, size_t numBlocks, size_t k) {
+    const size_t DIMS = 15;
+    size_t n = vectors.size();
+    std::vector<SimPoint> points;
+    if (n == 0) return points;
+    if (k > n) k = n;
+
+    // Random projection: each block gets a fixed random direction in 15 dimensions
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<double> projection(numBlocks * DIMS);
+    for (double& p : projection) p = uniform(rng);
+
+    // Normalize each BBV (so interval length does not matter) and project it
+    std::vector<std::vector<double>> data(n, std::vector<double>(DIMS, 0.0));
+    for (size_t i = 0; i < n; i++) {
+        double total = 0;
+        for (const auto& entry : vectors[i]) total += entry.second;
+        for (const auto& entry : vectors[i]) {
+            for (size_t d = 0; d < DIMS; d++) {
+                data[i][d] += entry.second / total * projection[entry.first * DIMS + d];
+            }
+        }
+    }
+    auto distance = [&](const std::vector<double>& a, const std::vector<double>& b) {
+        double sum = 0;
+        for (size_t d = 0; d < DIMS; d++) sum += (a[d] - b[d]) * (a[d] - b[d]);
+        return sum;
+    };
+
+    // k-means++ starting centers
+    std::vector<std::vector<double>> centers;
+    centers.push_back(data[rng() % n]);
+    std::vector<double> nearest(n);
+    while (centers.size() < k) {
+        double total = 0;
+        for (size_t i = 0; i < n; i++) {
+            nearest[i] = std::numeric_limits<double>::max();
+            for (const auto& c : centers) nearest[i] = std::min(nearest[i], distance(data[i], c));
+            total += nearest[i];
+        }
+        // All remaining points sit on a center already: fewer real phases than k
+        if (total == 0) break;
+        double pick = std::uniform_real_distribution<double>(0, total)(rng);
+        size_t chosen = 0;
+        while (chosen + 1 < n && pick > nearest[chosen]) pick -= nearest[chosen++];
+        centers.push_back(data[chosen]);
+    }
+    k = centers.size();
+
+    // Lloyd iterations: assign every interval to its closest center, move the centers
+    std::vector<size_t> cluster(n, 0);
+    for (int iter = 0; iter < 100; iter++) {
+        bool changed = false;
+        for (size_t i = 0; i < n; i++) {
+            size_t best = 0;
+            for (size_t c = 1; c < k; c++) {
+                if (distance(data[i], centers[c]) < distance(data[i], centers[best])) best = c;
+            }
+            if (best != cluster[i]) {
+                cluster[i] = best;
+                changed = true;
+            }
+        }
+        if (!changed && iter > 0) break;
+        std::vector<std::vector<double>> sums(k, std::vector<double>(DIMS, 0.0));
+        std::vector<size_t> sizes(k, 0);
+        for (size_t i = 0; i < n; i++) {
+            sizes[cluster[i]]++;
+            for (size_t d = 0; d < DIMS; d++) sums[cluster[i]][d] += data[i][d];
+        }
+        for (size_t c = 0; c < k; c++) {
+            if (sizes[c] == 0) continue;
+            for (size_t d = 0; d < DIMS; d++) centers[c][d] = sums[c][d] / sizes[c];
+        }
+    }
+
+    // The representative of each cluster is the interval closest to its center
+    for (size_t c = 0; c < k; c++) {
+        size_t best = n, members = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (cluster[i] != c) continue;
+            members++;
+            if (best == n || distance(data[i], centers[c]) < distance(data[best], centers[c])) best = i;
+        }
+        if (members > 0) {
+            points.push_back({best, members, (double)members / n});
+        }
+    }
+    std::sort(points.begin(), points.end(), [](const SimPoint& a, const SimPoint& b) { return a.interval < b.interval; });
+    return points;
+}
+
+// Prints the picked intervals and the matching --simpoints argument
+inline void printSimPoints(const std::vector<SimPoint>& points, uint64_t interval, std::ostream& out) {
+    out << "Simulation points (" << points.size() << " clusters, interval " << interval << " instructions):" << std::endl;
+    out << "  interval       start  members   weight" << std::endl;
+    std::string list;
+    for (const SimPoint& p : points) {
+        out << "  " << std::setw(8) << p.interval << std::setw(12) << p.interval * interval
+            << std::setw(9) << p.members << std::fixed << std::setprecision(4) << std::setw(9) << p.weight
+            << std::defaultfloat << std::endl;
+        if (!list.empty()) list += ",";
+        list += std::to_string(p.interval * interval) + ":" + std::to_string(p.weight);
+    }
+    out << "Use with: --simpoints " << list << " --detail " << interval << std::endl;
+}
+
+#endif
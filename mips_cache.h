@@ -0,0 +1,105 @@
+/*
+================================================================================
+                        CACHE MODEL
+================================================================================
+
+A set-associative cache with LRU replacement, used by the timing models.
+It only keeps TAGS (which lines are present), never the data itself: the
+values always come from Machine::memory, the cache only decides how long the
+access would have taken.
+
+Addresses are in WORDS, the unit both the data memory and the instruction
+memory use in this simulator (lw/sw word index, instruction index for fetch).
+
+    lineWords  words per cache line
+    sets       number of sets
+    ways       lines per set (1 = direct mapped)
+    capacity = sets * ways * lineWords words
+================================================================================
+*/
+#ifndef MIPS_CACHE_H
+#define MIPS_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+struct CacheConfig {
+    uint32_t sets = 64;
+    uint32_t ways = 4;
+    uint32_t lineWords = 4;
+    uint32_t missPenalty = 20;   // extra cycles for a miss
+};
+
+class Cache {
+public:
+    CacheConfig config;
+    uint64_t accesses = 0;
+    uint64_t misses = 0;
+
+    explicit Cache(const CacheConfig& c = CacheConfig())
+        : config(c), tags((size_t)c.sets * c.ways, 0), stamps((size_t)c.sets * c.ways, 0) {
+        // Power-of-two shapes (the usual case) index with a shift and a mask instead of dividing
+        if ((c.lineWords & (c.lineWords - 1)) == 0 && (c.sets & (c.sets - 1)) == 0) {
+            while ((1u << lineShift) < c.lineWords) lineShift++;
+            setMask = c.sets - 1;
+        }
+    }
+
+    // Looks up a word address, bringing its line in on a miss. Returns true on a hit.
+    bool access(uint64_t addr) {
+        accesses++;
+        bool hit = touch(addr);
+        if (!hit) {
+            misses++;
+        }
+        return hit;
+    }
+
+    // Same as access() but without counting it (used while warming the cache up)
+    bool touch(uint64_t addr) {
+        uint64_t line = lineOf(addr);
+        // Tags are stored as line + 1 so that 0 means "empty way"
+        uint64_t tag = line + 1;
+        size_t base = setOf(line) * config.ways;
+        clock++;
+
+        size_t victim = base;
+        for (size_t way = base; way < base + config.ways; way++) {
+            if (tags[way] == tag) {
+                stamps[way] = clock;
+                return true;
+            }
+            // Remember the least recently used way as the one to replace
+            if (stamps[way] < stamps[victim]) {
+                victim = way;
+            }
+        }
+        tags[victim] = tag;
+        stamps[victim] = clock;
+        return false;
+    }
+
+    // True if the line holding addr is in the cache (changes nothing)
+    bool contains(uint64_t addr) const {
+        uint64_t line = lineOf(addr);
+        size_t base = setOf(line) * config.ways;
+        for (size_t way = base; way < base + config.ways; way++) {
+            if (tags[way] == line + 1) return true;
+        }
+        return false;
+    }
+
+    double missRate() const { return accesses ? (double)misses / accesses : 0.0; }
+
+private:
+    std::vector<uint64_t> tags;     // line + 1 held by each way (0 = empty)
+    std::vector<uint64_t> stamps;   // last use time of each way, for LRU
+    uint64_t clock = 0;
+    uint32_t lineShift = 0;
+    uint64_t setMask = 0;           // 0 = not a power-of-two shape, divide
+
+    uint64_t lineOf(uint64_t addr) const { return setMask ? addr >> lineShift : addr / config.lineWords; }
+    size_t setOf(uint64_t line) const { return (size_t)(setMask ? line & setMask : line % config.sets); }
+};
+
+#endif
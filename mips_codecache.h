@@ -0,0 +1,227 @@
+/*
+================================================================================
+                        SHARED PREDECODED CODE
+================================================================================
+
+The instruction memory of this simulator is read-only: nothing a program
+does can change its text. So the predecoded form of a program (the Decoded
+array with its halt sentinel, and the bulk loops found in it) only depends
+on the program's words, and every Machine running the same program can use
+the same copy:
+
+    DecodedProgram  the predecoded text and its loop idioms, built once and
+                    never changed afterwards
+    ProgramText     what a Machine holds: a reference-counted pointer to a
+                    DecodedProgram, so copying a Machine (the cores of
+                    mips_multicore.h, the harts of mips_harts.h, the
+                    checkpoints...) copies a pointer instead of the text
+    CodeCache       finds the DecodedProgram of a program already loaded by
+                    another Machine, so Machine::load() decodes each program
+                    only once per process, however many instances load it
+
+The cache is a linked list of slots that are never unlinked; new slots are
+pushed at the front with a compare-and-swap. Each slot points at an
+immutable Entry (the program's hash and a weak reference to it) through a
+plain atomic pointer, so a lookup takes no lock (std::atomic<weak_ptr> would
+hide a spinlock) and never waits for a thread that is inserting. A program
+nobody runs any more is freed, and the next program decoded takes over the
+first slot whose program has gone by swapping in a new Entry with a
+compare-and-swap. So the list is only ever as long as the most programs
+alive at one time, however many come and go (--random-programs loads
+thousands).
+
+A lookup may still be reading the Entry that was swapped out, so it goes on
+a retired list, and the list is deleted at a moment when no lookup is
+running (lookups count themselves in and out: a minimal epoch scheme).
+Two threads loading a new program at the same moment may both decode it;
+both copies are correct and later lookups find one of them.
+================================================================================
+*/
+#ifndef MIPS_CODECACHE_H
+#define MIPS_CODECACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "mips_isa.h"
+#include "mips_idiom.h"
+
+// The predecoded form of one program
+struct DecodedProgram {
+    std::vector<Decoded> text;        // ends with an OP_HALT sentinel
+    std::vector<LoopIdiom> loops;     // bulk loops (mips_idiom.h), if they were looked for
+    bool idioms = false;
+
+    // Predecodes a program. Branches that leave the program are pointed at the
+    // halt sentinel, so the engines never have to check the PC.
+    DecodedProgram(const std::vector<uint32_t>& program, bool findIdioms) : idioms(findIdioms) {
+        text.reserve(program.size() + 1);
+        for (size_t i = 0; i < program.size(); i++) {
+            text.push_back(decode(program[i], (uint32_t)i));
+        }
+        for (Decoded& d : text) {
+            if (isBranch(d.op) && d.target > program.size()) {
+                d.target = (uint32_t)program.size();
+            }
+        }
+        text.push_back(haltInstruction());
+        if (findIdioms) loops = findLoopIdioms(text);
+    }
+
+    // Is this the predecoded form of program?
+    bool matches(const std::vector<uint32_t>& program, bool findIdioms) const {
+        if (idioms != findIdioms || text.size() != program.size() + 1) return false;
+        for (size_t i = 0; i < program.size(); i++) {
+            if (text[i].word != program[i]) return false;
+        }
+        return true;
+    }
+};
+
+// A Machine's (read-only) view of its predecoded program
+class ProgramText {
+public:
+    std::shared_ptr<const DecodedProgram> program;
+
+    const Decoded* data() const { return program->text.data(); }
+    size_t size() const { return program ? program->text.size() : 0; }
+    const Decoded& operator[](size_t i) const { return program->text[i]; }
+    const std::vector<LoopIdiom>& loops() const { return program->loops; }
+    // Machines sharing this text (including this one)
+    long sharers() const { return program.use_count(); }
+};
+
+class CodeCache {
+public:
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> decodes{0};
+    std::atomic<uint64_t> slots{0};   // in the list: about the most programs alive at one time
+
+    // The one cache of the process
+    static CodeCache& shared() {
+        static CodeCache cache;
+        return cache;
+    }
+
+    ~CodeCache() {
+        Slot* s = head.load();
+        while (s) {
+            Slot* next = s->next;
+            delete s->entry.load();
+            delete s;
+            s = next;
+        }
+        deleteList(retired.load());
+    }
+
+    std::shared_ptr<const DecodedProgram> get(const std::vector<uint32_t>& program, bool findIdioms) {
+        uint64_t key = hash(program) ^ (findIdioms ? 1 : 0);
+        if (std::shared_ptr<const DecodedProgram> found = find(program, findIdioms, key)) {
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return found;
+        }
+        std::shared_ptr<const DecodedProgram> built = std::make_shared<const DecodedProgram>(program, findIdioms);
+        decodes.fetch_add(1, std::memory_order_relaxed);
+
+        // Take over a slot whose program is gone, or push a new one
+        Entry* entry = new Entry{key, built};
+        if (Entry* old = takeOver(entry)) {
+            retire(old);
+            return built;
+        }
+        Slot* s = new Slot;
+        s->entry.store(entry);
+        s->next = head.load(std::memory_order_acquire);
+        while (!head.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_acquire)) {}
+        slots.fetch_add(1, std::memory_order_relaxed);
+        return built;
+    }
+
+private:
+    // What a slot points at; never changed while it is in a slot
+    struct Entry {
+        uint64_t key;
+        std::weak_ptr<const DecodedProgram> program;
+        Entry* retiredNext = nullptr;             // only used once it has left its slot
+    };
+    struct Slot {
+        std::atomic<Entry*> entry{nullptr};
+        Slot* next = nullptr;
+    };
+    std::atomic<Slot*> head{nullptr};
+    std::atomic<uint64_t> lookups{0};             // threads walking the slots right now
+    std::atomic<Entry*> retired{nullptr};         // swapped out, maybe still being read
+
+    // Counts a thread in for as long as it may read entries
+    struct Lookup {
+        CodeCache& cache;
+        explicit Lookup(CodeCache& c) : cache(c) { cache.lookups.fetch_add(1); }
+        ~Lookup() { cache.lookups.fetch_sub(1); }
+    };
+
+    std::shared_ptr<const DecodedProgram> find(const std::vector<uint32_t>& program, bool findIdioms, uint64_t key) {
+        Lookup lookup(*this);
+        for (Slot* s = head.load(std::memory_order_acquire); s; s = s->next) {
+            const Entry* e = s->entry.load();
+            if (e->key != key) continue;
+            std::shared_ptr<const DecodedProgram> found = e->program.lock();
+            if (found && found->matches(program, findIdioms)) return found;
+        }
+        return nullptr;
+    }
+
+    // Puts entry into the first slot whose program is gone; returns the entry it replaced (nullptr: none)
+    Entry* takeOver(Entry* entry) {
+        Lookup lookup(*this);
+        for (Slot* s = head.load(std::memory_order_acquire); s; s = s->next) {
+            Entry* old = s->entry.load();
+            if (old->program.expired() && s->entry.compare_exchange_strong(old, entry)) return old;
+        }
+        return nullptr;
+    }
+
+    /*
+    Deletes an entry once no lookup can be reading it. Everything on the
+    retired list had left its slot before this takes the list, so a lookup
+    that could still see one of them started before and is still counted:
+    if the count is zero afterwards, the whole list can go; otherwise it goes
+    back for a later retire() (or the destructor) to try again.
+    */
+    void retire(Entry* old) {
+        push(old, old);
+        Entry* list = retired.exchange(nullptr);
+        if (!list) return;
+        if (lookups.load() == 0) {
+            deleteList(list);
+            return;
+        }
+        Entry* last = list;
+        while (last->retiredNext) last = last->retiredNext;
+        push(list, last);
+    }
+
+    void push(Entry* first, Entry* last) {
+        last->retiredNext = retired.load();
+        while (!retired.compare_exchange_weak(last->retiredNext, first)) {}
+    }
+
+    static void deleteList(Entry* e) {
+        while (e) {
+            Entry* next = e->retiredNext;
+            delete e;
+            e = next;
+        }
+    }
+
+    // FNV-1a over the words, with the length
+    static uint64_t hash(const std::vector<uint32_t>& program) {
+        uint64_t h = 14695981039346656037ull ^ program.size();
+        for (uint32_t w : program) {
+            h = (h ^ w) * 1099511628211ull;
+        }
+        return h & ~1ull;
+    }
+};
+
+#endif
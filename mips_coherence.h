@@ -0,0 +1,256 @@
+/*
+================================================================================
+                        COHERENT PRIVATE L1 DATA CACHES (MESI)
+================================================================================
+
+With several simulated cores (mips_multicore.h) every core has its own L1
+data cache, and the caches are kept coherent by snooping a shared bus with
+the MESI protocol. Every line in a cache is in one of four states:
+
+    M  Modified    only this cache has it, and it is newer than memory
+    E  Exclusive   only this cache has it, same as memory
+    S  Shared      other caches may have it too, read-only
+    I  Invalid
+
+    read hit         any of M/E/S, no bus traffic
+    read miss        bus read: a cache holding the line in M/E/S supplies it
+                     (a cache-to-cache transfer; M also writes it back) and
+                     everybody ends up in S. If nobody has it, it comes from
+                     memory and this cache takes it in E.
+    write hit        M stays M, E silently becomes M, S has to send an
+                     upgrade on the bus that invalidates every other copy
+    write miss       bus read-exclusive: fetch the line (from a cache if one
+                     has it) and invalidate every other copy, take it in M
+
+Coherence misses (the line was here but another core's write invalidated it)
+are split into:
+    true sharing     the word we need now was written by the other core
+    false sharing    the other core wrote a DIFFERENT word of the same line:
+                     the miss only happened because both words share a line
+The lines with the most invalidations are listed with their counts, so
+false-sharing hot spots can be found and padded apart.
+
+Latencies: a hit costs nothing extra, a cache-to-cache transfer or an upgrade
+costs c2cLatency, and a fetch from memory costs memoryLatency or whatever the
+MemoryHierarchy behind the requesting core (mips_hierarchy.h) says: the same
+one for every core when the L2 is shared, the core's own one when it is
+private.
+================================================================================
+*/
+#ifndef MIPS_COHERENCE_H
+#define MIPS_COHERENCE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+#include "mips_hierarchy.h"
+
+struct CoherenceConfig {
+    uint32_t sets = 64;               // per core, same shape as the default L1
+    uint32_t ways = 4;
+    uint32_t lineWords = 4;
+    uint32_t c2cLatency = 10;         // cycles for a cache-to-cache transfer or an upgrade
+    uint32_t memoryLatency = 20;      // cycles for a line from memory when there is no MemoryHierarchy
+};
+
+class CoherentCaches {
+public:
+    // The protocol supports up to this many cores (the sharer bitmasks are 32 bits)
+    static const int MAX_CORES = 32;
+
+    CoherenceConfig config;
+
+    uint64_t busReads = 0;
+    uint64_t busReadExclusives = 0;
+    uint64_t upgrades = 0;
+    uint64_t invalidations = 0;           // copies invalidated in other caches
+    uint64_t cacheToCache = 0;            // misses served by another cache
+    uint64_t writebacks = 0;              // modified lines written back (evicted or snooped)
+    uint64_t trueSharingMisses = 0;
+    uint64_t falseSharingMisses = 0;
+
+    CoherentCaches(int cores, const CoherenceConfig& c = CoherenceConfig())
+        : config(c), caches(cores, std::vector<Way>((size_t)c.sets * c.ways)), accessCount(cores, 0), misses(cores, 0) {}
+
+    int cores() const { return (int)caches.size(); }
+
+    // One lw/sw of a core at cycle now, with memory behind that core's L1 (nullptr =
+    // memoryLatency). Returns the extra cycles it costs (0 = hit).
+    uint32_t access(int core, uint32_t addr, bool write, uint64_t now, uint32_t pc, MemoryHierarchy* memory) {
+        accessCount[core]++;
+        uint64_t line = addr / config.lineWords;
+        uint32_t wordBit = 1u << (addr % config.lineWords);
+        clock++;
+
+        LineStats* stats = nullptr;
+        auto it = lines.find(line);
+        if (it != lines.end()) stats = &it->second;
+        // Words written while another core's copy is invalid tell true from false sharing later
+        if (write && stats) {
+            for (int c = 0; c < cores(); c++) {
+                if (c != core && (stats->invalidated >> c & 1)) stats->writtenSince[c] |= wordBit;
+            }
+        }
+
+        Way* way = find(core, line);
+        if (way && way->state != INVALID) {
+            way->stamp = clock;
+            if (!write || way->state == MODIFIED) return 0;
+            if (way->state == EXCLUSIVE) {
+                way->state = MODIFIED;
+                return 0;
+            }
+            // Shared: everybody else has to drop the line first
+            upgrades++;
+            invalidateOthers(core, line, wordBit);
+            way->state = MODIFIED;
+            return config.c2cLatency;
+        }
+
+        // A miss. Was it caused by another core's write?
+        misses[core]++;
+        if (stats && (stats->invalidated >> core & 1)) {
+            stats->invalidated &= ~(1u << core);
+            if (stats->writtenSince[core] & wordBit) {
+                trueSharingMisses++;
+            } else {
+                falseSharingMisses++;
+                stats->falseSharing++;
+            }
+        }
+
+        bool supplied = false, shared = false;
+        if (write) {
+            busReadExclusives++;
+            supplied = invalidateOthers(core, line, wordBit);
+        } else {
+            busReads++;
+            for (int c = 0; c < cores(); c++) {
+                Way* other = c == core ? nullptr : find(c, line);
+                if (!other || other->state == INVALID) continue;
+                if (other->state == MODIFIED) writebacks++;
+                other->state = SHARED;
+                supplied = shared = true;
+            }
+        }
+        uint32_t latency;
+        if (supplied) {
+            cacheToCache++;
+            lines[line].transfers++;
+            latency = config.c2cLatency;
+        } else {
+            latency = memory ? memory->access(addr, now, pc, true) : config.memoryLatency;
+        }
+
+        Way& slot = allocate(core, line);
+        slot.state = write ? MODIFIED : (shared ? SHARED : EXCLUSIVE);
+        return latency;
+    }
+
+    uint64_t accesses(int core) const { return accessCount[core]; }
+    double missRate(int core) const { return accessCount[core] ? (double)misses[core] / accessCount[core] : 0.0; }
+
+    void report(std::ostream& out) const {
+        out << "Coherence (MESI, " << cores() << " private L1D caches):" << std::endl;
+        out << "  bus reads " << busReads << ", read-exclusives " << busReadExclusives << ", upgrades " << upgrades
+            << std::endl;
+        out << "  invalidations " << invalidations << ", cache-to-cache transfers " << cacheToCache
+            << ", writebacks " << writebacks << std::endl;
+        out << "  coherence misses: true sharing " << trueSharingMisses << ", false sharing " << falseSharingMisses
+            << std::endl;
+
+        // The most contended lines
+        std::vector<std::pair<uint64_t, const LineStats*>> hot;
+        for (const auto& entry : lines) hot.push_back({entry.first, &entry.second});
+        std::sort(hot.begin(), hot.end(), [](const auto& a, const auto& b) {
+            return a.second->invalidations != b.second->invalidations ? a.second->invalidations > b.second->invalidations
+                                                                      : a.first < b.first;
+        });
+        if (hot.size() > 8) hot.resize(8);
+        if (!hot.empty()) {
+            out << "  most contended lines:    words  invalidations  transfers  false sharing" << std::endl;
+            for (const auto& h : hot) {
+                uint64_t first = h.first * config.lineWords;
+                out << "    " << std::setw(10) << first << "-" << std::left << std::setw(10)
+                    << first + config.lineWords - 1 << std::right << std::setw(15) << h.second->invalidations
+                    << std::setw(11) << h.second->transfers << std::setw(15) << h.second->falseSharing << std::endl;
+            }
+        }
+    }
+
+private:
+    enum : uint8_t { INVALID, SHARED, EXCLUSIVE, MODIFIED };
+
+    struct Way {
+        uint64_t tag = 0;             // line + 1 (0 = empty)
+        uint64_t stamp = 0;
+        uint8_t state = INVALID;
+    };
+
+    // Only lines that took part in sharing get one of these
+    struct LineStats {
+        uint64_t invalidations = 0;
+        uint64_t transfers = 0;
+        uint64_t falseSharing = 0;
+        uint32_t invalidated = 0;                  // cores whose copy another core's write invalidated
+        uint32_t writtenSince[MAX_CORES] = {};     // words written since each of those invalidations
+    };
+
+    std::vector<std::vector<Way>> caches;          // one set-associative cache per core
+    std::vector<uint64_t> accessCount, misses;
+    std::unordered_map<uint64_t, LineStats> lines;
+    uint64_t clock = 0;
+
+    Way* find(int core, uint64_t line) {
+        std::vector<Way>& cache = caches[core];
+        size_t base = (size_t)(line % config.sets) * config.ways;
+        for (size_t w = base; w < base + config.ways; w++) {
+            if (cache[w].tag == line + 1) return &cache[w];
+        }
+        return nullptr;
+    }
+
+    // Places a line in a core's cache, over its own invalid copy or the LRU way
+    Way& allocate(int core, uint64_t line) {
+        Way* way = find(core, line);
+        if (!way) {
+            std::vector<Way>& cache = caches[core];
+            size_t base = (size_t)(line % config.sets) * config.ways;
+            way = &cache[base];
+            for (size_t w = base; w < base + config.ways; w++) {
+                if (cache[w].tag == 0) {
+                    way = &cache[w];
+                    break;
+                }
+                if (cache[w].stamp < way->stamp) way = &cache[w];
+            }
+            if (way->state == MODIFIED) writebacks++;
+            way->tag = line + 1;
+        }
+        way->stamp = clock;
+        return *way;
+    }
+
+    // Invalidates every other copy of a line for a write; returns true if one of them could supply the data
+    bool invalidateOthers(int core, uint64_t line, uint32_t wordBit) {
+        bool supplied = false;
+        for (int c = 0; c < cores(); c++) {
+            Way* other = c == core ? nullptr : find(c, line);
+            if (!other || other->state == INVALID) continue;
+            if (other->state == MODIFIED) writebacks++;
+            other->state = INVALID;
+            supplied = true;
+            invalidations++;
+            LineStats& stats = lines[line];
+            stats.invalidations++;
+            stats.invalidated |= 1u << c;
+            stats.writtenSince[c] = wordBit;
+        }
+        return supplied;
+    }
+};
+
+#endif
@@ -0,0 +1,11 @@
+// Explicit instantiations of the common Cpu policy combinations (declared
+// "extern template" in mips_cpu.h), so each engine loop is compiled only once.
+#include "mips_cpu.h"
+
+template class Cpu<NoTrace, UncheckedMemory, NoTiming>;
+template class Cpu<NoTrace, CheckedMemory, NoTiming>;
+template class Cpu<ConsoleTrace, CheckedMemory, NoTiming>;
+template class Cpu<BinaryTrace, CheckedMemory, NoTiming>;
+template class Cpu<NoTrace, UncheckedMemory, PipelineTiming>;
+template class Cpu<NoTrace, CheckedMemory, PipelineTiming>;
+template class Cpu<BinaryTrace, CheckedMemory, PipelineTiming>;
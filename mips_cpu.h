@@ -0,0 +1,439 @@
+/*
+================================================================================
+                        MIPS CPU CORE (POLICY TEMPLATE)
+================================================================================
+
+The CPU core used by mipssim. It runs a whole program (not one instruction at
+a time like the classroom programs) and it is a TEMPLATE on three policies:
+
+    Cpu<Trace, Memory, Timing>
+
+  Trace  - what to record for each instruction
+             NoTrace       nothing at all
+             ConsoleTrace  print every instruction and the state, like finalreview.cpp
+             BinaryTrace   write a 16-byte InstrEvent per instruction to a file
+             UndoTrace     log what each instruction overwrites (mips_reverse.h);
+                           a trace policy with a before() hook sees every
+                           instruction before it executes as well
+  Memory - how lw/sw addresses are checked
+             UncheckedMemory  no checks at all (the program must stay in range)
+             CheckedMemory    the "addr < 0 || addr >= 256" check from finalreview.cpp
+  Timing - which timing model is told about each instruction (mips_timing.h)
+             NoTiming, PipelineTiming
+
+Because the policies are template parameters, a feature that is turned off
+is not "skipped at run time", it is simply not in the compiled loop: the
+Cpu<NoTrace, UncheckedMemory, NoTiming> loop is nothing but the instruction
+switch. The common combinations are compiled once in mips_cpu.cpp (see the
+"extern template" list at the bottom of this file).
+
+MACHINE MODEL (same as finalreview.cpp):
+  - 32 registers, R[i] = i at start
+  - word-addressed data memory, M[i] = i at start, lw/sw use R[rs] + imm as
+    the word index
+  - lb/lbu/lh/sb/sh use R[rs] + imm as a BYTE address into the same memory:
+    byte address 4*i + k is byte k of M[i] (k = 0 is the low byte); halfwords
+    must be 2-byte aligned (checked engines report a misaligned one as a fault)
+  - mult/div leave their result in HI and LO, read back with mfhi/mflo
+  - syscall is passed to the Machine's SyscallHandler (mips_syscall.h); without
+    one it is skipped like an unknown instruction
+  - the program lives in its own instruction memory; the PC is an instruction
+    index and beq/bne jump to PC + 1 + imm
+================================================================================
+*/
+#ifndef MIPS_CPU_H
+#define MIPS_CPU_H
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "mips_isa.h"
+#include "mips_idiom.h"
+#include "mips_codecache.h"
+#include "mips_datamem.h"
+#include "mips_timing.h"
+
+struct Machine;
+
+// Operating-system services for the syscall instruction (see mips_syscall.h)
+class SyscallHandler {
+public:
+    virtual ~SyscallHandler() {}
+    // Carries out the service asked for in $v0. Returns false if the program exits.
+    virtual bool handle(Machine& m) = 0;
+    // Called when run() returns, so buffered program output shows up before the state
+    virtual void flush() {}
+};
+
+// The architectural state of one simulated processor
+struct Machine {
+    int registers[32];
+    int hi = 0;                      // HI and LO: results of mult and div
+    int lo = 0;
+    uint32_t pc = 0;                 // index of the next instruction in text
+    ProgramText text;                // predecoded program (shared, read-only), ends with an OP_HALT sentinel
+    DataMemory memory;               // data memory (word addressed, with dirty pages: mips_datamem.h)
+    uint64_t instructions = 0;       // instructions executed so far
+    uint64_t unknown = 0;            // unknown instructions skipped
+    uint64_t faults = 0;             // out-of-range lw/sw (checked engines only)
+    int64_t lastFault = 0;           // address of the last out-of-range access
+    bool halted = false;             // ran off the end of the program (or exited)
+    int exitCode = 0;                // set by the exit syscalls
+    SyscallHandler* os = nullptr;    // services for syscall (nullptr = none)
+    bool idioms = true;              // recognize bulk copy/clear/scan loops in load() (mips_idiom.h);
+                                     // the loops found are text.loops(), run in bulk by the fast engines
+    uint64_t idiomInstructions = 0;  // instructions those bulk runs stood for
+
+    // Start values from the assignment: R[i] = i and M[i] = i
+    void reset(size_t memWords) {
+        for (int i = 0; i < 32; i++) {
+            registers[i] = i;
+        }
+        hi = 0;
+        lo = 0;
+        memory.assign(memWords, 0);
+        for (size_t i = 0; i < memWords; i++) {
+            memory[i] = (int)i;
+        }
+        memory.baseline();
+        pc = 0;
+        instructions = 0;
+        idiomInstructions = 0;
+        unknown = 0;
+        faults = 0;
+        lastFault = 0;
+        halted = false;
+        exitCode = 0;
+    }
+
+    // Predecode a program, or pick up the predecoded copy another Machine already made
+    void load(const std::vector<uint32_t>& program) {
+        text.program = CodeCache::shared().get(program, idioms);
+        pc = 0;
+        halted = false;
+    }
+};
+
+// Displays R[0..15] and M[0..15] in the same layout as finalreview.cpp
+inline void displayState(const Machine& m) {
+    std::cout << "\n          --- Current State ---\n";
+    std::cout << std::endl;
+    std::cout << "Registers (0-15)\tMemory (0-15)\n";
+    std::cout << std::endl;
+    for (int i = 0; i < 16; ++i) {
+        // Keep only the lower 16 bits for display
+        unsigned int regVal = m.registers[i] & 0xFFFF;
+        unsigned int memVal = (i < (int)m.memory.size() ? m.memory[i] : 0) & 0xFFFF;
+        std::cout << std::dec << "R[$" << i << "] - " << std::setfill('0') << std::setw(4) << std::hex
+                  << std::uppercase << regVal;
+        std::cout << "\t\tM[" << std::dec << i << "] - " << std::setfill('0') << std::setw(4) << std::hex
+                  << std::uppercase << memVal << std::dec << std::endl;
+    }
+    std::cout << std::dec << std::setfill(' ');
+    std::cout << "           ---------------------\n";
+}
+
+// ---------------------------------------------------------------- TRACE POLICIES
+
+// NoTrace: records nothing
+struct NoTrace {
+    static constexpr const char* name = "NoTrace";
+    static constexpr bool enabled = false;
+    void record(const Machine&, const Decoded&, const InstrEvent&) {}
+};
+
+// ConsoleTrace: the classroom output, one instruction at a time
+struct ConsoleTrace {
+    static constexpr const char* name = "ConsoleTrace";
+    static constexpr bool enabled = true;
+    void record(const Machine& m, const Decoded& d, const InstrEvent& ev) {
+        if (ev.flags & EV_FAULT) {
+            std::cout << "Error: " << mnemonic(d.op) << " address out of range: " << m.lastFault << std::endl;
+        }
+        std::cout << "\nInstruction: " << disassemble(d);
+        if (isBranch(d.op)) {
+            std::cout << ((ev.flags & EV_TAKEN) ? "  (Branch Taken)" : "  (Branch Not Taken)");
+        }
+        std::cout << std::endl;
+        displayState(m);
+    }
+};
+
+// BinaryTrace: buffered InstrEvent records, written with fwrite in large chunks
+struct BinaryTrace {
+    static constexpr const char* name = "BinaryTrace";
+    static constexpr bool enabled = true;
+    FILE* out = nullptr;
+    std::vector<InstrEvent> buffer;
+
+    bool open(const std::string& path) {
+        out = fopen(path.c_str(), "wb");
+        buffer.reserve(1 << 16);
+        return out != nullptr;
+    }
+    void record(const Machine&, const Decoded&, const InstrEvent& ev) {
+        buffer.push_back(ev);
+        if (buffer.size() == (1 << 16)) {
+            flush();
+        }
+    }
+    void flush() {
+        if (out && !buffer.empty()) {
+            fwrite(buffer.data(), sizeof(InstrEvent), buffer.size(), out);
+        }
+        buffer.clear();
+    }
+    ~BinaryTrace() {
+        flush();
+        if (out) {
+            fclose(out);
+        }
+    }
+};
+
+// ---------------------------------------------------------------- MEMORY POLICIES
+
+// UncheckedMemory: every address is trusted
+struct UncheckedMemory {
+    static constexpr const char* name = "UncheckedMemory";
+    static bool valid(const Machine&, int32_t) { return true; }
+    static bool aligned(int32_t, int32_t) { return true; }
+};
+
+// CheckedMemory: out-of-range lw/sw are reported and skipped, like finalreview.cpp
+struct CheckedMemory {
+    static constexpr const char* name = "CheckedMemory";
+    static bool valid(const Machine& m, int32_t addr) {
+        return addr >= 0 && (size_t)addr < m.memory.size();
+    }
+    // Halfword accesses must start on an even byte address
+    static bool aligned(int32_t byteAddr, int32_t bytes) {
+        return (byteAddr & (bytes - 1)) == 0;
+    }
+};
+
+// Counts an out-of-range access; returns the flag to put in the InstrEvent
+inline uint8_t memoryFault(Machine& m, int64_t addr) {
+    m.faults++;
+    m.lastFault = addr;
+    return EV_FAULT;
+}
+
+// ---------------------------------------------------------------- THE CPU
+
+template <class Trace, class Memory, class Timing>
+class Cpu {
+public:
+    Machine& machine;
+    Trace trace;
+    Timing timing;
+
+    explicit Cpu(Machine& m) : machine(m) {}
+
+    // "Cpu<NoTrace, UncheckedMemory, NoTiming>", for reports
+    static std::string name() {
+        return std::string("Cpu<") + Trace::name + ", " + Memory::name + ", " + Timing::name + ">";
+    }
+
+    // Execute up to maxInstructions instructions (fewer if the program ends).
+    // Returns how many were executed.
+    uint64_t run(uint64_t maxInstructions);
+};
+
+template <class Trace, class Memory, class Timing>
+uint64_t Cpu<Trace, Memory, Timing>::run(uint64_t maxInstructions) {
+    // Keep the hot state in locals so the compiler can hold it in host registers
+    Machine& m = machine;
+    const Decoded* text = m.text.data();
+    int* R = m.registers;
+    int* M = m.memory.data();
+    uint8_t* D = m.memory.dirtyMap();     // a store marks its page (mips_datamem.h)
+    uint32_t pc = m.pc;
+    uint64_t count = 0;
+    int32_t byteAddr = 0;
+    uint32_t shift = 0;
+
+    while (count < maxInstructions) {
+        const Decoded& d = text[pc];
+        uint32_t nextPc = pc + 1;
+        int32_t addr = 0;
+        uint8_t flags = 0;
+
+        // Trace policies that need the state before an instruction (mips_reverse.h) get a look first
+        if constexpr (requires { trace.before(m, d, pc); }) {
+            trace.before(m, d, pc);
+        }
+
+        // The dispatch table: one case per Op, the compiler turns it into a jump table.
+        // Arithmetic is done on unsigned values so overflow wraps like real hardware.
+        switch (d.op) {
+            case OP_ADD: R[d.rd] = (int)((uint32_t)R[d.rs] + (uint32_t)R[d.rt]); break;
+            case OP_SUB: R[d.rd] = (int)((uint32_t)R[d.rs] - (uint32_t)R[d.rt]); break;
+            case OP_AND: R[d.rd] = R[d.rs] & R[d.rt]; break;
+            case OP_OR:  R[d.rd] = R[d.rs] | R[d.rt]; break;
+            case OP_XOR: R[d.rd] = R[d.rs] ^ R[d.rt]; break;
+            case OP_ADDI: R[d.rt] = (int)((uint32_t)R[d.rs] + (uint32_t)d.imm); break;
+            case OP_SLL:  R[d.rd] = (int)((uint32_t)R[d.rt] << d.shamt); break;
+            case OP_SRL:  R[d.rd] = (int)((uint32_t)R[d.rt] >> d.shamt); break;
+            case OP_SRA:  R[d.rd] = R[d.rt] >> d.shamt; break;
+            case OP_SLLV: R[d.rd] = (int)((uint32_t)R[d.rt] << (R[d.rs] & 31)); break;
+            case OP_SLT:  R[d.rd] = R[d.rs] < R[d.rt]; break;
+            case OP_SLTU: R[d.rd] = (uint32_t)R[d.rs] < (uint32_t)R[d.rt]; break;
+            case OP_SLTI: R[d.rt] = R[d.rs] < d.imm; break;
+            case OP_ANDI: R[d.rt] = R[d.rs] & d.imm; break;
+            case OP_ORI:  R[d.rt] = R[d.rs] | d.imm; break;
+            case OP_XORI: R[d.rt] = R[d.rs] ^ d.imm; break;
+            case OP_LUI:  R[d.rt] = d.imm; break;
+            case OP_MULT: {
+                int64_t product = (int64_t)R[d.rs] * R[d.rt];
+                m.hi = (int)(product >> 32);
+                m.lo = (int)(uint32_t)product;
+                break;
+            }
+            case OP_DIV:
+                // Division by zero leaves HI and LO unchanged (the result is undefined on MIPS)
+                if (R[d.rt] == 0) break;
+                if (R[d.rs] == INT32_MIN && R[d.rt] == -1) {
+                    m.lo = INT32_MIN;
+                    m.hi = 0;
+                } else {
+                    m.lo = R[d.rs] / R[d.rt];
+                    m.hi = R[d.rs] % R[d.rt];
+                }
+                break;
+            case OP_MFHI: R[d.rd] = m.hi; break;
+            case OP_MFLO: R[d.rd] = m.lo; break;
+            case OP_LW:
+                addr = (int32_t)((uint32_t)R[d.rs] + (uint32_t)d.imm);
+                if (Memory::valid(m, addr)) R[d.rt] = M[addr];
+                else flags = memoryFault(m, addr);
+                break;
+            case OP_SW:
+                addr = (int32_t)((uint32_t)R[d.rs] + (uint32_t)d.imm);
+                if (Memory::valid(m, addr)) {
+                    M[addr] = R[d.rt];
+                    D[addr >> DataMemory::PAGE_SHIFT] = DataMemory::WRITTEN;
+                } else {
+                    flags = memoryFault(m, addr);
+                }
+                break;
+            // Byte and halfword accesses: find the word, then the lane inside it
+            case OP_LB:
+            case OP_LBU:
+                byteAddr = (int32_t)((uint32_t)R[d.rs] + (uint32_t)d.imm);
+                addr = byteAddr >> 2;
+                shift = (byteAddr & 3) * 8;
+                if (!Memory::valid(m, addr)) flags = memoryFault(m, byteAddr);
+                else if (d.op == OP_LB) R[d.rt] = (int8_t)((uint32_t)M[addr] >> shift);
+                else R[d.rt] = (uint8_t)((uint32_t)M[addr] >> shift);
+                break;
+            case OP_LH:
+                byteAddr = (int32_t)((uint32_t)R[d.rs] + (uint32_t)d.imm);
+                addr = byteAddr >> 2;
+                shift = (byteAddr & 2) * 8;
+                if (Memory::valid(m, addr) && Memory::aligned(byteAddr, 2)) R[d.rt] = (int16_t)((uint32_t)M[addr] >> shift);
+                else flags = memoryFault(m, byteAddr);
+                break;
+            case OP_SB:
+                byteAddr = (int32_t)((uint32_t)R[d.rs] + (uint32_t)d.imm);
+                addr = byteAddr >> 2;
+                shift = (byteAddr & 3) * 8;
+                if (Memory::valid(m, addr)) {
+                    M[addr] = (int)(((uint32_t)M[addr] & ~(0xFFu << shift)) | (((uint32_t)R[d.rt] & 0xFFu) << shift));
+                    D[addr >> DataMemory::PAGE_SHIFT] = DataMemory::WRITTEN;
+                } else {
+                    flags = memoryFault(m, byteAddr);
+                }
+                break;
+            case OP_SH:
+                byteAddr = (int32_t)((uint32_t)R[d.rs] + (uint32_t)d.imm);
+                addr = byteAddr >> 2;
+                shift = (byteAddr & 2) * 8;
+                if (Memory::valid(m, addr) && Memory::aligned(byteAddr, 2)) {
+                    M[addr] = (int)(((uint32_t)M[addr] & ~(0xFFFFu << shift)) | (((uint32_t)R[d.rt] & 0xFFFFu) << shift));
+                    D[addr >> DataMemory::PAGE_SHIFT] = DataMemory::WRITTEN;
+                } else {
+                    flags = memoryFault(m, byteAddr);
+                }
+                break;
+            case OP_SYSCALL:
+                if (!m.os) {
+                    m.unknown++;
+                } else if (!m.os->handle(m)) {
+                    // exit: continue at the halt sentinel, which ends the run
+                    nextPc = (uint32_t)m.text.size() - 1;
+                }
+                // sbrk may have grown the data memory
+                M = m.memory.data();
+                D = m.memory.dirtyMap();
+                break;
+            case OP_BEQ:
+                if (R[d.rs] == R[d.rt]) {
+                    nextPc = d.target;
+                    flags |= EV_TAKEN;
+                }
+                break;
+            case OP_BNE:
+                if (R[d.rs] != R[d.rt]) {
+                    nextPc = d.target;
+                    flags |= EV_TAKEN;
+                    // A recognized copy/clear/scan loop: the remaining iterations in one go. Engines
+                    // with a trace or a timing model need every instruction, so only the plain ones do this.
+                    if constexpr (!Trace::enabled && !Timing::enabled) {
+                        if (d.loop) {
+                            uint64_t skipped = runLoopIdiom(m.text.loops()[d.loop - 1], R, m.memory, maxInstructions - count - 1);
+                            if (skipped) {
+                                count += skipped;
+                                m.idiomInstructions += skipped;
+                                nextPc = pc + 1;
+                            }
+                        }
+                    }
+                }
+                break;
+            case OP_HALT:
+                // End of the program: stop without counting the sentinel
+                m.halted = true;
+                m.pc = pc;
+                m.instructions += count;
+                if (m.os) m.os->flush();
+                return count;
+            default:
+                m.unknown++;
+                break;
+        }
+
+        // Hooks: only compiled in when the policy is enabled
+        if constexpr (Trace::enabled || Timing::enabled) {
+            InstrEvent ev = {pc, addr, d.op, flags, d.dst, d.src1, d.src2, {0, 0, 0}};
+            if constexpr (Trace::enabled) {
+                trace.record(m, d, ev);
+            }
+            if constexpr (Timing::enabled) {
+                timing.retire(ev);
+            }
+        }
+
+        pc = nextPc;
+        count++;
+    }
+
+    m.pc = pc;
+    m.instructions += count;
+    if (m.os) m.os->flush();
+    return count;
+}
+
+// The common engines, compiled once in mips_cpu.cpp
+extern template class Cpu<NoTrace, UncheckedMemory, NoTiming>;
+extern template class Cpu<NoTrace, CheckedMemory, NoTiming>;
+extern template class Cpu<ConsoleTrace, CheckedMemory, NoTiming>;
+extern template class Cpu<BinaryTrace, CheckedMemory, NoTiming>;
+extern template class Cpu<NoTrace, UncheckedMemory, PipelineTiming>;
+extern template class Cpu<NoTrace, CheckedMemory, PipelineTiming>;
+extern template class Cpu<BinaryTrace, CheckedMemory, PipelineTiming>;
+
+#endif
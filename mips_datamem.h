@@ -0,0 +1,215 @@
+/*
+================================================================================
+                        DATA MEMORY WITH DIRTY PAGES
+================================================================================
+
+The data memory of a Machine: the words (a block of host memory from
+mips_hostmem.h, resized in place as sbrk grows it) and, for every 4 KB page of them (1024 words), a dirty
+byte that remembers whether the page has been written:
+
+    since the last checkpoint   cleared whenever a MemorySnapshot is taken
+                                or restored, so the next snapshot copies
+                                only the pages written in between and
+                                shares the rest with the last one
+    since the baseline          cleared by baseline() (Machine::reset calls
+                                it once the start values are in). Memories
+                                copied from one baseline are equal on every
+                                page neither has written, so
+                                firstDifference() compares only the pages
+                                either of them wrote
+
+Writes through operator[] mark their page. The engines write through
+data() for speed and mark the page themselves (one byte store next to the
+word store, dirtyMap()); so does anything else that writes through data()
+(markDirty()). The whole map is one byte per 4 KB, 256 KB for 1 GB.
+
+A MemorySnapshot is a copy of a DataMemory made of reference-counted
+read-only pages. Consecutive snapshots share the pages nobody wrote in
+between, so a checkpoint of a mostly unchanged multi-GB memory costs its
+changed pages plus a pointer per page, and restoring one copies only the
+pages that can differ from the memory's current contents.
+================================================================================
+*/
+#ifndef MIPS_DATAMEM_H
+#define MIPS_DATAMEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "mips_hostmem.h"
+
+class DataMemory {
+public:
+    static constexpr unsigned PAGE_SHIFT = 10;
+    static constexpr size_t PAGE_WORDS = size_t(1) << PAGE_SHIFT;     // 4 KB
+    // Dirty bits of a page
+    static constexpr uint8_t SINCE_CHECKPOINT = 1;
+    static constexpr uint8_t SINCE_BASELINE = 2;
+    static constexpr uint8_t WRITTEN = SINCE_CHECKPOINT | SINCE_BASELINE;
+
+    DataMemory() = default;
+    DataMemory(const DataMemory& other) : dirty(other.dirty), origin(other.origin) {
+        resizeWords(other.count, 0);
+        if (count) memcpy(words, other.words, count * sizeof(int));
+    }
+    DataMemory(DataMemory&& other) noexcept { swap(other); }
+    DataMemory& operator=(DataMemory other) noexcept {
+        swap(other);
+        return *this;
+    }
+    ~DataMemory() { clear(); }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    // Writing through data() must mark the pages (markDirty, or dirtyMap() in the engines)
+    int* data() { return words; }
+    const int* data() const { return words; }
+    const int& operator[](size_t i) const { return words[i]; }
+    int& operator[](size_t i) {
+        dirty[i >> PAGE_SHIFT] = WRITTEN;
+        return words[i];
+    }
+
+    void assign(size_t n, int value) {
+        clear();
+        resizeWords(n, value);
+        dirty.assign(pagesFor(n), WRITTEN);
+    }
+    // Growing marks the new words (and the page they start in) written
+    void resize(size_t n, int value) {
+        size_t old = count;
+        resizeWords(n, value);
+        dirty.resize(pagesFor(n), WRITTEN);
+        if (n > old && old % PAGE_WORDS) dirty[old >> PAGE_SHIFT] = WRITTEN;
+    }
+    void clear() {
+        if (words) HostMemory::release(words, count * sizeof(int));
+        words = nullptr;
+        count = 0;
+        dirty.clear();
+    }
+    void swap(DataMemory& other) noexcept {
+        std::swap(words, other.words);
+        std::swap(count, other.count);
+        dirty.swap(other.dirty);
+        std::swap(origin, other.origin);
+    }
+
+    size_t pages() const { return dirty.size(); }
+    uint8_t* dirtyMap() { return dirty.data(); }
+    uint8_t pageState(size_t page) const { return dirty[page]; }
+
+    // Marks words [first, first + count) written
+    void markDirty(size_t first, size_t count) {
+        if (count == 0) return;
+        std::fill(dirty.begin() + (first >> PAGE_SHIFT), dirty.begin() + ((first + count - 1) >> PAGE_SHIFT) + 1,
+                  WRITTEN);
+    }
+    void clearCheckpointBits() {
+        for (uint8_t& d : dirty) d &= SINCE_BASELINE;
+    }
+
+    // The current contents are the common starting point of this memory and its copies
+    void baseline() {
+        std::fill(dirty.begin(), dirty.end(), 0);
+        static std::atomic<uint64_t> baselines{0};
+        origin = ++baselines;
+    }
+    // Memories with the same (non-zero) baseline started out equal
+    uint64_t baselineId() const { return origin; }
+
+    static size_t pagesFor(size_t n) { return (n + PAGE_WORDS - 1) >> PAGE_SHIFT; }
+
+private:
+    int* words = nullptr;
+    size_t count = 0;
+    std::vector<uint8_t> dirty;
+    uint64_t origin = 0;
+
+    // New words are set to value, except where they are fresh zero pages and value is 0
+    void resizeWords(size_t n, int value) {
+        size_t zero;
+        words = static_cast<int*>(HostMemory::reallocate(words, count * sizeof(int), n * sizeof(int), zero));
+        size_t fillEnd = value == 0 ? std::max(zero / sizeof(int), count) : n;
+        if (n > count) std::fill(words + count, words + std::min(n, fillEnd), value);
+        count = n;
+    }
+};
+
+// The first word at which a and b differ, or -1 if they are equal (a shorter memory differs at its end)
+inline int64_t firstDifference(const DataMemory& a, const DataMemory& b) {
+    size_t common = std::min(a.size(), b.size());
+    bool sameStart = a.baselineId() != 0 && a.baselineId() == b.baselineId();
+    for (size_t page = 0; page < DataMemory::pagesFor(common); page++) {
+        if (sameStart && !((a.pageState(page) | b.pageState(page)) & DataMemory::SINCE_BASELINE)) continue;
+        size_t first = page << DataMemory::PAGE_SHIFT;
+        size_t count = std::min(DataMemory::PAGE_WORDS, common - first);
+        if (memcmp(a.data() + first, b.data() + first, count * sizeof(int)) == 0) continue;
+        for (size_t i = first;; i++) {
+            if (a[i] != b[i]) return (int64_t)i;
+        }
+    }
+    return a.size() == b.size() ? -1 : (int64_t)common;
+}
+
+// A copy of a DataMemory in shared, read-only pages
+class MemorySnapshot {
+public:
+    typedef std::shared_ptr<const int[]> Page;
+
+    size_t words = 0;
+    std::vector<Page> pages;
+    size_t ownPages = 0;              // pages this snapshot copied (the rest are shared with an earlier one)
+
+    // Copies memory. base is the snapshot memory was last taken as or restored from (nullptr = none):
+    // the pages not written since then are shared with it.
+    void take(DataMemory& memory, const MemorySnapshot* base) {
+        words = memory.size();
+        pages.assign(memory.pages(), Page());
+        ownPages = 0;
+        for (size_t p = 0; p < pages.size(); p++) {
+            if (base && p < base->pages.size() && !(memory.pageState(p) & DataMemory::SINCE_CHECKPOINT) &&
+                pageWords(p) == base->pageWords(p)) {
+                pages[p] = base->pages[p];
+                continue;
+            }
+            std::shared_ptr<int[]> copy(new int[DataMemory::PAGE_WORDS]);
+            memcpy(copy.get(), memory.data() + (p << DataMemory::PAGE_SHIFT), pageWords(p) * sizeof(int));
+            pages[p] = std::move(copy);
+            ownPages++;
+        }
+        memory.clearCheckpointBits();
+    }
+
+    // Puts memory back to this snapshot. base as for take(): only pages written since then, or
+    // different between the two snapshots, are copied. Returns the pages copied.
+    size_t restore(DataMemory& memory, const MemorySnapshot* base) const {
+        if (memory.size() != words) memory.resize(words, 0);
+        size_t copied = 0;
+        for (size_t p = 0; p < pages.size(); p++) {
+            if (base && p < base->pages.size() && base->pages[p] == pages[p] &&
+                !(memory.pageState(p) & DataMemory::SINCE_CHECKPOINT)) {
+                continue;
+            }
+            size_t first = p << DataMemory::PAGE_SHIFT;
+            memcpy(memory.data() + first, pages[p].get(), pageWords(p) * sizeof(int));
+            memory.markDirty(first, pageWords(p));
+            copied++;
+        }
+        memory.clearCheckpointBits();
+        return copied;
+    }
+
+    // Words of page p (the last page can be partial)
+    size_t pageWords(size_t p) const {
+        return std::min(DataMemory::PAGE_WORDS, words - (p << DataMemory::PAGE_SHIFT));
+    }
+
+    size_t bytes() const { return pages.size() * sizeof(Page) + ownPages * DataMemory::PAGE_WORDS * sizeof(int); }
+};
+
+#endif
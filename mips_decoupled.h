@@ -0,0 +1,131 @@
+/*
+================================================================================
+                        DECOUPLED FUNCTIONAL / TIMING SIMULATION
+================================================================================
+
+In the normal engines the timing model runs inside the instruction loop:
+every instruction is executed and then retire()d into the pipeline model
+before the next one starts, so a detailed run costs functional time PLUS
+timing time. Here the two run on separate host threads:
+
+    functional thread   Cpu<QueueTrace, Memory, NoTiming>: executes the
+                        program and pushes one InstrEvent per instruction
+                        into an EventRing
+    timing thread       pops the events and retire()s them into the timing
+                        model (PipelineTiming, OooTiming, ...)
+
+so with two host cores a detailed run takes about as long as the slower of
+the two halves instead of their sum.
+
+EventRing is a single-producer / single-consumer ring with no locks: the
+producer only writes "tail", the consumer only writes "head", and each side
+publishes its index once per batch of events (an atomic store with release
+ordering), so the threads touch the shared indexes rarely and the events
+themselves are plain memory. When the ring is full the producer waits, when
+it is empty the consumer waits (spinning briefly, then yielding the core).
+
+No rollback is needed: in this simulator the timing models only observe the
+instruction stream, nothing they compute (cycles, cache hits) changes what
+the program does, so the functional thread can run ahead as far as the ring
+allows. The results are the same as the coupled engine's, to the cycle.
+================================================================================
+*/
+#ifndef MIPS_DECOUPLED_H
+#define MIPS_DECOUPLED_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "mips_cpu.h"
+
+class EventRing {
+public:
+    static const size_t CAPACITY = 1 << 16;        // events (a power of two)
+    static const size_t BATCH = 512;               // events published at a time
+
+    EventRing() : slots(CAPACITY) {}
+
+    // Producer side
+    void push(const InstrEvent& ev) {
+        if (tail - headSeen == CAPACITY) {
+            publish();
+            while (tail - (headSeen = head.load(std::memory_order_acquire)) == CAPACITY) wait(fullWaits);
+        }
+        slots[tail & (CAPACITY - 1)] = ev;
+        if (++tail % BATCH == 0) publish();
+    }
+
+    // Producer side: no more events
+    void finish() {
+        publish();
+        done.store(true, std::memory_order_release);
+    }
+
+    // Consumer side: hands every event to timing.retire() until finish() and the ring is empty
+    template <class Timing>
+    void drain(Timing& timing) {
+        uint64_t next = 0;
+        while (true) {
+            uint64_t available = published.load(std::memory_order_acquire);
+            if (available == next) {
+                if (done.load(std::memory_order_acquire) && published.load(std::memory_order_acquire) == next) break;
+                wait(emptyWaits);
+                continue;
+            }
+            for (; next != available; next++) timing.retire(slots[next & (CAPACITY - 1)]);
+            head.store(next, std::memory_order_release);
+        }
+    }
+
+    // Times either side had to wait; read once both threads are done
+    uint64_t stalls() const { return fullWaits + emptyWaits; }
+
+private:
+    std::vector<InstrEvent> slots;
+    // Each index on its own cache line, so the two threads do not fight over one line
+    alignas(64) std::atomic<uint64_t> published{0};    // written by the producer
+    alignas(64) std::atomic<uint64_t> head{0};         // written by the consumer
+    alignas(64) std::atomic<bool> done{false};
+    alignas(64) uint64_t tail = 0;                     // producer's own copies
+    uint64_t headSeen = 0;
+    uint64_t fullWaits = 0;                            // producer waits, ring full
+    alignas(64) uint64_t emptyWaits = 0;               // consumer's own: waits, ring empty
+
+    void publish() { published.store(tail, std::memory_order_release); }
+
+    // Spin a little (the other side is usually about to catch up), then give the core away
+    // (each side counts in its own counter, so the two never write the same memory)
+    void wait(uint64_t& waits) {
+        waits++;
+        for (int i = 0; i < 64; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        std::this_thread::yield();
+    }
+};
+
+// QueueTrace: pushes every executed instruction into an EventRing
+struct QueueTrace {
+    static constexpr const char* name = "QueueTrace";
+    static constexpr bool enabled = true;
+    EventRing* ring = nullptr;
+    void record(const Machine&, const Decoded&, const InstrEvent& ev) { ring->push(ev); }
+};
+
+// Runs up to maxInstructions of m on this thread and the timing model on a second one
+template <class Memory, class Timing>
+uint64_t runDecoupled(Machine& m, Timing& timing, uint64_t maxInstructions) {
+    EventRing ring;
+    std::thread timingThread([&] { ring.drain(timing); });
+    Cpu<QueueTrace, Memory, NoTiming> cpu(m);
+    cpu.trace.ring = &ring;
+    uint64_t executed = cpu.run(maxInstructions);
+    ring.finish();
+    timingThread.join();
+    return executed;
+}
+
+#endif
@@ -0,0 +1,241 @@
+/*
+================================================================================
+                        LIGHTWEIGHT HARTS ON COROUTINES
+================================================================================
+
+Simulates hundreds or thousands of simple harts (hardware threads) on a few
+host threads, for throughput-server style workloads where every hart serves
+its own request:
+
+    hart        a Machine of its own (registers, pc, PRIVATE data memory)
+                running the program on the plain Cpu engine; like the cores
+                of mips_multicore.h it starts with $k0 = hart number and
+                $k1 = number of harts
+    coroutine   each hart's loop is a C++20 coroutine: run one quantum of
+                instructions, then co_await, which hands the host thread back
+                to the scheduler (a suspended hart is just its coroutine frame
+                and its Machine, no host stack)
+    scheduler   a pool of host worker threads, each with its own queue of
+                ready harts: a worker resumes the hart at the front of its
+                queue and puts it at the back when the quantum is over; a
+                worker whose queue is empty STEALS half of another worker's
+                queue (from the back), so the load evens out by itself
+
+On a host with several NUMA nodes a hart copies its memory when it first
+runs, so the copy is allocated on the node of that worker (mips_hostmem.h).
+Harts stolen later keep their memory where it is.
+
+Every hart has its own memory and runs up to --max instructions of its own,
+so the harts never see each other and the results are the same for any
+quantum and any number of workers; only hart 0's syscall output goes to the
+terminal. The quantum trades how evenly the harts advance (and how often
+work can move between workers) against scheduling overhead: every quantum
+costs one suspend, one resume and one queue operation.
+
+The queues are short critical sections under a mutex per worker (one lock
+per quantum, contended only while stealing), which is cheap next to a
+quantum of a few hundred instructions or more.
+================================================================================
+*/
+#ifndef MIPS_HARTS_H
+#define MIPS_HARTS_H
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "mips_cpu.h"
+#include "mips_syscall.h"
+
+// The coroutine type of a hart's loop: starts suspended, the scheduler resumes it
+struct HartTask {
+    struct promise_type {
+        HartTask get_return_object() { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+struct HartConfig {
+    int harts = 1000;
+    unsigned workers = 0;             // host threads (0 = one per host core)
+    uint64_t quantum = 1000;          // instructions per turn
+};
+
+template <class Memory>
+class HartPool {
+public:
+    // One hart: its state, its engine and its (quiet) syscall handler
+    struct Hart {
+        Machine machine;
+        Cpu<NoTrace, Memory, NoTiming> cpu;
+        SpimSyscalls quiet;
+        std::coroutine_handle<> task;     // its loop (see loop())
+        uint64_t turns = 0;
+        explicit Hart(const Machine& m) : machine(m), cpu(machine), quiet(nullptr, nullptr) {}
+    };
+
+    // What each worker did (a cache line each, the workers update them all the time)
+    struct alignas(64) WorkerStats {
+        uint64_t turns = 0;
+        uint64_t steals = 0;          // successful steals
+        uint64_t stolen = 0;          // harts taken by those steals
+        uint64_t instructions = 0;
+    };
+
+    HartConfig config;
+    std::vector<std::unique_ptr<Hart>> harts;
+    std::vector<WorkerStats> stats;
+
+    // Copies the loaded state of m to every hart; hart 0 keeps m's syscall handler
+    HartPool(const Machine& m, const HartConfig& c) : config(c) {
+        if (config.workers == 0) config.workers = std::thread::hardware_concurrency();
+        if (config.workers == 0) config.workers = 1;
+        for (int i = 0; i < config.harts; i++) {
+            harts.emplace_back(new Hart(m));
+            Machine& h = harts.back()->machine;
+            h.registers[26] = i;
+            h.registers[27] = config.harts;
+            if (i > 0) h.os = &harts.back()->quiet;
+        }
+    }
+
+    // Runs every hart until it stops or has executed maxInstructions; returns the instructions of all harts
+    uint64_t run(uint64_t maxInstructions) {
+        unsigned n = config.workers;
+        queues = std::vector<Queue>(n);
+        stats.assign(n, WorkerStats());
+        remaining = (int64_t)harts.size();
+        for (size_t i = 0; i < harts.size(); i++) {
+            harts[i]->task = loop(*harts[i], maxInstructions).handle;
+            queues[i % n].ready.push_back(harts[i].get());
+        }
+
+        std::vector<std::thread> threads;
+        for (unsigned w = 1; w < n; w++) threads.emplace_back([this, w] { work(w); });
+        work(0);
+        for (std::thread& t : threads) t.join();
+
+        uint64_t total = 0;
+        for (const auto& h : harts) {
+            h->task.destroy();
+            total += h->machine.instructions;
+        }
+        return total;
+    }
+
+    void report(std::ostream& out) const {
+        uint64_t turns = 0, steals = 0, fewest = UINT64_MAX, most = 0;
+        for (const WorkerStats& s : stats) {
+            turns += s.turns;
+            steals += s.steals;
+        }
+        for (const auto& h : harts) {
+            fewest = std::min(fewest, h->machine.instructions);
+            most = std::max(most, h->machine.instructions);
+        }
+        out << "Harts: " << harts.size() << " on " << config.workers << " worker threads (quantum "
+            << config.quantum << " instructions), " << turns << " turns, " << steals << " steals" << std::endl;
+        out << "  instructions per hart: " << fewest << " to " << most << std::endl;
+        const ProgramText& text = harts[0]->machine.text;
+        out << "  predecoded program: " << text.size() << " instructions (" << text.size() * sizeof(Decoded) / 1024.0
+            << " KB), one copy shared by " << text.sharers() << " machines" << std::endl;
+        out << "  worker         turns  steals  harts stolen  instructions" << std::endl;
+        for (size_t w = 0; w < stats.size(); w++) {
+            const WorkerStats& s = stats[w];
+            out << "  " << std::setw(6) << w << std::setw(14) << s.turns << std::setw(8) << s.steals << std::setw(14)
+                << s.stolen << std::setw(14) << s.instructions << std::endl;
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<Hart*> ready;
+    };
+
+    std::vector<Queue> queues;
+    std::atomic<int64_t> remaining{0};   // harts not finished yet
+
+    // A hart's life: one quantum per resume
+    HartTask loop(Hart& hart, uint64_t maxInstructions) {
+        Machine& m = hart.machine;
+        if (HostMemory::numa && HostMemory::nodes() > 1) {
+            DataMemory local(m.memory);
+            m.memory.swap(local);
+        }
+        while (!m.halted && m.instructions < maxInstructions) {
+            hart.cpu.run(std::min(config.quantum, maxInstructions - m.instructions));
+            hart.turns++;
+            co_await std::suspend_always{};
+        }
+    }
+
+    void work(unsigned self) {
+        WorkerStats& mine = stats[self];
+        Queue& own = queues[self];
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            Hart* h = nullptr;
+            {
+                std::lock_guard<std::mutex> guard(own.lock);
+                if (!own.ready.empty()) {
+                    h = own.ready.front();
+                    own.ready.pop_front();
+                }
+            }
+            if (!h && !steal(self)) {
+                std::this_thread::yield();
+                continue;
+            }
+            if (!h) continue;
+
+            uint64_t before = h->machine.instructions;
+            h->task.resume();
+            mine.turns++;
+            mine.instructions += h->machine.instructions - before;
+            if (h->task.done()) {
+                remaining.fetch_sub(1, std::memory_order_acq_rel);
+            } else {
+                std::lock_guard<std::mutex> guard(own.lock);
+                own.ready.push_back(h);
+            }
+        }
+    }
+
+    // Takes half of the first non-empty queue found after our own; false if every queue is empty
+    bool steal(unsigned self) {
+        unsigned n = (unsigned)queues.size();
+        for (unsigned k = 1; k < n; k++) {
+            Queue& victim = queues[(self + k) % n];
+            std::deque<Hart*> taken;
+            {
+                std::lock_guard<std::mutex> guard(victim.lock);
+                size_t half = (victim.ready.size() + 1) / 2;
+                for (size_t i = 0; i < half; i++) {
+                    taken.push_front(victim.ready.back());
+                    victim.ready.pop_back();
+                }
+            }
+            if (taken.empty()) continue;
+            stats[self].steals++;
+            stats[self].stolen += taken.size();
+            std::lock_guard<std::mutex> guard(queues[self].lock);
+            queues[self].ready.insert(queues[self].ready.end(), taken.begin(), taken.end());
+            return true;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,209 @@
+/*
+================================================================================
+                        MEMORY HIERARCHY BEHIND THE L1 CACHES
+================================================================================
+
+Without a hierarchy every L1 miss costs the cache's fixed missPenalty. With
+one, an L1 miss goes to:
+
+    L2      a unified, larger, slower cache (Cache from mips_cache.h)
+    DRAM    on an L2 miss. Memory is split into banks; each bank keeps the
+            last row it opened in its row buffer:
+              row hit       the row is already open          rowHitLatency
+              row miss      close it, open the new row       rowMissLatency
+            A bank still busy with an earlier access makes the new one wait
+            (a bank conflict), and every line crosses one shared data bus
+            that moves busBytesPerCycle, which limits the bandwidth.
+
+A prefetcher can watch the L2 accesses and bring lines in early:
+    next-line   an L2 miss on line L also fetches line L+1
+    stride      a table indexed by the load/store PC learns the distance
+                between consecutive accesses of that instruction and, once the
+                same stride is seen twice, fetches the line one stride ahead
+Prefetches go into the L2 and use DRAM bandwidth but never delay the access
+that triggered them (they are assumed to arrive in time). A prefetch is
+"useful" if a demand access hits the line before it is fetched again.
+
+Several cores' timing models can point at one MemoryHierarchy (a shared L2)
+or each have their own (private L2s).
+
+Addresses are word addresses, as in mips_cache.h. Instruction fetches (the
+pc, an instruction index) are moved up by TEXT_BASE first, so code and data
+never share an L2 line or a DRAM row and next-line prefetches after an
+instruction miss fetch code.
+================================================================================
+*/
+#ifndef MIPS_HIERARCHY_H
+#define MIPS_HIERARCHY_H
+
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <unordered_set>
+#include <vector>
+#include "mips_cache.h"
+
+struct DramConfig {
+    uint32_t banks = 8;
+    uint32_t rowWords = 512;          // 2 KB rows
+    uint32_t rowHitLatency = 40;      // cycles, row already open
+    uint32_t rowMissLatency = 80;     // cycles, precharge + activate + read
+    uint32_t busBytesPerCycle = 8;
+};
+
+class Dram {
+public:
+    DramConfig config;
+    uint64_t accesses = 0;
+    uint64_t rowHits = 0;
+    uint64_t bankConflicts = 0;       // accesses that waited for a busy bank
+    uint64_t bytes = 0;               // bytes moved over the bus
+
+    explicit Dram(const DramConfig& c = DramConfig())
+        : config(c), openRow(c.banks, NO_ROW), bankFree(c.banks, 0) {}
+
+    // Reads or writes one line starting at cycle now; returns the cycles until its data is through
+    uint32_t access(uint64_t addr, uint32_t lineWords, uint64_t now) {
+        accesses++;
+        uint64_t row = addr / config.rowWords;
+        size_t bank = (size_t)(row % config.banks);   // consecutive rows sit in different banks
+
+        uint64_t start = now;
+        if (bankFree[bank] > start) {
+            bankConflicts++;
+            start = bankFree[bank];
+        }
+        uint64_t ready = start;
+        if (openRow[bank] == row) {
+            rowHits++;
+            ready += config.rowHitLatency;
+        } else {
+            ready += config.rowMissLatency;
+            openRow[bank] = row;
+        }
+        bankFree[bank] = ready;
+
+        // Then the line takes its turn on the data bus
+        uint32_t lineBytes = lineWords * 4;
+        uint64_t transfer = ready > busFree ? ready : busFree;
+        busFree = transfer + (lineBytes + config.busBytesPerCycle - 1) / config.busBytesPerCycle;
+        bytes += lineBytes;
+        return (uint32_t)(busFree - now);
+    }
+
+    double rowHitRate() const { return accesses ? (double)rowHits / accesses : 0.0; }
+
+private:
+    static const uint64_t NO_ROW = ~0ull;
+    std::vector<uint64_t> openRow;    // row held in each bank's row buffer
+    std::vector<uint64_t> bankFree;   // cycle each bank finishes its current access
+    uint64_t busFree = 0;
+};
+
+enum PrefetchKind { PREFETCH_NONE, PREFETCH_NEXT_LINE, PREFETCH_STRIDE };
+
+struct HierarchyConfig {
+    CacheConfig l2 = {512, 8, 16, 0};   // 256 KB; missPenalty is unused here
+    uint32_t l2Latency = 12;            // cycles for an L2 hit
+    DramConfig dram;
+    PrefetchKind prefetch = PREFETCH_NONE;
+};
+
+class MemoryHierarchy {
+public:
+    // Where instruction fetches live: above any data word address, translated ones included
+    static const uint64_t TEXT_BASE = (uint64_t)1 << 40;
+
+    HierarchyConfig config;
+    Cache l2;
+    Dram dram;
+    uint64_t requests = 0;            // L1 misses that came here
+    uint64_t latency = 0;             // total cycles they took
+    uint64_t prefetches = 0;          // lines prefetched
+    uint64_t usefulPrefetches = 0;    // prefetched lines a demand access hit
+
+    explicit MemoryHierarchy(const HierarchyConfig& c = HierarchyConfig())
+        : config(c), l2(c.l2), dram(c.dram), strides(STRIDE_ENTRIES) {}
+
+    // An L1 miss at cycle now: returns the extra cycles until the word arrives.
+    // pc is the instruction doing the access (for the stride prefetcher), data is
+    // false for instruction fetches.
+    uint32_t access(uint64_t addr, uint64_t now, uint32_t pc, bool data) {
+        if (!data) addr += TEXT_BASE;
+        requests++;
+        uint64_t line = addr / config.l2.lineWords;
+        uint32_t cycles = config.l2Latency;
+        if (l2.access(addr)) {
+            if (pending.erase(line)) usefulPrefetches++;
+        } else {
+            pending.erase(line);
+            cycles += dram.access(addr, config.l2.lineWords, now + config.l2Latency);
+            if (config.prefetch == PREFETCH_NEXT_LINE) prefetch(line + 1, now);
+        }
+        if (config.prefetch == PREFETCH_STRIDE && data) trainStride(addr, pc, now);
+        latency += cycles;
+        return cycles;
+    }
+
+    // Warm-up (PipelineTiming::warm in a sampled run's warm-up window): fill the L2 without counting anything
+    void warm(uint64_t addr, bool data) { l2.touch(data ? addr : addr + TEXT_BASE); }
+
+    double averageLatency() const { return requests ? (double)latency / requests : 0.0; }
+    double prefetchAccuracy() const { return prefetches ? (double)usefulPrefetches / prefetches : 0.0; }
+
+    void report(std::ostream& out, uint64_t cycles) const {
+        const char* kinds[] = {"none", "next-line", "stride"};
+        out << std::fixed << std::setprecision(3);
+        out << "  L2: " << l2.accesses << " accesses, miss rate " << l2.missRate() * 100
+            << "%, average L1 miss latency " << std::setprecision(1) << averageLatency() << " cycles" << std::endl;
+        out << "  DRAM: " << dram.accesses << " accesses, row-buffer hit rate " << dram.rowHitRate() * 100
+            << "%, bank conflicts " << dram.bankConflicts << ", " << dram.bytes << " bytes ("
+            << std::setprecision(3) << (cycles ? (double)dram.bytes / cycles : 0.0) << " bytes/cycle)" << std::endl;
+        out << "  prefetcher: " << kinds[config.prefetch];
+        if (config.prefetch != PREFETCH_NONE) {
+            out << ", " << prefetches << " prefetches, accuracy " << std::setprecision(1)
+                << prefetchAccuracy() * 100 << "%";
+        }
+        out << std::endl << std::defaultfloat;
+    }
+
+private:
+    struct StrideEntry {
+        uint32_t pc = ~0u;
+        uint64_t lastAddr = 0;
+        int64_t stride = 0;
+        bool confident = false;
+    };
+    static const size_t STRIDE_ENTRIES = 64;
+
+    std::vector<StrideEntry> strides;
+    std::unordered_set<uint64_t> pending;   // prefetched lines not used yet
+
+    void prefetch(uint64_t line, uint64_t now) {
+        uint64_t addr = line * config.l2.lineWords;
+        if (l2.contains(addr)) return;
+        prefetches++;
+        l2.touch(addr);
+        pending.insert(line);
+        dram.access(addr, config.l2.lineWords, now);
+    }
+
+    void trainStride(uint64_t addr, uint32_t pc, uint64_t now) {
+        StrideEntry& e = strides[pc % STRIDE_ENTRIES];
+        if (e.pc != pc) {
+            e = StrideEntry();
+            e.pc = pc;
+            e.lastAddr = addr;
+            return;
+        }
+        int64_t stride = (int64_t)addr - (int64_t)e.lastAddr;
+        e.confident = stride != 0 && stride == e.stride;
+        e.stride = stride;
+        e.lastAddr = addr;
+        if (e.confident && (int64_t)addr + stride >= 0) {
+            prefetch((uint64_t)((int64_t)addr + stride) / config.l2.lineWords, now);
+        }
+    }
+};
+
+#endif
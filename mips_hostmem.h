@@ -0,0 +1,222 @@
+/*
+================================================================================
+                        HOST MEMORY FOR THE SIMULATED RAM
+================================================================================
+
+A simulated data memory of a few GB is a few GB of host memory that the
+engines touch all over. With the host's normal 4 KB pages every lw/sw to a
+new 4 KB of simulated memory needs its own host TLB entry, and big heaps
+spend much of their time in host page walks. DataMemory (the type of
+Machine::memory, mips_datamem.h) keeps its words in a block from HostMemory,
+which takes large memories straight from the kernel:
+
+    huge pages    memories of 2 MB or more are mapped 2 MB aligned and
+                  madvise()d for transparent huge pages, so one host TLB
+                  entry covers 2 MB of simulated memory (when the kernel has
+                  THP set to "madvise" or "always"; with "never" nothing
+                  changes). Turned off, they are madvise()d NOHUGEPAGE, so
+                  the two can be compared even with THP "always".
+    NUMA          on a host with several NUMA nodes, mapped memories are
+                  bound (preferred, not strict) to the node of the thread
+                  that allocates them. The harts of mips_harts.h copy their
+                  private memory on the worker thread that first runs them,
+                  so it lands next to that worker.
+    growing       sbrk grows the memory a little at a time. A mapped block is
+                  resized with mremap: in place when the address space after
+                  it is free, otherwise its pages are moved (not copied) to a
+                  new huge-page aligned range. Either way nothing is copied,
+                  the new words are the kernel's zero pages until they are
+                  touched, and exactly the memory's size stays mapped.
+
+Small memories (the default 256 words) come from operator new as before.
+Without Linux everything does. The dTLB-misses column of --perf
+(mips_perf.h) shows the difference; --no-huge-pages and --no-numa turn the
+two off.
+
+The multi-core machine (mips_multicore.h) runs all its cores on one host
+thread over ONE shared memory, so there is nothing per core to place there.
+================================================================================
+*/
+#ifndef MIPS_HOSTMEM_H
+#define MIPS_HOSTMEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <ostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class HostMemory {
+public:
+    static const size_t HUGE_PAGE = 2 << 20;
+    static const size_t MAPPED = 64 << 10;   // smaller memories come from operator new
+
+    // Settings (set before the memories are allocated)
+    static inline bool hugePages = true;
+    static inline bool numa = true;
+
+    static inline std::atomic<uint64_t> mappedBytes{0};   // mapped right now
+    static inline std::atomic<uint64_t> placedBytes{0};   // mapped so far and bound to a NUMA node
+
+    static void* allocate(size_t bytes) {
+#ifdef __linux__
+        // release() tells mapped blocks by their size, so these can only come from mmap
+        if (bytes >= MAPPED) {
+            size_t size = mappedSize(bytes);
+            void* p = map(size);
+            if (!p) throw std::bad_alloc();
+            mappedBytes += size;
+            if (place(p, size)) placedBytes += size;
+            return p;
+        }
+#endif
+        return ::operator new(bytes);
+    }
+
+    /*
+    Resizes a block from allocate() to newBytes, keeping the first
+    min(oldBytes, newBytes) bytes (p may be nullptr for oldBytes 0). The bytes
+    from "zero" on are known to be zero (fresh pages); those between oldBytes
+    and zero hold whatever they held.
+    */
+    static void* reallocate(void* p, size_t oldBytes, size_t newBytes, size_t& zero) {
+#ifdef __linux__
+        if (p && oldBytes >= MAPPED && newBytes >= MAPPED) {
+            size_t from = mappedSize(oldBytes), to = mappedSize(newBytes);
+            zero = std::min(from, newBytes);
+            if (from == to) return p;
+            // In place keeps the huge-page alignment only if the block already had it
+            void* q = from >= HUGE_PAGE || to < HUGE_PAGE ? mremap(p, from, to, 0) : MAP_FAILED;
+            if (q == MAP_FAILED) {
+                void* target = map(to);
+                if (!target) throw std::bad_alloc();
+                q = mremap(p, from, to, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+                if (q == MAP_FAILED) {
+                    munmap(target, to);
+                    throw std::bad_alloc();
+                }
+            }
+            mappedBytes += to;
+            mappedBytes -= from;
+            if (to > from && place(q, to)) placedBytes += to - from;
+            return q;
+        }
+#endif
+        void* q = newBytes ? allocate(newBytes) : nullptr;
+        if (p) {
+            memcpy(q, p, std::min(oldBytes, newBytes));
+            release(p, oldBytes);
+        }
+        zero = newBytes >= MAPPED ? std::min(oldBytes, newBytes) : newBytes;
+        return q;
+    }
+
+    static void release(void* p, size_t bytes) {
+#ifdef __linux__
+        if (bytes >= MAPPED) {
+            size_t size = mappedSize(bytes);
+            munmap(p, size);
+            mappedBytes -= size;
+            return;
+        }
+#endif
+        ::operator delete(p);
+    }
+
+    // NUMA nodes of the host (1 without NUMA)
+    static int nodes() {
+        static const int count = countNodes();
+        return count;
+    }
+
+    // Huge-page setting of the kernel ("always", "madvise", "never" or "" if unknown)
+    static std::string transparentHugePages() {
+        std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string line;
+        std::getline(in, line);
+        size_t open = line.find('['), close = line.find(']');
+        return open == std::string::npos || close == std::string::npos ? "" : line.substr(open + 1, close - open - 1);
+    }
+
+    // Bytes of this process actually backed by huge pages right now
+    static uint64_t hugeResidentBytes() {
+        std::ifstream in("/proc/self/smaps_rollup");
+        std::string key;
+        uint64_t kb = 0;
+        while (in >> key) {
+            if (key == "AnonHugePages:") {
+                in >> kb;
+                return kb * 1024;
+            }
+            in.ignore(1 << 10, '\n');
+        }
+        return 0;
+    }
+
+    static void report(std::ostream& out) {
+        std::string thp = transparentHugePages();
+        out << "Host memory: " << mappedBytes / (1 << 20) << " MB mapped for simulated memory, huge pages "
+            << (hugePages ? "on" : "off") << " (kernel THP: " << (thp.empty() ? "unknown" : thp) << "), "
+            << hugeResidentBytes() / (1 << 20) << " MB resident on huge pages";
+        if (nodes() > 1) out << "; " << placedBytes / (1 << 20) << " MB placed on " << nodes() << " NUMA nodes";
+        out << std::endl;
+    }
+
+private:
+    // Whole pages; whole huge pages from one huge page up, so the size is the same when it is freed
+    static size_t mappedSize(size_t bytes) {
+        size_t page = bytes >= HUGE_PAGE ? HUGE_PAGE : 4096;
+        return (bytes + page - 1) / page * page;
+    }
+
+#ifdef __linux__
+    // Anonymous memory, huge-page aligned if it is at least one huge page
+    static void* map(size_t size) {
+        size_t slack = size >= HUGE_PAGE ? HUGE_PAGE : 0;
+        void* raw = mmap(nullptr, size + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return nullptr;
+        uintptr_t start = (uintptr_t)raw;
+        uintptr_t aligned = slack ? (start + slack - 1) / slack * slack : start;
+        if (aligned > start) munmap(raw, aligned - start);
+        if (start + slack > aligned) munmap((void*)(aligned + size), start + slack - aligned);
+        return (void*)aligned;
+    }
+
+    // Huge pages (or not) and the NUMA node for a mapped block; true if it was bound to a node
+    static bool place(void* p, size_t size) {
+        if (size >= HUGE_PAGE) madvise(p, size, hugePages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+        return numa && nodes() > 1 && bind(p, size);
+    }
+
+    // Prefer the NUMA node of the calling thread for the pages of [p, p + size)
+    static bool bind(void* p, size_t size) {
+        unsigned cpu = 0, node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0 || node >= 64) return false;
+        unsigned long mask = 1ul << node;
+        return syscall(SYS_mbind, p, size, MPOL_PREFERRED, &mask, 64, 0) == 0;
+    }
+#endif
+
+    // /sys/devices/system/node/online is a list such as "0" or "0-3"
+    static int countNodes() {
+        std::ifstream in("/sys/devices/system/node/online");
+        std::string list;
+        if (!std::getline(in, list) || list.empty()) return 1;
+        size_t dash = list.rfind('-'), comma = list.rfind(',');
+        size_t from = dash == std::string::npos ? (comma == std::string::npos ? 0 : comma + 1) : dash + 1;
+        return std::stoi(list.substr(from)) + 1;
+    }
+};
+
+#endif
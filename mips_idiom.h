@@ -0,0 +1,276 @@
+/*
+================================================================================
+                        LOOP IDIOMS (BULK MEMORY OPERATIONS)
+================================================================================
+
+Copy, clear and scan loops are the same few instructions over and over:
+
+    memset                      memcpy                      strlen
+    L: sw   $v, 0($p)           L: lw   $t, 0($s)           L: lbu  $t, 0($p)
+       addi $p, $p, 1              sw   $t, 0($d)              addi $p, $p, 1
+       addi $n, $n, -1             addi $s, $s, 1              bne  $t, $0, L
+       bne  $n, $0, L              addi $d, $d, 1
+                                   addi $n, $n, -1
+                                   bne  $n, $0, L
+
+When a program is loaded, findLoopIdioms() looks for loops of this kind: a
+backward bne closing a body made only of addi "induction" updates (r = r + c),
+at most one load and at most one store walking memory one element (word or
+byte) per iteration, with either a counter/pointer compared to a register the
+loop does not change, or the loaded value compared to one (scan until a
+terminator, like strlen or strcpy). The instructions may come in any order.
+
+The closing bne is marked (Decoded::loop) and the fast engines (no trace, no
+timing model) call runLoopIdiom() when it is taken: the number of iterations
+left is worked out up front, and they are done as ONE host operation
+(std::fill / memset, memmove, a std::find / memchr scan), after which the
+registers get the values the last iteration would have left and the
+instruction count goes up by exactly the instructions skipped. Anything
+unusual (out-of-range addresses, overlap that a forward copy would smear,
+not enough instructions left before --max, counters that would wrap) makes
+it return 0 and the loop simply runs instruction by instruction.
+
+Byte loops use the memory as bytes in host order, so they are only
+recognized on little-endian hosts (byte k of M[i] is host byte 4*i + k).
+mipssim --no-idioms turns the recognition off to check the results.
+================================================================================
+*/
+#ifndef MIPS_IDIOM_H
+#define MIPS_IDIOM_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "mips_isa.h"
+#include "mips_datamem.h"
+
+// One recognized loop, with everything needed to run it in bulk
+struct LoopIdiom {
+    enum : uint8_t { COUNTED, SCAN };
+    static const int MAX_INDUCTIONS = 4;
+
+    uint32_t head = 0;                // first instruction of the body
+    uint32_t length = 0;              // instructions per iteration, bne included
+    uint8_t exit = COUNTED;           // COUNTED: an induction reaches a limit; SCAN: the loaded value does
+    uint8_t exitReg = 0;              // the induction (COUNTED) compared to...
+    uint8_t limitReg = 0;             // ...this register, which the loop does not write
+
+    int inductions = 0;
+    uint8_t inductionReg[MAX_INDUCTIONS];
+    int32_t step[MAX_INDUCTIONS];
+
+    // The load and the store; their address in iteration j is R[ptr] + j * step + offset
+    // (offset includes the step when the pointer is bumped before the access)
+    uint8_t loadOp = OP_UNKNOWN, loadPtr = 0, loadDst = 0;
+    int32_t loadOffset = 0;
+    uint8_t storeOp = OP_UNKNOWN, storePtr = 0, storeSrc = 0;
+    int32_t storeOffset = 0;
+    bool storeCopies = false;         // the store writes the loaded value (else an invariant register)
+};
+
+namespace idiom_detail {
+
+inline int inductionIndex(const LoopIdiom& loop, uint8_t reg) {
+    for (int i = 0; i < loop.inductions; i++) {
+        if (loop.inductionReg[i] == reg) return i;
+    }
+    return -1;
+}
+
+// Tries to read the body [head, branch] as a bulk loop
+inline bool analyze(const std::vector<Decoded>& text, uint32_t head, uint32_t branch, LoopIdiom& loop) {
+    loop.head = head;
+    loop.length = branch - head + 1;
+    if (loop.length < 3 || loop.length > 8) return false;
+
+    // Which registers are written, and how often
+    int writes[32] = {};
+    for (uint32_t i = head; i < branch; i++) {
+        const Decoded& d = text[i];
+        if (d.op == OP_ADDI) {
+            if (d.rt != d.rs || d.imm == 0 || loop.inductions == LoopIdiom::MAX_INDUCTIONS) return false;
+            loop.inductionReg[loop.inductions] = d.rt;
+            loop.step[loop.inductions++] = d.imm;
+            writes[d.rt]++;
+        } else if (d.op == OP_LW || d.op == OP_LB || d.op == OP_LBU) {
+            if (loop.loadOp != OP_UNKNOWN) return false;
+            loop.loadOp = d.op;
+            loop.loadPtr = d.rs;
+            loop.loadDst = d.rt;
+            loop.loadOffset = d.imm;
+            writes[d.rt]++;
+        } else if (d.op == OP_SW || d.op == OP_SB) {
+            if (loop.storeOp != OP_UNKNOWN) return false;
+            loop.storeOp = d.op;
+            loop.storePtr = d.rs;
+            loop.storeSrc = d.rt;
+            loop.storeOffset = d.imm;
+        } else {
+            return false;
+        }
+    }
+    for (int r = 0; r < 32; r++) {
+        if (writes[r] > 1) return false;
+    }
+    if (loop.loadOp == OP_UNKNOWN && loop.storeOp == OP_UNKNOWN) return false;
+
+    // Both accesses walk memory one element per iteration; a pointer bumped before
+    // the access shows up as an extra step in the offset
+    for (uint32_t i = head; i < branch; i++) {
+        const Decoded& d = text[i];
+        if (d.op != OP_ADDI) continue;
+        for (uint32_t j = i + 1; j < branch; j++) {
+            const Decoded& access = text[j];
+            if (isLoad(access.op) && access.rs == d.rt) loop.loadOffset += d.imm;
+            if (isStore(access.op) && access.rs == d.rt) loop.storeOffset += d.imm;
+        }
+    }
+    if (loop.loadOp != OP_UNKNOWN) {
+        int k = inductionIndex(loop, loop.loadPtr);
+        if (k < 0 || loop.step[k] != 1 || inductionIndex(loop, loop.loadDst) >= 0) return false;
+    }
+    if (loop.storeOp != OP_UNKNOWN) {
+        int k = inductionIndex(loop, loop.storePtr);
+        if (k < 0 || loop.step[k] != 1) return false;
+        if (loop.loadOp != OP_UNKNOWN && loop.storeSrc == loop.loadDst) {
+            // A copy: same element size, and the load comes first
+            if ((loop.loadOp == OP_LW) != (loop.storeOp == OP_SW)) return false;
+            for (uint32_t i = head; i < branch; i++) {
+                if (isStore(text[i].op)) return false;
+                if (isLoad(text[i].op)) break;
+            }
+            loop.storeCopies = true;
+        } else if (writes[loop.storeSrc] || loop.loadOp != OP_UNKNOWN) {
+            // A fill, and nothing else: a load next to it could read what the fill wrote
+            return false;
+        }
+    }
+    if (loop.loadOp != OP_UNKNOWN && (loop.loadPtr == loop.loadDst || loop.storePtr == loop.loadDst)) return false;
+
+    // How the loop ends: bne a, b with a changing and b fixed (either way round)
+    const Decoded& b = text[branch];
+    uint8_t moving = b.rs, fixed = b.rt;
+    if (writes[moving] == 0) std::swap(moving, fixed);
+    if (writes[moving] == 0 || writes[fixed] != 0) return false;
+    loop.limitReg = fixed;
+    if (inductionIndex(loop, moving) >= 0) {
+        loop.exit = LoopIdiom::COUNTED;
+        loop.exitReg = moving;
+    } else if (loop.loadOp != OP_UNKNOWN && moving == loop.loadDst) {
+        loop.exit = LoopIdiom::SCAN;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Value a load of the given kind produces at addr (a word address for lw, else a byte address)
+inline int loadValue(uint8_t op, const int* M, int64_t addr) {
+    if (op == OP_LW) return M[addr];
+    uint32_t byte = ((uint32_t)M[addr >> 2] >> ((addr & 3) * 8)) & 0xFF;
+    return op == OP_LB ? (int)(int8_t)byte : (int)byte;
+}
+
+}  // namespace idiom_detail
+
+// Finds the bulk loops of a predecoded program and marks their closing bne (Decoded::loop)
+inline std::vector<LoopIdiom> findLoopIdioms(std::vector<Decoded>& text) {
+    std::vector<LoopIdiom> loops;
+    if constexpr (std::endian::native != std::endian::little) return loops;
+    std::vector<uint32_t> targets;
+    for (const Decoded& d : text) {
+        if (isBranch(d.op)) targets.push_back(d.target);
+    }
+    std::sort(targets.begin(), targets.end());
+    for (uint32_t pc = 0; pc < text.size(); pc++) {
+        Decoded& d = text[pc];
+        if (d.op != OP_BNE || d.target >= pc || loops.size() == 255) continue;
+        // Nothing may jump into the middle of the body
+        bool entered = std::upper_bound(targets.begin(), targets.end(), d.target) !=
+                       std::upper_bound(targets.begin(), targets.end(), pc);
+        LoopIdiom loop;
+        if (!entered && idiom_detail::analyze(text, d.target, pc, loop)) {
+            loops.push_back(loop);
+            d.loop = (uint8_t)loops.size();
+        }
+    }
+    return loops;
+}
+
+/*
+Runs the rest of a loop whose closing bne was just taken (so the registers
+are at the top of an iteration). Returns the instructions it stands for, or
+0 if the loop has to run instruction by instruction. budget is how many
+instructions may still be executed.
+*/
+inline uint64_t runLoopIdiom(const LoopIdiom& loop, int* R, DataMemory& memory, uint64_t budget) {
+    using idiom_detail::inductionIndex;
+    const int64_t words = (int64_t)memory.size();
+    int* M = memory.data();
+    bool byteLoad = loop.loadOp == OP_LB || loop.loadOp == OP_LBU;
+    bool byteStore = loop.storeOp == OP_SB;
+    int64_t loadStart = (int64_t)R[loop.loadPtr] + loop.loadOffset;
+    int64_t storeStart = (int64_t)R[loop.storePtr] + loop.storeOffset;
+    int64_t loadLimit = byteLoad ? words * 4 : words;
+
+    // Iterations left
+    int64_t n = 0;
+    if (loop.exit == LoopIdiom::COUNTED) {
+        int k = inductionIndex(loop, loop.exitReg);
+        int64_t distance = (int64_t)R[loop.limitReg] - R[loop.exitReg];
+        if (distance == 0 || distance % loop.step[k] != 0 || distance / loop.step[k] <= 0) return 0;
+        n = distance / loop.step[k];
+    } else {
+        // Scan for the terminator within memory; not finding it means the loop runs off the end
+        if (loadStart < 0 || loadStart >= loadLimit) return 0;
+        int target = R[loop.limitReg];
+        if (byteLoad) {
+            if (loop.loadOp == OP_LBU ? (target < 0 || target > 255) : (target < -128 || target > 127)) return 0;
+            const uint8_t* bytes = (const uint8_t*)M;
+            const void* hit = memchr(bytes + loadStart, (uint8_t)target, (size_t)(loadLimit - loadStart));
+            if (!hit) return 0;
+            n = (const uint8_t*)hit - (bytes + loadStart) + 1;
+        } else {
+            const int* hit = std::find(M + loadStart, M + words, target);
+            if (hit == M + words) return 0;
+            n = hit - (M + loadStart) + 1;
+        }
+    }
+    if ((uint64_t)n * loop.length > budget || n < 2) return 0;
+
+    // Every address has to be in range, and the inductions must not wrap
+    if (loop.loadOp != OP_UNKNOWN && (loadStart < 0 || loadStart + n > loadLimit)) return 0;
+    if (loop.storeOp != OP_UNKNOWN && (storeStart < 0 || storeStart + n > (byteStore ? words * 4 : words))) return 0;
+    for (int i = 0; i < loop.inductions; i++) {
+        int64_t end = (int64_t)R[loop.inductionReg[i]] + n * loop.step[i];
+        if (end < INT32_MIN || end > INT32_MAX) return 0;
+    }
+
+    if (loop.storeOp != OP_UNKNOWN) {
+        if (loop.storeCopies) {
+            // A forward copy onto a destination just ahead of the source repeats the data: leave it alone
+            if (storeStart > loadStart && storeStart < loadStart + n) return 0;
+            if (byteStore) memmove((uint8_t*)M + storeStart, (const uint8_t*)M + loadStart, (size_t)n);
+            else memmove(M + storeStart, M + loadStart, (size_t)n * sizeof(int));
+        } else if (byteStore) {
+            memset((uint8_t*)M + storeStart, (uint8_t)R[loop.storeSrc], (size_t)n);
+        } else {
+            std::fill(M + storeStart, M + storeStart + n, R[loop.storeSrc]);
+        }
+        if (byteStore) memory.markDirty((size_t)storeStart / 4, (size_t)((storeStart + n + 3) / 4 - storeStart / 4));
+        else memory.markDirty((size_t)storeStart, (size_t)n);
+    }
+    // The registers as the last iteration leaves them. A copy never writes over source
+    // elements it has yet to read, so the last one loaded is still in memory.
+    if (loop.loadOp != OP_UNKNOWN) {
+        R[loop.loadDst] = idiom_detail::loadValue(loop.loadOp, M, loadStart + n - 1);
+    }
+    for (int i = 0; i < loop.inductions; i++) {
+        R[loop.inductionReg[i]] = (int)((uint32_t)R[loop.inductionReg[i]] + (uint32_t)(n * loop.step[i]));
+    }
+    return (uint64_t)n * loop.length;
+}
+
+#endif
@@ -0,0 +1,283 @@
+/*
+================================================================================
+                        MIPS INSTRUCTION SET (DECODER)
+================================================================================
+
+Shared instruction decoding for the mipssim simulator engines.
+
+The classroom programs (finalreview.cpp and friends) turn every instruction
+into a binary STRING and use substr()/stoi() to pull out the fields. That is
+easy to read but far too slow when we want to run millions of instructions,
+so here we do the same field extraction with shifts and masks and we do it
+ONCE per instruction when the program is loaded ("predecoding").
+
+  R-format: [opcode 31-26] [rs 25-21] [rt 20-16] [rd 15-11] [shamt 10-6] [funct 5-0]
+  I-format: [opcode 31-26] [rs 25-21] [rt 20-16] [immediate 15-0]
+
+Each instruction is turned into a Decoded record holding a small Op number
+(used by the engines' dispatch table), the register fields, the sign-extended
+immediate and, for branches, the absolute branch target.
+================================================================================
+*/
+#ifndef MIPS_ISA_H
+#define MIPS_ISA_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sstream>
+
+// Operation numbers used by the execution engines (one per supported instruction)
+enum Op : uint8_t {
+    OP_ADD,      // add  rd, rs, rt   (funct 32)
+    OP_SUB,      // sub  rd, rs, rt   (funct 34)
+    OP_AND,      // and  rd, rs, rt   (funct 36)
+    OP_OR,       // or   rd, rs, rt   (funct 37)
+    OP_XOR,      // xor  rd, rs, rt   (funct 38)
+    OP_ADDI,     // addi rt, rs, imm  (opcode 8)
+    OP_LW,       // lw   rt, imm(rs)  (opcode 35)
+    OP_SW,       // sw   rt, imm(rs)  (opcode 43)
+    OP_BEQ,      // beq  rs, rt, imm  (opcode 4)
+    OP_BNE,      // bne  rs, rt, imm  (opcode 5)
+    // Shifts
+    OP_SLL,      // sll  rd, rt, shamt  (funct 0)
+    OP_SRL,      // srl  rd, rt, shamt  (funct 2)
+    OP_SRA,      // sra  rd, rt, shamt  (funct 3)
+    OP_SLLV,     // sllv rd, rt, rs     (funct 4)
+    // Compares
+    OP_SLT,      // slt  rd, rs, rt   (funct 42)
+    OP_SLTU,     // sltu rd, rs, rt   (funct 43)
+    OP_SLTI,     // slti rt, rs, imm  (opcode 10)
+    // Immediate logic (the immediate is zero-extended)
+    OP_ANDI,     // andi rt, rs, imm  (opcode 12)
+    OP_ORI,      // ori  rt, rs, imm  (opcode 13)
+    OP_XORI,     // xori rt, rs, imm  (opcode 14)
+    OP_LUI,      // lui  rt, imm      (opcode 15)
+    // Multiply / divide into the HI and LO registers
+    OP_MULT,     // mult rs, rt       (funct 24)
+    OP_DIV,      // div  rs, rt       (funct 26)
+    OP_MFHI,     // mfhi rd           (funct 16)
+    OP_MFLO,     // mflo rd           (funct 18)
+    // Byte and halfword memory access
+    OP_LB,       // lb   rt, imm(rs)  (opcode 32)
+    OP_LH,       // lh   rt, imm(rs)  (opcode 33)
+    OP_LBU,      // lbu  rt, imm(rs)  (opcode 36)
+    OP_SB,       // sb   rt, imm(rs)  (opcode 40)
+    OP_SH,       // sh   rt, imm(rs)  (opcode 41)
+    OP_SYSCALL,  // syscall           (funct 12), service number in $v0
+    OP_UNKNOWN,  // anything else: reported and skipped, like the classroom programs
+    OP_HALT,     // sentinel placed after the last instruction of the program
+    OP_COUNT
+};
+
+// Marks "no register" in the dependency fields below
+const uint8_t NO_REG = 0xFF;
+// HI and LO are tracked as one extra register (number 32) by the timing models
+const uint8_t REG_HILO = 32;
+const int NUM_TIMING_REGS = 33;
+
+// One predecoded instruction
+struct Decoded {
+    uint8_t op;       // Op number
+    uint8_t rs;       // first source register
+    uint8_t rt;       // second source / target register
+    uint8_t rd;       // destination register (R-type)
+    uint8_t shamt;    // shift amount (R-type)
+    uint8_t dst;      // register written by the instruction (NO_REG if none)
+    uint8_t src1;     // registers read by the instruction (NO_REG if unused)
+    uint8_t src2;
+    int32_t imm;      // immediate: sign-extended, zero-extended for andi/ori/xori, already shifted for lui
+    uint32_t target;  // branch target (instruction index) for beq/bne
+    uint32_t word;    // the raw 32-bit instruction
+    uint8_t loop;     // bne closing a bulk loop: 1 + its index in Machine::loops (0 = none, see mips_idiom.h)
+};
+
+// Instruction classes the timing models care about
+inline bool isLoad(uint8_t op)   { return op == OP_LW || op == OP_LB || op == OP_LH || op == OP_LBU; }
+inline bool isStore(uint8_t op)  { return op == OP_SW || op == OP_SB || op == OP_SH; }
+inline bool isBranch(uint8_t op) { return op == OP_BEQ || op == OP_BNE; }
+inline bool isMulDiv(uint8_t op) { return op == OP_MULT || op == OP_DIV; }
+
+// Instruction names, indexed by Op
+inline const char* mnemonic(uint8_t op) {
+    static const char* names[OP_COUNT] = {
+        "add", "sub", "and", "or", "xor", "addi", "lw", "sw", "beq", "bne",
+        "sll", "srl", "sra", "sllv", "slt", "sltu", "slti", "andi", "ori", "xori", "lui",
+        "mult", "div", "mfhi", "mflo", "lb", "lh", "lbu", "sb", "sh", "syscall", "unknown", "halt"};
+    return op < OP_COUNT ? names[op] : "unknown";
+}
+
+// Decode one 32-bit instruction found at instruction index pc
+inline Decoded decode(uint32_t word, uint32_t pc) {
+    Decoded d;
+    // Same bit ranges as the substr() calls in finalreview.cpp
+    int opcode = (word >> 26) & 0x3F;
+    int funct  = word & 0x3F;
+    d.rs    = (word >> 21) & 0x1F;
+    d.rt    = (word >> 16) & 0x1F;
+    d.rd    = (word >> 11) & 0x1F;
+    d.shamt = (word >> 6) & 0x1F;
+    // Sign-extend the 16-bit immediate (same as "imm -= (1 << 16)" when bit 15 is set)
+    d.imm   = (int16_t)(word & 0xFFFF);
+    d.word  = word;
+    d.target = 0;
+    d.dst = NO_REG;
+    d.src1 = NO_REG;
+    d.src2 = NO_REG;
+    d.op = OP_UNKNOWN;
+    d.loop = 0;
+
+    if (opcode == 0) {
+        // R-type: the funct field picks the operation
+        switch (funct) {
+            case 32: d.op = OP_ADD;  break;
+            case 34: d.op = OP_SUB;  break;
+            case 36: d.op = OP_AND;  break;
+            case 37: d.op = OP_OR;   break;
+            case 38: d.op = OP_XOR;  break;
+            case 42: d.op = OP_SLT;  break;
+            case 43: d.op = OP_SLTU; break;
+            case 4:  d.op = OP_SLLV; break;
+            case 0:  d.op = OP_SLL;  d.dst = d.rd; d.src1 = d.rt; break;
+            case 2:  d.op = OP_SRL;  d.dst = d.rd; d.src1 = d.rt; break;
+            case 3:  d.op = OP_SRA;  d.dst = d.rd; d.src1 = d.rt; break;
+            case 24: d.op = OP_MULT; d.dst = REG_HILO; d.src1 = d.rs; d.src2 = d.rt; break;
+            case 26: d.op = OP_DIV;  d.dst = REG_HILO; d.src1 = d.rs; d.src2 = d.rt; break;
+            case 16: d.op = OP_MFHI; d.dst = d.rd; d.src1 = REG_HILO; break;
+            case 18: d.op = OP_MFLO; d.dst = d.rd; d.src1 = REG_HILO; break;
+            // syscall reads $v0/$a0 and may write $v0
+            case 12: d.op = OP_SYSCALL; d.dst = 2; d.src1 = 2; d.src2 = 4; break;
+        }
+        // The plain three-register operations: rd = rs OP rt
+        if (d.op != OP_UNKNOWN && d.dst == NO_REG) {
+            d.dst = d.rd;
+            d.src1 = d.rs;
+            d.src2 = d.rt;
+        }
+    } else {
+        // I-type: the opcode picks the operation
+        switch (opcode) {
+            case 8:  d.op = OP_ADDI; d.dst = d.rt; d.src1 = d.rs; break;
+            case 10: d.op = OP_SLTI; d.dst = d.rt; d.src1 = d.rs; break;
+            case 12: d.op = OP_ANDI; d.dst = d.rt; d.src1 = d.rs; break;
+            case 13: d.op = OP_ORI;  d.dst = d.rt; d.src1 = d.rs; break;
+            case 14: d.op = OP_XORI; d.dst = d.rt; d.src1 = d.rs; break;
+            case 15: d.op = OP_LUI;  d.dst = d.rt; break;
+            case 35: d.op = OP_LW;   d.dst = d.rt; d.src1 = d.rs; break;
+            case 32: d.op = OP_LB;   d.dst = d.rt; d.src1 = d.rs; break;
+            case 33: d.op = OP_LH;   d.dst = d.rt; d.src1 = d.rs; break;
+            case 36: d.op = OP_LBU;  d.dst = d.rt; d.src1 = d.rs; break;
+            case 43: d.op = OP_SW;   d.src1 = d.rs; d.src2 = d.rt; break;
+            case 40: d.op = OP_SB;   d.src1 = d.rs; d.src2 = d.rt; break;
+            case 41: d.op = OP_SH;   d.src1 = d.rs; d.src2 = d.rt; break;
+            case 4:  d.op = OP_BEQ;  d.src1 = d.rs; d.src2 = d.rt; break;
+            case 5:  d.op = OP_BNE;  d.src1 = d.rs; d.src2 = d.rt; break;
+        }
+        // The logical immediates are zero-extended, lui puts its immediate in the upper half
+        if (d.op == OP_ANDI || d.op == OP_ORI || d.op == OP_XORI) {
+            d.imm = (int32_t)(word & 0xFFFF);
+        } else if (d.op == OP_LUI) {
+            d.imm = (int32_t)((word & 0xFFFF) << 16);
+        }
+        // Branch offsets count instructions from the one after the branch
+        if (isBranch(d.op)) {
+            d.target = pc + 1 + d.imm;
+        }
+    }
+    return d;
+}
+
+// The sentinel that ends every loaded program
+inline Decoded haltInstruction() {
+    Decoded d = decode(0xFFFFFFFF, 0);
+    d.op = OP_HALT;
+    return d;
+}
+
+// Human-readable form of an instruction, printed the same way as finalreview.cpp
+inline std::string disassemble(const Decoded& d) {
+    std::ostringstream out;
+    int rs = d.rs, rt = d.rt, rd = d.rd;
+    const char* name = mnemonic(d.op);
+    switch (d.op) {
+        case OP_ADD: case OP_SUB: case OP_AND: case OP_OR: case OP_XOR: case OP_SLT: case OP_SLTU:
+            out << name << " $" << rd << ", $" << rs << ", $" << rt; break;
+        case OP_SLL: case OP_SRL: case OP_SRA:
+            out << name << " $" << rd << ", $" << rt << ", " << (int)d.shamt; break;
+        case OP_SLLV:
+            out << name << " $" << rd << ", $" << rt << ", $" << rs; break;
+        case OP_ADDI: case OP_SLTI: case OP_ANDI: case OP_ORI: case OP_XORI:
+            out << name << " $" << rt << ", $" << rs << ", " << d.imm; break;
+        case OP_LUI:
+            out << name << " $" << rt << ", " << ((uint32_t)d.imm >> 16); break;
+        case OP_MULT: case OP_DIV:
+            out << name << " $" << rs << ", $" << rt; break;
+        case OP_MFHI: case OP_MFLO:
+            out << name << " $" << rd; break;
+        case OP_LW: case OP_SW: case OP_LB: case OP_LH: case OP_LBU: case OP_SB: case OP_SH:
+            out << name << " $" << rt << ", " << d.imm << "($" << rs << ")"; break;
+        case OP_BEQ: case OP_BNE:
+            out << name << " $" << rs << ", $" << rt << ", " << d.imm; break;
+        case OP_HALT: case OP_SYSCALL:
+            out << name; break;
+        default:
+            if ((d.word >> 26) == 0)
+                out << "Unknown R-type (funct = " << (d.word & 0x3F) << ")";
+            else
+                out << "Unknown I-type (opcode = " << (d.word >> 26) << ")";
+    }
+    return out.str();
+}
+
+// Parse one 8-digit hex instruction. Returns false for bad input, using the same
+// rule as the classroom programs: exactly 8 characters, all hex digits.
+inline bool parseHexWord(const std::string& text, uint32_t& word) {
+    if (text.length() != 8) {
+        return false;
+    }
+    word = 0;
+    for (char c : text) {
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return false;
+        word = (word << 4) | digit;
+    }
+    return true;
+}
+
+// Flags carried by an InstrEvent
+const uint8_t EV_TAKEN = 1;   // branch was taken
+const uint8_t EV_FAULT = 2;   // load/store address was out of range (checked engines only)
+
+/*
+The record an engine hands to its trace and timing hooks for every instruction
+it executes. It carries everything a timing model needs (which registers are
+read and written, the data address, the branch outcome) so that the same
+record can be written to a trace file and replayed later without re-running
+the instructions.
+*/
+struct InstrEvent {
+    uint32_t pc;      // instruction index
+    int32_t addr;     // data WORD address for loads and stores (0 otherwise)
+    uint8_t op;       // Op number
+    uint8_t flags;    // EV_TAKEN / EV_FAULT
+    uint8_t dst;      // register written (NO_REG if none)
+    uint8_t src1;     // registers read (NO_REG if unused)
+    uint8_t src2;
+    uint8_t pad[3];   // keeps the record at 16 bytes in trace files
+};
+
+// ENCODERS: build instruction words (used by the built-in kernels in mips_programs.h)
+inline uint32_t encodeR(int funct, int rd, int rs, int rt, int shamt = 0) {
+    return ((uint32_t)rs << 21) | ((uint32_t)rt << 16) | ((uint32_t)rd << 11) |
+           ((uint32_t)shamt << 6) | (uint32_t)funct;
+}
+
+inline uint32_t encodeI(int opcode, int rt, int rs, int imm) {
+    return ((uint32_t)opcode << 26) | ((uint32_t)rs << 21) | ((uint32_t)rt << 16) |
+           ((uint32_t)imm & 0xFFFF);
+}
+
+#endif
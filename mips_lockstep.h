@@ -0,0 +1,417 @@
+/*
+================================================================================
+                        LOCKSTEP DIFFERENTIAL EXECUTION
+================================================================================
+
+Every fast engine (the Cpu dispatch table, SuperblockCpu, the bulk loops of
+mips_idiom.h) has to do exactly what the classroom executor in
+finalreview.cpp does. This harness checks that, at speed, by running a
+candidate engine and a REFERENCE executor side by side on two copies of the
+same machine and comparing their architectural state as they go:
+
+    ReferenceCpu  the finalreview.cpp way, for whole programs: the fields
+                  are cut out of the raw instruction word for every
+                  instruction and an if/else on the opcode (and funct)
+                  carries it out. No predecoding, no mips_isa.h decoder, no
+                  sentinel: it shares nothing with the engines under test
+                  but the syscall handler.
+    granularity   the states are compared every N instructions (N = 1:
+                  after every instruction), or at the end of every block:
+                  every basic block the reference runs through, or every
+                  superblock for SuperblockCpu. Coarser checks let the
+                  candidate take its fast paths: a superblock only runs as
+                  one when its whole length fits in the budget, and a bulk
+                  loop only when all its iterations do.
+    comparison    pc, registers, HI/LO, the instruction, unknown-instruction
+                  and fault counts, the last fault address, halted and the
+                  exit code; the memory is compared only on the pages either
+                  side wrote since the last comparison (the dirty pages of
+                  mips_datamem.h), so a comparison costs a few words copied
+                  plus a scan of a byte per 4 KB page, eight pages at a time
+                  (8 KB of map for 32 MB of memory: on big memories, compare
+                  every block or every N instructions)
+
+The first comparison that fails stops the run and is reported with what
+differs and the last instructions the reference executed before it.
+
+randomProgram() makes test programs out of every instruction the simulator
+knows (plus the odd unknown word and copy/clear loops for the bulk paths);
+mipssim --lockstep also takes hex files, kernels and --replay-log run logs,
+whose recorded syscall input is handed to both sides.
+================================================================================
+*/
+#ifndef MIPS_LOCKSTEP_H
+#define MIPS_LOCKSTEP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mips_cpu.h"
+
+// The classroom executor (finalreview.cpp) extended to a whole program and the simulator's full ISA
+class ReferenceCpu {
+public:
+    Machine& machine;
+    std::vector<uint32_t> program;
+
+    ReferenceCpu(Machine& m, const std::vector<uint32_t>& words) : machine(m), program(words) {}
+
+    // Executes the instruction at the pc; false (and nothing executed) once the program has ended
+    bool step() {
+        Machine& m = machine;
+        int* registers = m.registers;
+        if (m.pc >= program.size()) {
+            m.pc = (uint32_t)program.size();
+            m.halted = true;
+            return false;
+        }
+        uint32_t word = program[m.pc];
+        uint32_t nextPc = m.pc + 1;
+
+        // The same fields as the substr() calls of finalreview.cpp
+        int opcode = (word >> 26) & 0x3F;
+        int rs     = (word >> 21) & 0x1F;
+        int rt     = (word >> 16) & 0x1F;
+        int rd     = (word >> 11) & 0x1F;
+        int shamt  = (word >> 6) & 0x1F;
+        int funct  = word & 0x3F;
+        int imm    = word & 0xFFFF;
+        int uimm   = imm;
+        // Sign-extend the immediate value if it's negative (most significant bit is 1)
+        if (imm & 0x8000) {
+            imm -= (1 << 16);
+        }
+        // Sums wrap around like the hardware's
+        auto wrap = [](int64_t value) { return (int)(uint32_t)value; };
+
+        if (opcode == 0) {
+            if (funct == 32) registers[rd] = wrap((int64_t)registers[rs] + registers[rt]);
+            else if (funct == 34) registers[rd] = wrap((int64_t)registers[rs] - registers[rt]);
+            else if (funct == 36) registers[rd] = registers[rs] & registers[rt];
+            else if (funct == 37) registers[rd] = registers[rs] | registers[rt];
+            else if (funct == 38) registers[rd] = registers[rs] ^ registers[rt];
+            else if (funct == 42) registers[rd] = registers[rs] < registers[rt] ? 1 : 0;
+            else if (funct == 43) registers[rd] = (uint32_t)registers[rs] < (uint32_t)registers[rt] ? 1 : 0;
+            else if (funct == 0) registers[rd] = (int)((uint32_t)registers[rt] << shamt);
+            else if (funct == 2) registers[rd] = (int)((uint32_t)registers[rt] >> shamt);
+            else if (funct == 3) registers[rd] = registers[rt] >> shamt;
+            else if (funct == 4) registers[rd] = (int)((uint32_t)registers[rt] << (registers[rs] & 31));
+            else if (funct == 24) {
+                int64_t product = (int64_t)registers[rs] * registers[rt];
+                m.hi = (int)(product >> 32);
+                m.lo = (int)(uint32_t)product;
+            }
+            else if (funct == 26) {
+                // Division by zero leaves HI and LO alone
+                if (registers[rt] != 0) {
+                    int64_t quotient = (int64_t)registers[rs] / registers[rt];
+                    m.lo = wrap(quotient);
+                    m.hi = (int)((int64_t)registers[rs] - quotient * registers[rt]);
+                }
+            }
+            else if (funct == 16) registers[rd] = m.hi;
+            else if (funct == 18) registers[rd] = m.lo;
+            else if (funct == 12) {
+                if (!m.os) m.unknown++;
+                else if (!m.os->handle(m)) nextPc = (uint32_t)program.size();
+            }
+            else m.unknown++;
+        }
+        else if (opcode == 8) registers[rt] = wrap((int64_t)registers[rs] + imm);
+        else if (opcode == 10) registers[rt] = registers[rs] < imm ? 1 : 0;
+        else if (opcode == 12) registers[rt] = registers[rs] & uimm;
+        else if (opcode == 13) registers[rt] = registers[rs] | uimm;
+        else if (opcode == 14) registers[rt] = registers[rs] ^ uimm;
+        else if (opcode == 15) registers[rt] = (int)((uint32_t)uimm << 16);
+        else if (opcode == 35 || opcode == 43) {
+            // lw / sw: a word address, checked like finalreview.cpp (against the whole memory)
+            int64_t addr = wrap((int64_t)registers[rs] + imm);
+            if (addr < 0 || addr >= (int64_t)m.memory.size()) fault(addr);
+            else if (opcode == 35) registers[rt] = std::as_const(m.memory)[addr];
+            else m.memory[addr] = registers[rt];
+        }
+        else if (opcode == 32 || opcode == 33 || opcode == 36 || opcode == 40 || opcode == 41) {
+            // lb, lh, lbu, sb, sh: a byte address; halfwords must be aligned
+            int64_t byteAddr = wrap((int64_t)registers[rs] + imm);
+            int64_t addr = byteAddr >> 2;
+            bool half = opcode == 33 || opcode == 41;
+            int shift = (int)(byteAddr & (half ? 2 : 3)) * 8;
+            if (addr < 0 || addr >= (int64_t)m.memory.size() || (half && (byteAddr & 1))) {
+                fault(byteAddr);
+            } else {
+                uint32_t value = (uint32_t)std::as_const(m.memory)[addr];
+                uint32_t mask = half ? 0xFFFFu : 0xFFu;
+                if (opcode == 32) registers[rt] = (int8_t)(value >> shift);
+                else if (opcode == 33) registers[rt] = (int16_t)(value >> shift);
+                else if (opcode == 36) registers[rt] = (int)((value >> shift) & 0xFF);
+                else m.memory[addr] = (int)((value & ~(mask << shift)) | (((uint32_t)registers[rt] & mask) << shift));
+            }
+        }
+        else if (opcode == 4 || opcode == 5) {
+            // beq / bne: PC + 1 + imm; a target outside the program ends it
+            bool equal = registers[rs] == registers[rt];
+            if (equal == (opcode == 4)) {
+                nextPc = m.pc + 1 + (uint32_t)imm;
+                if (nextPc > program.size()) nextPc = (uint32_t)program.size();
+            }
+        }
+        else m.unknown++;
+
+        m.pc = nextPc;
+        m.instructions++;
+        return true;
+    }
+
+private:
+    void fault(int64_t addr) {
+        machine.faults++;
+        machine.lastFault = addr;
+    }
+};
+
+struct LockstepConfig {
+    uint64_t every = 1;               // instructions between comparisons (0 = at the end of every block)
+    uint64_t maxInstructions = 1000000000;
+};
+
+struct LockstepResult {
+    uint64_t instructions = 0;        // executed by the reference
+    uint64_t comparisons = 0;
+    bool diverged = false;
+    uint64_t lastAgreed = 0;          // instructions executed when the states were last the same
+    std::vector<std::string> differences;
+    std::vector<uint32_t> recent;     // pcs of the reference's last instructions, oldest first
+};
+
+/*
+Lockstep: runs Engine (anything constructed on a Machine& with Cpu's run())
+on candidate and a ReferenceCpu on reference, two machines in the same
+state, comparing them as configured.
+*/
+template <class Engine>
+class Lockstep {
+public:
+    static const size_t RECENT = 16;          // instructions shown before a divergence
+    static const size_t MAX_DIFFERENCES = 8;
+
+    Machine& reference;
+    Machine& candidate;
+    ReferenceCpu ref;
+    Engine engine;
+    LockstepConfig config;
+    LockstepResult result;
+
+    Lockstep(Machine& r, Machine& c, const std::vector<uint32_t>& program, const LockstepConfig& conf)
+        : reference(r), candidate(c), ref(r, program), engine(c), config(conf) {}
+
+    // Runs both sides to the end (or config.maxInstructions); false at the first divergence
+    bool run() {
+        // The two must start out the same, all of memory included
+        if (!compare(false)) return false;
+        while (result.instructions < config.maxInstructions && !(reference.halted && candidate.halted)) {
+            uint64_t budget = config.maxInstructions - result.instructions;
+            uint64_t n = config.every ? std::min(config.every, budget) : engineBlock(budget);
+            uint64_t stepped = 0;
+            while (n == 0 ? stepped < budget : stepped < n) {
+                uint32_t pc = reference.pc;
+                if (!ref.step()) break;
+                recent[result.instructions++ % RECENT] = pc;
+                stepped++;
+                if (n == 0 && endsBlock(pc)) break;
+            }
+            // A reference that has just run off the end lets the candidate find its own end
+            engine.run(n ? n : stepped + (reference.halted ? 1 : 0));
+            if (!compare(true)) return false;
+            result.lastAgreed = result.instructions;
+        }
+        return true;
+    }
+
+    void report(std::ostream& out, const std::string& name, double seconds) const {
+        out << "Lockstep " << name << " against the reference: " << result.instructions << " instructions, "
+            << result.comparisons << " comparisons (";
+        if (config.every) out << "every " << config.every << (config.every == 1 ? " instruction" : " instructions");
+        else out << "every block";
+        out << ")";
+        if (seconds > 0) out << ", " << std::fixed << std::setprecision(1) << result.instructions / seconds / 1e6
+                             << " million instructions/s" << std::defaultfloat;
+        if (!result.diverged) {
+            out << ": same state throughout" << std::endl;
+            return;
+        }
+        out << std::endl << "  DIVERGED after instruction " << result.instructions
+            << " (the states were last the same after instruction " << result.lastAgreed << "):" << std::endl;
+        for (const std::string& d : result.differences) out << "    " << d << std::endl;
+        out << "  the reference's last instructions:" << std::endl;
+        uint64_t number = result.instructions - result.recent.size();
+        for (uint32_t pc : result.recent) {
+            out << "    " << std::setw(12) << ++number << "  pc " << std::setw(6) << pc << "  "
+                << disassemble(decode(ref.program[pc], pc)) << std::endl;
+        }
+    }
+
+private:
+    uint32_t recent[RECENT] = {};
+
+    // Basic blocks end at a branch or a syscall (the only instructions that can change the flow)
+    bool endsBlock(uint32_t pc) const {
+        uint32_t word = ref.program[pc];
+        int opcode = (word >> 26) & 0x3F;
+        return opcode == 4 || opcode == 5 || (opcode == 0 && (word & 0x3F) == 12);
+    }
+
+    // Block granularity: the engine's own block if it has one, else 0 (the reference's basic block)
+    uint64_t engineBlock(uint64_t budget) const {
+        if constexpr (requires { engine.formedBlockLength(); }) {
+            return std::min<uint64_t>(engine.formedBlockLength(), budget);
+        }
+        return 0;
+    }
+
+    // The memories were the same at the last comparison, so only the pages either side wrote since
+    // can differ. One pass over both dirty maps, eight pages at a time, clearing them on the way.
+    int64_t writtenDifference() {
+        DataMemory& a = reference.memory;
+        DataMemory& b = candidate.memory;
+        if (a.size() != b.size()) return (int64_t)std::min(a.size(), b.size());
+        uint8_t* da = a.dirtyMap();
+        uint8_t* db = b.dirtyMap();
+        const uint64_t written = 0x0101010101010101ull * DataMemory::SINCE_CHECKPOINT;
+        int64_t first = -1;
+        for (size_t p = 0; p < a.pages(); p += 8) {
+            size_t n = std::min<size_t>(8, a.pages() - p);
+            uint64_t wa = 0, wb = 0;
+            memcpy(&wa, da + p, n);
+            memcpy(&wb, db + p, n);
+            if (!((wa | wb) & written)) continue;
+            for (size_t q = p; q < p + n; q++) {
+                if (!((da[q] | db[q]) & DataMemory::SINCE_CHECKPOINT)) continue;
+                da[q] &= DataMemory::SINCE_BASELINE;
+                db[q] &= DataMemory::SINCE_BASELINE;
+                size_t start = q << DataMemory::PAGE_SHIFT;
+                size_t count = std::min(DataMemory::PAGE_WORDS, a.size() - start);
+                if (first >= 0 || memcmp(a.data() + start, b.data() + start, count * sizeof(int)) == 0) continue;
+                for (size_t i = start;; i++) {
+                    if (a.data()[i] != b.data()[i]) {
+                        first = (int64_t)i;
+                        break;
+                    }
+                }
+            }
+        }
+        return first;
+    }
+
+    bool compare(bool sinceLast) {
+        result.comparisons++;
+        const Machine& r = reference;
+        const Machine& c = candidate;
+        std::vector<std::string>& out = result.differences;
+        auto differ = [&out](const auto& what, int64_t a, int64_t b) {
+            if (a != b && out.size() < MAX_DIFFERENCES) {
+                out.push_back(std::string(what) + ": reference " + std::to_string(a) + ", candidate " + std::to_string(b));
+            }
+        };
+        differ("pc", r.pc, c.pc);
+        if (memcmp(r.registers, c.registers, sizeof(r.registers)) != 0) {
+            for (int i = 0; i < 32; i++) {
+                if (r.registers[i] != c.registers[i]) differ("R[$" + std::to_string(i) + "]", r.registers[i], c.registers[i]);
+            }
+        }
+        differ("HI", r.hi, c.hi);
+        differ("LO", r.lo, c.lo);
+        differ("instructions", (int64_t)r.instructions, (int64_t)c.instructions);
+        differ("unknown instructions", (int64_t)r.unknown, (int64_t)c.unknown);
+        differ("faults", (int64_t)r.faults, (int64_t)c.faults);
+        differ("last fault address", r.lastFault, c.lastFault);
+        differ("halted", r.halted, c.halted);
+        differ("exit code", r.exitCode, c.exitCode);
+        int64_t at = sinceLast ? writtenDifference() : firstDifference(r.memory, c.memory);
+        if (at >= 0 && (size_t)at < std::min(r.memory.size(), c.memory.size())) {
+            differ("M[" + std::to_string(at) + "]", r.memory[at], c.memory[at]);
+        } else if (at >= 0) {
+            differ("memory words", (int64_t)r.memory.size(), (int64_t)c.memory.size());
+        }
+        if (!sinceLast) {
+            reference.memory.clearCheckpointBits();
+            candidate.memory.clearCheckpointBits();
+        }
+        if (out.empty()) return true;
+
+        result.diverged = true;
+        size_t shown = (size_t)std::min<uint64_t>(result.instructions, RECENT);
+        for (size_t i = 0; i < shown; i++) result.recent.push_back(recent[(result.instructions - shown + i) % RECENT]);
+        return false;
+    }
+};
+
+/*
+A random test program of about length instructions: every instruction of the
+simulator with registers $0-$15 and small offsets (so most loads and stores
+hit the default 256-word memory), the odd random word (mostly unknown
+instructions), short forward and backward branches, copy/clear loops the
+bulk-loop recognizer picks up, and print/sbrk/exit syscalls.
+*/
+inline std::vector<uint32_t> randomProgram(std::mt19937_64& rng, size_t length) {
+    std::vector<uint32_t> words;
+    auto pick = [&rng](int n) { return (int)(rng() % (uint64_t)n); };
+    auto reg = [&pick]() { return pick(16); };
+    // Only the syscall sequences set $v0 and $a0, so a branch into one cannot sbrk a huge heap
+    auto dst = [&pick]() {
+        int r = pick(16);
+        return r == 2 || r == 4 ? r + 14 : r;
+    };
+    auto offset = [&pick]() { return pick(48) - 8; };
+    static const int rFuncts[] = {32, 34, 36, 37, 38, 42, 43, 0, 2, 3, 4, 24, 26, 16, 18};
+    static const int iOpcodes[] = {8, 10, 12, 13, 14, 15, 35, 43, 32, 33, 36, 40, 41};
+
+    while (words.size() < length) {
+        int kind = pick(100);
+        if (kind < 45) {
+            int funct = rFuncts[pick(15)];
+            words.push_back(encodeR(funct, dst(), reg(), reg(), pick(32)));
+        } else if (kind < 80) {
+            int opcode = iOpcodes[pick(13)];
+            int imm = opcode >= 32 ? offset() : pick(3) ? pick(64) - 16 : (int)(rng() & 0xFFFF);
+            bool store = opcode == 43 || opcode == 40 || opcode == 41;
+            words.push_back(encodeI(opcode, store ? reg() : dst(), reg(), imm));
+        } else if (kind < 90) {
+            // A branch a few instructions either way
+            words.push_back(encodeI(pick(2) ? 4 : 5, reg(), reg(), pick(16) - 10));
+        } else if (kind < 93) {
+            // Any word at all, except a syscall with whatever happens to be in $v0
+            uint32_t word = (uint32_t)rng();
+            if ((word >> 26) == 0 && (word & 0x3F) == 12) word ^= 1;
+            words.push_back(word);
+        } else if (kind < 97) {
+            // A copy or clear loop over n words: $8 source, $10 destination, $9 counts up to $11
+            int n = 2 + pick(40);
+            words.push_back(encodeI(8, 8, 0, pick(100)));
+            words.push_back(encodeI(8, 10, 0, pick(100)));
+            words.push_back(encodeI(8, 9, 0, 0));
+            words.push_back(encodeI(8, 11, 0, n));
+            bool copy = pick(2);
+            if (copy) words.push_back(encodeI(35, 12, 8, 0));
+            words.push_back(encodeI(43, copy ? 12 : 13, 10, 0));
+            words.push_back(encodeI(8, 8, 8, 1));
+            words.push_back(encodeI(8, 10, 10, 1));
+            words.push_back(encodeI(8, 9, 9, 1));
+            words.push_back(encodeI(5, 11, 9, copy ? -6 : -5));
+        } else {
+            // print_int, sbrk of a few words, or (rarely) exit
+            int service = pick(8) ? (pick(2) ? 1 : 9) : 10;
+            words.push_back(encodeI(8, 2, 0, service));
+            words.push_back(encodeI(8, 4, 0, pick(64)));
+            words.push_back(encodeR(12, 0, 0, 0));
+        }
+    }
+    return words;
+}
+
+#endif
@@ -0,0 +1,217 @@
+/*
+================================================================================
+                        INTERVAL METRICS (TIME SERIES EXPORT)
+================================================================================
+
+End-of-run totals hide phases: a kernel that misses in the cache for the
+first million instructions and then runs from the cache looks "average" in
+the totals. IntervalTiming is a PipelineTiming that also closes an interval
+every N instructions (or every N cycles) and writes one CSV row per interval:
+
+    interval,end_instruction,end_cycle,ipc,l1i_miss_rate,l1d_miss_rate,
+    branch_mispredict_rate,loads,stores,footprint_words
+
+footprint_words is the number of distinct data words touched since the start.
+
+The core loop never waits for the disk: it only copies the raw counters
+into a batch, and full batches are handed to a writer thread that turns them
+into text and writes them out.
+================================================================================
+*/
+#ifndef MIPS_METRICS_H
+#define MIPS_METRICS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mips_timing.h"
+
+// Raw counter differences for one interval (rates are computed by the writer thread)
+struct MetricsRow {
+    uint64_t interval;
+    uint64_t endInstruction;
+    uint64_t endCycle;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t icacheAccesses, icacheMisses;
+    uint64_t dcacheAccesses, dcacheMisses;
+    uint64_t branches, mispredicts;
+    uint64_t loads, stores;
+    uint64_t footprint;
+};
+
+// Background CSV writer: push() only appends to a batch, the thread does the I/O
+class MetricsWriter {
+public:
+    bool open(const std::string& path) {
+        out = fopen(path.c_str(), "w");
+        if (!out) return false;
+        fprintf(out, "interval,end_instruction,end_cycle,ipc,l1i_miss_rate,l1d_miss_rate,"
+                     "branch_mispredict_rate,loads,stores,footprint_words\n");
+        batch.reserve(BATCH_ROWS);
+        worker = std::thread(&MetricsWriter::work, this);
+        return true;
+    }
+
+    void push(const MetricsRow& row) {
+        batch.push_back(row);
+        if (batch.size() == BATCH_ROWS) {
+            handOff();
+        }
+    }
+
+    // Writes everything still buffered and stops the thread
+    void close() {
+        if (!out) return;
+        handOff();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            done = true;
+        }
+        ready.notify_one();
+        worker.join();
+        fclose(out);
+        out = nullptr;
+    }
+
+    ~MetricsWriter() { close(); }
+
+private:
+    static const size_t BATCH_ROWS = 4096;
+    FILE* out = nullptr;
+    std::vector<MetricsRow> batch;                   // being filled by the core
+    std::deque<std::vector<MetricsRow>> queue;       // full batches waiting for the writer
+    std::mutex lock;
+    std::condition_variable ready;
+    std::thread worker;
+    bool done = false;
+
+    // Moving a vector is just a pointer swap, so the core holds the lock very briefly
+    void handOff() {
+        if (batch.empty()) return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            queue.push_back(std::move(batch));
+        }
+        batch = std::vector<MetricsRow>();
+        batch.reserve(BATCH_ROWS);
+        ready.notify_one();
+    }
+
+    static double rate(uint64_t part, uint64_t whole) { return whole ? (double)part / whole : 0.0; }
+
+    void work() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            ready.wait(guard, [this] { return done || !queue.empty(); });
+            if (queue.empty()) break;
+            std::vector<MetricsRow> rows = std::move(queue.front());
+            queue.pop_front();
+            // Format and write without holding the lock
+            guard.unlock();
+            for (const MetricsRow& r : rows) {
+                fprintf(out, "%llu,%llu,%llu,%.4f,%.6f,%.6f,%.6f,%llu,%llu,%llu\n",
+                        (unsigned long long)r.interval, (unsigned long long)r.endInstruction,
+                        (unsigned long long)r.endCycle, rate(r.instructions, r.cycles),
+                        rate(r.icacheMisses, r.icacheAccesses), rate(r.dcacheMisses, r.dcacheAccesses),
+                        rate(r.mispredicts, r.branches), (unsigned long long)r.loads,
+                        (unsigned long long)r.stores, (unsigned long long)r.footprint);
+            }
+            guard.lock();
+        }
+    }
+};
+
+/*
+IntervalTiming: PipelineTiming plus a row of metrics every "interval"
+instructions (or cycles when byCycles is set). Call open() before running and
+finish() afterwards to write the last, partial interval.
+*/
+struct IntervalTiming : PipelineTiming {
+    static constexpr const char* name = "IntervalTiming";
+    uint64_t interval = 100000;
+    bool byCycles = false;
+    uint64_t rows = 0;
+
+    bool open(const std::string& path) {
+        nextBoundary = interval;
+        return writer.open(path);
+    }
+
+    void retire(const InstrEvent& ev) {
+        PipelineTiming::retire(ev);
+        if (isLoad(ev.op) || isStore(ev.op)) {
+            if (isLoad(ev.op)) loads++;
+            else stores++;
+            if (!(ev.flags & EV_FAULT)) markTouched((uint32_t)ev.addr);
+        }
+        uint64_t now = byCycles ? cycle : instructions;
+        if (now >= nextBoundary) {
+            closeInterval();
+            // A long stall can cross several cycle boundaries at once
+            while (nextBoundary <= now) nextBoundary += interval;
+        }
+    }
+
+    void finish() {
+        if (instructions > last.endInstruction) {
+            closeInterval();
+        }
+        writer.close();
+    }
+
+private:
+    MetricsWriter writer;
+    MetricsRow last = {};                 // counter values at the end of the previous interval
+    uint64_t nextBoundary = 0;
+    uint64_t loads = 0, stores = 0, footprint = 0;
+    std::vector<uint64_t> touchedWords;   // one bit per data word ever accessed
+
+    void markTouched(uint32_t addr) {
+        size_t word = addr / 64;
+        if (word >= touchedWords.size()) touchedWords.resize(word + 1024, 0);
+        uint64_t bit = 1ull << (addr % 64);
+        if (!(touchedWords[word] & bit)) {
+            touchedWords[word] |= bit;
+            footprint++;
+        }
+    }
+
+    void closeInterval() {
+        MetricsRow now;
+        now.interval = rows++;
+        now.endInstruction = instructions;
+        now.endCycle = cycle;
+        now.icacheAccesses = icache.accesses;
+        now.icacheMisses = icache.misses;
+        now.dcacheAccesses = dcache.accesses;
+        now.dcacheMisses = dcache.misses;
+        now.branches = predictor.lookups;
+        now.mispredicts = predictor.mispredicts;
+        now.loads = loads;
+        now.stores = stores;
+        now.footprint = footprint;
+
+        // The row holds what happened during this interval only
+        MetricsRow row = now;
+        row.instructions = now.endInstruction - last.endInstruction;
+        row.cycles = now.endCycle - last.endCycle;
+        row.icacheAccesses -= last.icacheAccesses;
+        row.icacheMisses -= last.icacheMisses;
+        row.dcacheAccesses -= last.dcacheAccesses;
+        row.dcacheMisses -= last.dcacheMisses;
+        row.branches -= last.branches;
+        row.mispredicts -= last.mispredicts;
+        row.loads -= last.loads;
+        row.stores -= last.stores;
+        writer.push(row);
+        last = now;
+    }
+};
+
+#endif
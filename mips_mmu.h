@@ -0,0 +1,171 @@
+/*
+================================================================================
+                        MMU AND TLB MODEL
+================================================================================
+
+Programs keep using raw word addresses into Machine::memory; the MMU is a
+TIMING model that treats those addresses as VIRTUAL and works out what
+translating them would cost:
+
+    L1 TLB      small and fast, checked on every lw/sw        (no extra cycles)
+    L2 TLB      larger, checked on an L1 TLB miss             (l2Latency)
+    page walk   on an L2 TLB miss: one page-table entry per level is read
+                through the data cache and whatever is behind it, so walks
+                compete with the program's own data for cache space
+
+Each address space (asid) has its own multi-level page table in PageTables;
+each core has its own TLBs (Mmu). Pages get a physical frame the first time
+they are touched (frames are handed out in order), and the page tables
+themselves live in frames too. The caches then
+see PHYSICAL addresses, so pages that are far apart virtually can still
+conflict in the cache.
+
+A level of the page table resolves 10 bits of the virtual page number
+(1024 four-byte entries fill a 4 KB table), over a 32-bit word address space:
+    4 KB pages  (pageWords 1024)     22-bit page number, 3 levels
+    2 MB pages  (pageWords 524288)   13-bit page number, 2 levels
+Large pages reach more memory per TLB entry and walk one level less.
+================================================================================
+*/
+#ifndef MIPS_MMU_H
+#define MIPS_MMU_H
+
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <unordered_map>
+#include "mips_cache.h"
+
+struct MmuConfig {
+    uint32_t pageWords = 1024;        // 4 KB pages (must be a power of two)
+    uint32_t l1Entries = 64;
+    uint32_t l1Ways = 4;
+    uint32_t l2Entries = 1024;
+    uint32_t l2Ways = 8;
+    uint32_t l2Latency = 7;           // cycles for an L1 TLB miss that hits in the L2 TLB
+};
+
+/*
+PageTables: the page tables of every address space, and the frame allocator.
+Threads of one process (the cores of mips_multicore.h) share it with the same
+asid; separate processes use different asids.
+*/
+class PageTables {
+public:
+    uint32_t pageWords;
+    uint32_t pageShift = 0;
+    uint32_t levels = 1;
+    uint64_t pages = 0;               // data pages touched
+    uint64_t tablePages = 0;          // frames holding page tables
+
+    explicit PageTables(uint32_t words = 1024) : pageWords(words) {
+        while ((1u << pageShift) < pageWords) pageShift++;
+        levels = (32 - pageShift + 9) / 10;
+    }
+
+    // Physical frame of a virtual page (one is allocated on the first touch)
+    uint64_t frameOf(uint32_t asid, uint64_t vpn) {
+        uint64_t key = (uint64_t)asid << 40 | vpn;
+        auto it = frames.find(key);
+        if (it != frames.end()) return it->second;
+        pages++;
+        frames[key] = nextFrame;
+        return nextFrame++;
+    }
+
+    // Frame of the table at a level that covers the given page number prefix (level 0 is the root)
+    uint64_t tableFrame(uint32_t asid, uint32_t level, uint64_t prefix) {
+        uint64_t key = (uint64_t)asid << 48 | (uint64_t)level << 40 | prefix;
+        auto it = tables.find(key);
+        if (it != tables.end()) return it->second;
+        tablePages++;
+        tables[key] = nextFrame;
+        return nextFrame++;
+    }
+
+private:
+    uint64_t nextFrame = 0;
+    std::unordered_map<uint64_t, uint64_t> frames;    // (asid, vpn) -> frame
+    std::unordered_map<uint64_t, uint64_t> tables;    // (asid, level, vpn prefix) -> frame
+};
+
+// Mmu: one core's L1 and L2 TLBs in front of a PageTables
+class Mmu {
+public:
+    MmuConfig config;
+    PageTables* tables;
+    uint32_t asid = 0;                // address space the core is running
+    Cache l1;                         // TLBs are caches of page numbers with one-entry "lines"
+    Cache l2;
+    uint64_t walks = 0;
+    uint64_t walkCycles = 0;          // cycles spent reading page-table entries
+    uint64_t translationCycles = 0;   // L2 TLB lookups plus walks
+
+    Mmu(const MmuConfig& c, PageTables* t)
+        : config(c), tables(t), l1(tlbShape(c.l1Entries, c.l1Ways)), l2(tlbShape(c.l2Entries, c.l2Ways)) {}
+
+    /*
+    Translates a virtual word address. readPte(physicalAddr) is called for
+    every page-table entry a walk reads and returns its cost in cycles.
+    Returns the extra cycles the translation took; paddr gets the result.
+    */
+    template <class ReadPte>
+    uint32_t translate(uint64_t vaddr, uint64_t& paddr, ReadPte readPte) {
+        uint64_t vpn = vaddr >> tables->pageShift;
+        paddr = physical(vpn, vaddr);
+        uint64_t key = (uint64_t)asid << 40 | vpn;
+        if (l1.access(key)) return 0;
+        uint32_t cycles = config.l2Latency;
+        if (!l2.access(key)) {
+            // Walk from the root; each table is a frame of its own
+            walks++;
+            uint32_t levels = tables->levels;
+            uint64_t table = tables->tableFrame(asid, 0, 0);
+            for (uint32_t level = 0; level < levels; level++) {
+                uint32_t shift = 10 * (levels - 1 - level);
+                uint32_t cost = readPte(table * tables->pageWords + (vpn >> shift & 1023));
+                cycles += cost;
+                walkCycles += cost;
+                if (level + 1 < levels) table = tables->tableFrame(asid, level + 1, vpn >> shift);
+            }
+        }
+        translationCycles += cycles;
+        return cycles;
+    }
+
+    // Warm-up: fills the TLBs without counting anything; returns the physical address
+    uint64_t warm(uint64_t vaddr) {
+        uint64_t vpn = vaddr >> tables->pageShift;
+        uint64_t key = (uint64_t)asid << 40 | vpn;
+        if (!l1.touch(key)) l2.touch(key);
+        return physical(vpn, vaddr);
+    }
+
+    void report(std::ostream& out) const {
+        out << std::fixed << std::setprecision(3);
+        out << "  TLB (" << tables->pageWords / 256 << " KB pages, " << tables->levels << "-level page table): L1 "
+            << config.l1Entries << " entries, miss rate " << l1.missRate() * 100 << "%; L2 " << config.l2Entries
+            << " entries, miss rate " << l2.missRate() * 100 << "%" << std::endl;
+        out << "  page walks " << walks << ", walk cycles " << walkCycles << " (" << std::setprecision(1)
+            << (walks ? (double)walkCycles / walks : 0.0) << " per walk), translation cycles " << translationCycles
+            << std::endl;
+        out << "  pages touched " << tables->pages << " (+" << tables->tablePages << " page-table pages)" << std::endl;
+        out << std::defaultfloat;
+    }
+
+private:
+    static CacheConfig tlbShape(uint32_t entries, uint32_t ways) {
+        CacheConfig c;
+        c.ways = ways < entries ? ways : entries;
+        c.sets = entries / c.ways;
+        c.lineWords = 1;
+        c.missPenalty = 0;
+        return c;
+    }
+
+    uint64_t physical(uint64_t vpn, uint64_t vaddr) {
+        return tables->frameOf(asid, vpn) << tables->pageShift | (vaddr & (tables->pageWords - 1));
+    }
+};
+
+#endif
@@ -0,0 +1,187 @@
+/*
+================================================================================
+                        MULTI-CORE MACHINE
+================================================================================
+
+Runs the same program on several simulated cores that share one data memory,
+each with its own registers, pc and PipelineTiming model, and with private
+L1 data caches kept coherent by MESI (mips_coherence.h).
+
+Every core starts with the classroom register values, except:
+    $k0 ($26) = core number (0, 1, ...)
+    $k1 ($27) = number of cores
+so a program can pick its own part of the work.
+
+The cores take turns: each runs "quantum" instructions, then the next one
+goes. Their memory accesses interleave at that granularity; a smaller quantum
+is closer to real cores running at the same time (and more ping-pong for
+shared lines), a larger one runs faster. A core that halts or exits drops out.
+
+The memory is shared by moving the one DataMemory into the Machine of the core
+whose turn it is (std::swap only exchanges pointers), so the engines run
+unchanged.
+
+With a RunLog (mips_record.h) the turns are written to the log as they are
+taken (a stretch of plain round-robin turns as one count), or, when
+replaying, taken from the log.
+
+An L2/DRAM (mips_hierarchy.h) can be shared by all cores or private to each.
+With tlb set every core gets its own TLBs (mips_mmu.h); the cores are threads
+of one process, so they share one set of page tables.
+================================================================================
+*/
+#ifndef MIPS_MULTICORE_H
+#define MIPS_MULTICORE_H
+
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+#include "mips_cpu.h"
+#include "mips_record.h"
+
+struct MulticoreConfig {
+    int cores = 1;
+    uint64_t quantum = 1000;          // instructions per turn
+    bool l2 = false;                  // put an L2/DRAM behind the L1s
+    bool sharedL2 = true;             // one L2 for all cores (false = one per core)
+    HierarchyConfig hierarchy;
+    CoherenceConfig coherence;
+    bool tlb = false;                 // translate through per-core TLBs
+    MmuConfig mmu;
+};
+
+template <class Memory>
+class Multicore {
+public:
+    typedef Cpu<NoTrace, Memory, PipelineTiming> Core;
+
+    MulticoreConfig config;
+    std::vector<Machine> machines;
+    std::vector<std::unique_ptr<Core>> cpus;
+    std::vector<std::unique_ptr<MemoryHierarchy>> hierarchies;
+    CoherentCaches coherence;
+    PageTables tables;
+    std::vector<std::unique_ptr<Mmu>> mmus;
+    RunLog* log = nullptr;            // records or replays the turns (nullptr = neither)
+
+    // Copies the loaded state of m (registers, program, memory) to every core
+    Multicore(const Machine& m, const MulticoreConfig& c)
+        : config(c), machines(c.cores, m), coherence(c.cores, c.coherence), tables(c.mmu.pageWords) {
+        if (config.l2) {
+            int count = config.sharedL2 ? 1 : config.cores;
+            for (int i = 0; i < count; i++) hierarchies.emplace_back(new MemoryHierarchy(config.hierarchy));
+        }
+        for (int i = 0; i < config.cores; i++) {
+            machines[i].registers[26] = i;
+            machines[i].registers[27] = config.cores;
+            // Only core 0 keeps the memory between turns
+            if (i > 0) machines[i].memory.clear();
+            cpus.emplace_back(new Core(machines[i]));
+            PipelineTiming& timing = cpus[i]->timing;
+            timing.coherence = &coherence;
+            timing.coreId = i;
+            if (config.l2) timing.memory = hierarchies[config.sharedL2 ? 0 : i].get();
+            if (config.tlb) {
+                mmus.emplace_back(new Mmu(config.mmu, &tables));
+                timing.mmu = mmus.back().get();
+            }
+        }
+    }
+
+    // Runs until every core has stopped or maxInstructions were executed in total
+    uint64_t run(uint64_t maxInstructions) {
+        uint64_t total = 0;
+        int next = 0;                 // where the round robin goes on
+        if (log && log->mode == RunLog::REPLAY) {
+            int core;
+            uint64_t turn;
+            while (log->replayTurn(core, turn)) {
+                if (core == RunLog::ROUND_ROBIN) {
+                    for (uint64_t k = 0; k < turn && (core = nextCore(next)) >= 0; k++) {
+                        total += runTurn(core, config.quantum);
+                        next = (core + 1) % config.cores;
+                    }
+                } else if (core < config.cores) {
+                    total += runTurn(core, turn);
+                    next = (core + 1) % config.cores;
+                } else {
+                    break;
+                }
+            }
+            return total;
+        }
+        int core;
+        while (total < maxInstructions && (core = nextCore(next)) >= 0) {
+            uint64_t turn = std::min(config.quantum, maxInstructions - total);
+            if (log && log->mode == RunLog::RECORD) log->recordTurn(core, turn, turn == config.quantum);
+            total += runTurn(core, turn);
+            next = (core + 1) % config.cores;
+        }
+        return total;
+    }
+
+
+    // The run is as long as its slowest core
+    uint64_t cycles() const {
+        uint64_t longest = 0;
+        for (const auto& cpu : cpus) longest = std::max(longest, cpu->timing.cycles());
+        return longest;
+    }
+
+    // Every core's registers with the shared memory, for RunLog::stateHash
+    std::vector<const Machine*> state() const {
+        std::vector<const Machine*> all;
+        for (const Machine& m : machines) all.push_back(&m);
+        return all;
+    }
+
+    void report(std::ostream& out) const {
+        out << "Cores: " << config.cores << " (quantum " << config.quantum << " instructions)" << std::endl;
+        out << "  core  instructions        cycles     CPI  L1D miss rate" << std::endl;
+        uint64_t instructions = 0;
+        for (int i = 0; i < config.cores; i++) {
+            const PipelineTiming& t = cpus[i]->timing;
+            instructions += t.instructions;
+            out << "  " << std::setw(4) << i << std::setw(14) << t.instructions << std::setw(14) << t.cycles()
+                << std::fixed << std::setprecision(3) << std::setw(8)
+                << (t.instructions ? (double)t.cycles() / t.instructions : 0.0) << std::setw(14)
+                << coherence.missRate(i) * 100 << "%" << std::defaultfloat << std::endl;
+        }
+        out << "Parallel run: " << cycles() << " cycles (slowest core), aggregate IPC " << std::fixed
+            << std::setprecision(3) << (cycles() ? (double)instructions / cycles() : 0.0) << std::defaultfloat
+            << std::endl;
+        coherence.report(out);
+        for (size_t i = 0; i < mmus.size(); i++) {
+            out << "Core " << i << " translation:" << std::endl;
+            mmus[i]->report(out);
+        }
+        for (size_t i = 0; i < hierarchies.size(); i++) {
+            out << (config.sharedL2 ? "Shared L2:" : "Private L2 of core " + std::to_string(i) + ":") << std::endl;
+            hierarchies[i]->report(out, cycles());
+        }
+    }
+
+private:
+    // Round robin: the first core from "from" on that has not stopped (-1 if they all have)
+    int nextCore(int from) const {
+        for (int k = 0; k < config.cores; k++) {
+            int i = (from + k) % config.cores;
+            if (!machines[i].halted) return i;
+        }
+        return -1;
+    }
+
+    // One core runs for up to count instructions on the shared memory
+    uint64_t runTurn(int core, uint64_t count) {
+        Machine& m = machines[core];
+        if (core > 0) std::swap(m.memory, machines[0].memory);
+        uint64_t executed = cpus[core]->run(count);
+        if (core > 0) std::swap(m.memory, machines[0].memory);
+        return executed;
+    }
+};
+
+#endif
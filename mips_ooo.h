@@ -0,0 +1,333 @@
+/*
+================================================================================
+                        OUT-OF-ORDER CORE TIMING MODEL
+================================================================================
+
+OooTiming is a timing policy (see mips_timing.h) for a modern out-of-order
+core. Like PipelineTiming it is driven by the instructions the functional
+engine retires, in program order, and works out for every instruction the
+cycle at which it would be dispatched, issued, completed and committed:
+
+    FRONT END   fetch/rename up to "width" instructions per cycle through the
+                L1 instruction cache; a mispredicted branch redirects fetch
+                only once the branch has executed (plus the front-end depth)
+    DISPATCH    needs a free ROB entry, a free issue queue entry, a free
+                load/store queue entry (loads and stores) and a free physical
+                register (instructions with a destination). Dispatch is in
+                order, so one full structure holds up everything behind it.
+    ISSUE       as soon as the source operands are ready and a functional
+                unit of the right kind is free. Renaming removes WAR and WAW
+                hazards, so only true (read-after-write) dependences wait.
+    EXECUTE     ALU, branch and mult take fixed latencies, div blocks its unit,
+                loads go through the L1 data cache or take their value straight
+                from an older store to the same word still in the LSQ; with an
+                "mmu" (mips_mmu.h) lw/sw translate their address first, and a
+                TLB miss delays the access by the L2 TLB lookup or page walk
+    COMMIT      in order, up to "width" per cycle, freeing the ROB and LSQ entry
+                and the physical register the previous writer of the same
+                architectural register was holding
+
+Because the instructions come from the functional engine, the model never
+runs down a wrong path: a misprediction just costs the cycles until fetch
+starts again on the right one.
+
+Reported: IPC, average ROB occupancy (by Little's law: the sum of every
+instruction's time in the ROB divided by the cycles) and, for the cycles where
+dispatch could not proceed, which structure was the reason.
+================================================================================
+*/
+#ifndef MIPS_OOO_H
+#define MIPS_OOO_H
+
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <queue>
+#include <vector>
+#include "mips_timing.h"
+
+struct OooConfig {
+    int width = 4;                // instructions fetched, dispatched and committed per cycle
+    int frontendDepth = 5;        // cycles from fetch to dispatch (refilled after a mispredict)
+    int robSize = 128;
+    int iqSize = 48;              // issue queue entries
+    int lsqSize = 32;             // load/store queue entries
+    int physRegs = 128;           // physical registers (32 of them hold the architectural state)
+    int aluUnits = 3;
+    int memPorts = 2;
+    int branchUnits = 2;
+    int aluLatency = 1;
+    int loadLatency = 2;          // L1 hit, address generation included
+    int multLatency = 4;          // pipelined
+    int divLatency = 20;          // not pipelined: blocks the mult/div unit
+};
+
+struct OooTiming {
+    static constexpr const char* name = "OooTiming";
+    static constexpr bool enabled = true;
+
+    OooConfig config;
+    BranchPredictor predictor;
+    Cache icache;
+    Cache dcache;
+    MemoryHierarchy* memory = nullptr;  // L2 and DRAM behind the L1s (nullptr = fixed missPenalty)
+    Mmu* mmu = nullptr;                 // virtual memory: TLBs and page tables (nullptr = addresses are physical)
+
+    uint64_t instructions = 0;
+    uint64_t robCycles = 0;           // sum of (commit - dispatch) over all instructions
+    uint64_t frontendStalls = 0;      // cycles dispatch waited for the instruction cache
+    uint64_t mispredictStalls = 0;    // cycles dispatch waited for fetch to be redirected
+    uint64_t robFull = 0;             // cycles dispatch waited for a ROB entry
+    uint64_t iqFull = 0;              // ... for an issue queue entry
+    uint64_t lsqFull = 0;             // ... for a load/store queue entry
+    uint64_t regsFull = 0;            // ... for a free physical register
+    uint64_t operandWaits = 0;        // instruction-cycles waiting in the IQ for operands
+    uint64_t unitWaits = 0;           // instruction-cycles waiting for a free functional unit
+    uint64_t forwardedLoads = 0;      // loads served by an older store in the LSQ
+
+    OooTiming() { setup(); }
+
+    // The queues are sized from the config, so call this after changing it
+    void setup() {
+        robCommit.assign(config.robSize, 0);
+        lsqCommit.assign(config.lsqSize, 0);
+        regCommit.assign(config.physRegs > 32 ? config.physRegs - 32 : 1, 0);
+        stores.assign(config.lsqSize, StoreEntry{});
+        slots.assign(CALENDAR, Slot{});
+    }
+
+    void retire(const InstrEvent& ev) {
+        bool load = isLoad(ev.op), store = isStore(ev.op);
+        bool memOk = (load || store) && !(ev.flags & EV_FAULT);
+
+        // FRONT END: the next slot of the current fetch group
+        if (groupCount == config.width) {
+            groupCycle++;
+            groupCount = 0;
+        }
+        uint64_t front = groupCycle;
+        if (fetchResume > front) {
+            mispredictStalls += fetchResume - front;
+            front = fetchResume;
+        }
+        if (!icache.access(ev.pc)) {
+            uint32_t penalty = memory ? memory->access(ev.pc, front, ev.pc, false) : icache.config.missPenalty;
+            front += penalty;
+            frontendStalls += penalty;
+        }
+
+        // DISPATCH: wait for every structure this instruction needs
+        uint64_t dispatch = front;
+        waitFor(dispatch, robCommit[robHead], robFull);
+        while (!iq.empty() && iq.top() <= dispatch) iq.pop();
+        if ((int)iq.size() >= config.iqSize) {
+            waitFor(dispatch, iq.top(), iqFull);
+            while (!iq.empty() && iq.top() <= dispatch) iq.pop();
+        }
+        if (load || store) waitFor(dispatch, lsqCommit[lsqHead], lsqFull);
+        if (ev.dst != NO_REG) waitFor(dispatch, regCommit[regHead], regsFull);
+        if (dispatch != groupCycle) {
+            groupCycle = dispatch;
+            groupCount = 0;
+        }
+        groupCount++;
+
+        // ISSUE: operands first, then a free unit of the right kind
+        uint64_t operands = dispatch + 1;
+        if (ev.src1 != NO_REG && regReady[ev.src1] > operands) operands = regReady[ev.src1];
+        if (ev.src2 != NO_REG && regReady[ev.src2] > operands) operands = regReady[ev.src2];
+        operandWaits += operands - (dispatch + 1);
+        int unit = unitOf(ev.op);
+        uint64_t issue = operands;
+        if (ev.op == OP_DIV && divFree > issue) issue = divFree;
+        issue = reserveUnit(unit, issue);
+        unitWaits += issue - operands;
+        iq.push(issue);
+
+        // EXECUTE: lw/sw translate their address first, reading page-table entries through the data cache
+        uint64_t addr = (uint32_t)ev.addr;
+        uint64_t translation = 0;
+        if (memOk && mmu) {
+            translation = mmu->translate(addr, addr, [&](uint64_t pte) {
+                return 1 + dataMiss(pte, issue, ev.pc);
+            });
+        }
+        uint64_t complete = issue + config.aluLatency;
+        if (ev.op == OP_MULT) {
+            complete = issue + config.multLatency;
+        } else if (ev.op == OP_DIV) {
+            complete = issue + config.divLatency;
+            divFree = complete;
+        } else if (load) {
+            complete = issue + translation + config.loadLatency;
+            uint64_t forwarded = 0;
+            if (memOk && findStore(addr, forwarded)) {
+                forwardedLoads++;
+                if (forwarded > complete - config.loadLatency) complete = forwarded + config.loadLatency;
+            } else if (memOk) {
+                complete += dataMiss(addr, issue + translation, ev.pc);
+            }
+        } else if (store && memOk) {
+            // The store writes the cache when it commits; it does not hold anything up
+            complete += translation;
+            if (!dcache.access(addr) && memory) memory->access(addr, issue + translation, ev.pc, true);
+        }
+        if (ev.dst != NO_REG) regReady[ev.dst] = complete;
+
+        if (isBranch(ev.op) && !predictor.predict(ev.pc, ev.flags & EV_TAKEN)) {
+            // Fetch restarts on the right path once the branch has executed
+            fetchResume = complete + config.frontendDepth;
+        }
+
+        // COMMIT: in order, "width" per cycle
+        uint64_t commit = complete > lastCommit ? complete : lastCommit;
+        if (commit == lastCommit && commitCount == config.width) commit++;
+        commitCount = commit == lastCommit ? commitCount + 1 : 1;
+        lastCommit = commit;
+
+        robCommit[robHead] = commit;
+        robHead = (robHead + 1) % robCommit.size();
+        if (load || store) {
+            lsqCommit[lsqHead] = commit;
+            lsqHead = (lsqHead + 1) % lsqCommit.size();
+        }
+        if (store && memOk) {
+            stores[storeHead] = {addr, complete, commit, true};
+            storeHead = (storeHead + 1) % stores.size();
+        }
+        if (ev.dst != NO_REG) {
+            regCommit[regHead] = commit;
+            regHead = (regHead + 1) % regCommit.size();
+        }
+        robCycles += commit - dispatch;
+        instructions++;
+    }
+
+    // Cycles until the last instruction commits, counting the front-end fill
+    uint64_t cycles() const { return instructions ? lastCommit + config.frontendDepth + 1 : 0; }
+
+    void report(std::ostream& out) const {
+        uint64_t total = cycles();
+        out << "Out-of-order core (width " << config.width << ", ROB " << config.robSize << ", IQ "
+            << config.iqSize << ", LSQ " << config.lsqSize << ", " << config.physRegs << " physical registers):"
+            << std::endl;
+        out << std::fixed << std::setprecision(3);
+        out << "  " << total << " cycles, IPC " << (total ? (double)instructions / total : 0.0)
+            << ", average ROB occupancy " << std::setprecision(1) << (total ? (double)robCycles / total : 0.0)
+            << std::endl;
+        out << "  dispatch stalls (cycles):" << std::endl;
+        out << "    instruction cache " << frontendStalls << std::endl;
+        out << "    branch mispredict " << mispredictStalls << "  (mispredict rate " << std::setprecision(3)
+            << predictor.mispredictRate() * 100 << "%)" << std::endl;
+        out << "    ROB full          " << robFull << std::endl;
+        out << "    issue queue full  " << iqFull << std::endl;
+        out << "    LSQ full          " << lsqFull << std::endl;
+        out << "    no free register  " << regsFull << std::endl;
+        out << "  issue waits (instruction-cycles): operands " << operandWaits << ", functional units "
+            << unitWaits << std::endl;
+        out << "  L1I miss rate " << icache.missRate() * 100 << "%, L1D miss rate " << dcache.missRate() * 100
+            << "%, loads forwarded from the LSQ " << forwardedLoads << std::endl;
+        if (memory) memory->report(out, total);
+        if (mmu) mmu->report(out);
+        out << std::defaultfloat;
+    }
+
+private:
+    enum { UNIT_ALU, UNIT_MEM, UNIT_BRANCH, UNIT_MULDIV, NUM_UNITS };
+
+    // Issue slots already taken in one cycle, per unit kind (tagged with the cycle)
+    struct Slot {
+        uint64_t cycle = ~0ull;
+        uint8_t used[NUM_UNITS] = {};
+    };
+    // Everything in flight issues within a few thousand cycles of each other
+    static const size_t CALENDAR = 8192;
+
+    struct StoreEntry {
+        uint64_t addr = 0;            // physical with an mmu
+        uint64_t dataReady = 0;
+        uint64_t commit = 0;
+        bool valid = false;
+    };
+
+    uint64_t groupCycle = 0;          // cycle of the current fetch/dispatch group
+    int groupCount = 0;               // instructions already in that group
+    uint64_t fetchResume = 0;         // fetch waits for a mispredicted branch until this cycle
+    uint64_t lastCommit = 0;
+    int commitCount = 0;              // instructions committed in cycle lastCommit
+    uint64_t divFree = 0;
+    uint64_t regReady[NUM_TIMING_REGS] = {};  // cycle the newest value of each register is ready
+
+    // Rings of commit cycles: the entry at the head belongs to the instruction
+    // that has to leave before the next one can take its place
+    std::vector<uint64_t> robCommit, lsqCommit, regCommit;
+    size_t robHead = 0, lsqHead = 0, regHead = 0;
+    std::vector<StoreEntry> stores;   // the most recent stores, for store-to-load forwarding
+    size_t storeHead = 0;
+    // Issue cycles of the instructions in the issue queue (they leave it when they issue)
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> iq;
+    std::vector<Slot> slots;
+
+    static void waitFor(uint64_t& cycle, uint64_t until, uint64_t& stalls) {
+        if (until > cycle) {
+            stalls += until - cycle;
+            cycle = until;
+        }
+    }
+
+    static int unitOf(uint8_t op) {
+        if (isLoad(op) || isStore(op)) return UNIT_MEM;
+        if (isBranch(op)) return UNIT_BRANCH;
+        if (isMulDiv(op)) return UNIT_MULDIV;
+        return UNIT_ALU;
+    }
+
+    int unitCount(int unit) const {
+        switch (unit) {
+            case UNIT_MEM: return config.memPorts;
+            case UNIT_BRANCH: return config.branchUnits;
+            case UNIT_MULDIV: return 1;
+            default: return config.aluUnits;
+        }
+    }
+
+    // Takes the first free slot of a unit kind at or after cycle; returns that cycle
+    uint64_t reserveUnit(int unit, uint64_t cycle) {
+        int count = unitCount(unit);
+        while (true) {
+            Slot& s = slots[cycle % CALENDAR];
+            if (s.cycle != cycle) {
+                s = Slot();
+                s.cycle = cycle;
+            }
+            if (s.used[unit] < count) {
+                s.used[unit]++;
+                return cycle;
+            }
+            cycle++;
+        }
+    }
+
+    // Extra cycles of an L1 data cache access (0 on a hit)
+    uint32_t dataMiss(uint64_t addr, uint64_t now, uint32_t pc) {
+        if (dcache.access(addr)) return 0;
+        return memory ? memory->access(addr, now, pc, true) : dcache.config.missPenalty;
+    }
+
+    // Youngest older store to the same word that has not committed yet
+    bool findStore(uint64_t addr, uint64_t& dataReady) const {
+        size_t n = stores.size();
+        for (size_t i = 1; i <= n; i++) {
+            const StoreEntry& s = stores[(storeHead + n - i) % n];
+            if (!s.valid) break;
+            if (s.addr == addr && s.commit > groupCycle) {
+                dataReady = s.dataReady;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
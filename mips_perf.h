@@ -0,0 +1,176 @@
+/*
+================================================================================
+                        HOST PERFORMANCE COUNTERS
+================================================================================
+
+Answers "why is the SIMULATOR slow on this workload?" by reading the host
+CPU's own hardware counters (Linux perf_event_open) around an engine's run
+loop:
+
+    cycles          host clock cycles
+    instructions    host instructions
+    branch-misses   host branch mispredictions (the engine's dispatch jump is
+                    the usual suspect)
+    L1d-misses      host L1 data cache read misses (memory model lookups)
+    LLC-misses      host last-level cache misses
+    dTLB-misses     host data TLB read misses (simulated memories too big for
+                    the host TLB; see the huge pages of mips_hostmem.h)
+
+Divided by the number of SIMULATED instructions these tell us, for example,
+that one engine spends 3 host cycles and 0.02 branch misses per simulated
+instruction while another spends 20 cycles and 0.5 misses.
+
+Counters only count this process in user mode, which is allowed with the
+default perf_event_paranoid setting. They follow the host threads the run
+starts (perf "inherit"), so an engine that uses more than one thread, such
+as the timing thread of --decoupled (mips_decoupled.h), is counted whole:
+its host cycles are then the sum over its threads, not the time it took.
+Counters the host (or a virtual machine) does not offer are reported as
+"n/a". On systems without perf_event_open every counter is "n/a".
+================================================================================
+*/
+#ifndef MIPS_PERF_H
+#define MIPS_PERF_H
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class HostCounters {
+public:
+    enum { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, DTLB_MISSES, NUM_COUNTERS };
+
+    HostCounters() {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            fds[i] = -1;
+            values[i] = 0;
+        }
+#ifdef __linux__
+        const uint64_t l1dReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const uint64_t dtlbReadMiss = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        fds[CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds[INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        fds[L1D_MISSES] = openCounter(PERF_TYPE_HW_CACHE, l1dReadMiss);
+        fds[LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fds[DTLB_MISSES] = openCounter(PERF_TYPE_HW_CACHE, dtlbReadMiss);
+#endif
+    }
+
+    ~HostCounters() {
+#ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (fds[i] >= 0) close(fds[i]);
+        }
+#endif
+    }
+
+    HostCounters(const HostCounters&) = delete;
+    HostCounters& operator=(const HostCounters&) = delete;
+
+    bool available(int counter) const { return fds[counter] >= 0; }
+
+    bool anyAvailable() const {
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (available(i)) return true;
+        }
+        return false;
+    }
+
+    // Zero the counters and start counting
+    void start() {
+#ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (fds[i] < 0) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // Stop counting and read the values
+    void stop() {
+#ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (fds[i] < 0) continue;
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            // value, time enabled, time running: when the kernel had to share the
+            // hardware between counters, scale the count up to the whole run
+            uint64_t data[3] = {0, 0, 0};
+            if (read(fds[i], data, sizeof(data)) != (ssize_t)sizeof(data)) {
+                values[i] = 0;
+            } else if (data[2] > 0 && data[2] < data[1]) {
+                values[i] = (uint64_t)((double)data[0] * data[1] / data[2]);
+            } else {
+                values[i] = data[0];
+            }
+        }
+#endif
+    }
+
+    uint64_t value(int counter) const { return values[counter]; }
+
+    static const char* name(int counter) {
+        static const char* names[NUM_COUNTERS] = {"cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses",
+                                                  "dTLB-misses"};
+        return names[counter];
+    }
+
+    // One line of "host events per simulated instruction"
+    void report(std::ostream& out, const std::string& engine, uint64_t simulated) const {
+        out << "  " << std::left << std::setw(62) << engine << std::right;
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            out << std::setw(15);
+            if (!available(i) || simulated == 0) {
+                out << "n/a";
+            } else {
+                out << std::fixed << std::setprecision(i < BRANCH_MISSES ? 2 : 4) << (double)values[i] / simulated;
+            }
+        }
+        out << std::defaultfloat << std::endl;
+    }
+
+    static void reportHeader(std::ostream& out) {
+        out << "Host events per simulated instruction (all host threads of the engine):" << std::endl;
+        out << "  " << std::left << std::setw(62) << "engine" << std::right;
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            out << std::setw(15) << name(i);
+        }
+        out << std::endl;
+    }
+
+private:
+    int fds[NUM_COUNTERS];
+    uint64_t values[NUM_COUNTERS];
+
+#ifdef __linux__
+    static int openCounter(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // Threads created while the counter is open count into it too
+        attr.inherit = 1;
+        // This process, any CPU
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,489 @@
+/*
+================================================================================
+                        BUILT-IN KERNELS
+================================================================================
+
+Small programs assembled in C++ so the simulator can be benchmarked without
+any input files (mipssim --kernel NAME, mipssim --bench).
+
+The Assembler below writes instruction words with the encoders from
+mips_isa.h and fills in branch offsets from labels, so the kernels can be
+written like assembly:
+
+    a.label("loop");
+    a.lw(9, 0, 8);          // lw   $9, 0($8)
+    a.addi(8, 8, 1);        // addi $8, $8, 1
+    a.bne(8, 12, "loop");   // bne  $8, $12, loop
+================================================================================
+*/
+#ifndef MIPS_PROGRAMS_H
+#define MIPS_PROGRAMS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "mips_isa.h"
+
+class Assembler {
+public:
+    std::vector<uint32_t> words;
+
+    void label(const std::string& name) { labels[name] = (int)words.size(); }
+
+    // R-type: op rd, rs, rt
+    void add(int rd, int rs, int rt)  { words.push_back(encodeR(32, rd, rs, rt)); }
+    void sub(int rd, int rs, int rt)  { words.push_back(encodeR(34, rd, rs, rt)); }
+    void and_(int rd, int rs, int rt) { words.push_back(encodeR(36, rd, rs, rt)); }
+    void or_(int rd, int rs, int rt)  { words.push_back(encodeR(37, rd, rs, rt)); }
+    void xor_(int rd, int rs, int rt) { words.push_back(encodeR(38, rd, rs, rt)); }
+
+    void slt(int rd, int rs, int rt)  { words.push_back(encodeR(42, rd, rs, rt)); }
+    void sltu(int rd, int rs, int rt) { words.push_back(encodeR(43, rd, rs, rt)); }
+
+    // Shifts: op rd, rt, shamt  and  sllv rd, rt, rs
+    void sll(int rd, int rt, int shamt) { words.push_back(encodeR(0, rd, 0, rt, shamt)); }
+    void srl(int rd, int rt, int shamt) { words.push_back(encodeR(2, rd, 0, rt, shamt)); }
+    void sra(int rd, int rt, int shamt) { words.push_back(encodeR(3, rd, 0, rt, shamt)); }
+    void sllv(int rd, int rt, int rs)   { words.push_back(encodeR(4, rd, rs, rt)); }
+
+    // Multiply / divide
+    void mult(int rs, int rt) { words.push_back(encodeR(24, 0, rs, rt)); }
+    void div(int rs, int rt)  { words.push_back(encodeR(26, 0, rs, rt)); }
+    void mfhi(int rd)         { words.push_back(encodeR(16, rd, 0, 0)); }
+    void mflo(int rd)         { words.push_back(encodeR(18, rd, 0, 0)); }
+
+    // I-type: op rt, rs, imm  and  op rt, imm(rs)
+    void addi(int rt, int rs, int imm) { words.push_back(encodeI(8, rt, rs, imm)); }
+    void slti(int rt, int rs, int imm) { words.push_back(encodeI(10, rt, rs, imm)); }
+    void andi(int rt, int rs, int imm) { words.push_back(encodeI(12, rt, rs, imm)); }
+    void ori(int rt, int rs, int imm)  { words.push_back(encodeI(13, rt, rs, imm)); }
+    void xori(int rt, int rs, int imm) { words.push_back(encodeI(14, rt, rs, imm)); }
+    void lui(int rt, int imm)          { words.push_back(encodeI(15, rt, 0, imm)); }
+    void lw(int rt, int imm, int rs)   { words.push_back(encodeI(35, rt, rs, imm)); }
+    void sw(int rt, int imm, int rs)   { words.push_back(encodeI(43, rt, rs, imm)); }
+    void lb(int rt, int imm, int rs)   { words.push_back(encodeI(32, rt, rs, imm)); }
+    void lh(int rt, int imm, int rs)   { words.push_back(encodeI(33, rt, rs, imm)); }
+    void lbu(int rt, int imm, int rs)  { words.push_back(encodeI(36, rt, rs, imm)); }
+    void sb(int rt, int imm, int rs)   { words.push_back(encodeI(40, rt, rs, imm)); }
+    void sh(int rt, int imm, int rs)   { words.push_back(encodeI(41, rt, rs, imm)); }
+
+    // System call: the service number goes in $v0 (see mips_syscall.h)
+    void syscall() { words.push_back(encodeR(12, 0, 0, 0)); }
+
+    // Branches: the offset is filled in by finish()
+    void beq(int rs, int rt, const std::string& target) { branch(4, rs, rt, target); }
+    void bne(int rs, int rt, const std::string& target) { branch(5, rs, rt, target); }
+
+    // Resolve branch labels and return the program
+    std::vector<uint32_t> finish() {
+        for (const Fixup& f : fixups) {
+            int offset = labels.at(f.label) - (f.index + 1);
+            words[f.index] = (words[f.index] & 0xFFFF0000u) | ((uint32_t)offset & 0xFFFF);
+        }
+        fixups.clear();
+        return words;
+    }
+
+private:
+    struct Fixup {
+        int index;
+        std::string label;
+    };
+    std::map<std::string, int> labels;
+    std::vector<Fixup> fixups;
+
+    void branch(int opcode, int rs, int rt, const std::string& target) {
+        fixups.push_back({(int)words.size(), target});
+        words.push_back(encodeI(opcode, rt, rs, 0));
+    }
+};
+
+// After an sbrk syscall: on to "nomem" if it returned -1 (the memory cannot grow that far). Uses $8.
+inline void checkSbrk(Assembler& a) {
+    a.addi(8, 0, -1);
+    a.beq(2, 8, "nomem");
+}
+
+// The "nomem" exit of a kernel that checks its sbrk: exit2(1) instead of running on out-of-range addresses
+inline void sbrkFailed(Assembler& a) {
+    a.label("nomem");
+    a.addi(4, 0, 1);
+    a.addi(2, 0, 17);
+    a.syscall();
+}
+
+/*
+"sum": running prefix sums of M[0..63] into M[128..191], repeated 20000 times.
+A mix of lw/add/xor/sw/addi/bne that stays inside the 256-word memory of the
+classroom machine (about 7.8 million instructions).
+*/
+inline std::vector<uint32_t> sumKernel() {
+    Assembler a;
+    a.addi(13, 0, 20000);      // $13 = outer repetitions
+    a.addi(12, 0, 64);         // $12 = n
+    a.label("outer");
+    a.addi(8, 0, 0);           // i = 0
+    a.addi(10, 0, 0);          // sum = 0
+    a.label("inner");
+    a.lw(9, 0, 8);             // $9 = M[i]
+    a.add(10, 10, 9);          // sum += M[i]
+    a.xor_(11, 11, 9);         // checksum ^= M[i]
+    a.sw(10, 128, 8);          // M[128 + i] = sum
+    a.addi(8, 8, 1);           // i++
+    a.bne(8, 12, "inner");
+    a.addi(13, 13, -1);
+    a.bne(13, 0, "outer");
+    return a.finish();
+}
+
+/*
+"matmul": C = A * B for 64x64 integer matrices on the heap (sbrk), then prints
+the sum of C and exits through the syscalls, like a compiled benchmark would
+(about 2.5 million instructions). Needs a syscall handler.
+*/
+inline std::vector<uint32_t> matmulKernel() {
+    const int N = 64;
+    Assembler a;
+    a.ori(4, 0, 3 * N * N * 4);   // sbrk(3 matrices)
+    a.addi(2, 0, 9);
+    a.syscall();
+    checkSbrk(a);
+    a.srl(16, 2, 2);           // $16 = A (word address)
+    a.addi(17, 16, N * N);     // $17 = B
+    a.addi(18, 17, N * N);     // $18 = C
+    a.addi(22, 0, N);          // $22 = N
+    a.ori(9, 0, N * N);        // $9 = N*N
+
+    // A[k] = k & 7, B[k] = 3k & 7
+    a.addi(8, 0, 0);
+    a.label("fill");
+    a.andi(10, 8, 7);
+    a.add(11, 16, 8);
+    a.sw(10, 0, 11);
+    a.sll(12, 8, 1);
+    a.add(12, 12, 8);
+    a.andi(12, 12, 7);
+    a.add(11, 17, 8);
+    a.sw(12, 0, 11);
+    a.addi(8, 8, 1);
+    a.bne(8, 9, "fill");
+
+    a.addi(19, 0, 0);          // i
+    a.label("iloop");
+    a.addi(20, 0, 0);          // j
+    a.label("jloop");
+    a.mult(19, 22);
+    a.mflo(24);
+    a.add(24, 24, 16);         // $24 = &A[i][0]
+    a.add(25, 17, 20);         // $25 = &B[0][j]
+    a.addi(21, 0, 0);          // k
+    a.addi(23, 0, 0);          // sum
+    a.label("kloop");
+    a.lw(10, 0, 24);
+    a.lw(11, 0, 25);
+    a.mult(10, 11);
+    a.mflo(12);
+    a.add(23, 23, 12);
+    a.addi(24, 24, 1);
+    a.addi(25, 25, N);
+    a.addi(21, 21, 1);
+    a.bne(21, 22, "kloop");
+    a.mult(19, 22);
+    a.mflo(12);
+    a.add(12, 12, 18);
+    a.add(12, 12, 20);
+    a.sw(23, 0, 12);           // C[i][j] = sum
+    a.addi(20, 20, 1);
+    a.bne(20, 22, "jloop");
+    a.addi(19, 19, 1);
+    a.bne(19, 22, "iloop");
+
+    // print_int(sum of C), print_char('\n'), exit
+    a.addi(8, 0, 0);
+    a.addi(4, 0, 0);
+    a.label("check");
+    a.add(11, 18, 8);
+    a.lw(10, 0, 11);
+    a.add(4, 4, 10);
+    a.addi(8, 8, 1);
+    a.bne(8, 9, "check");
+    a.addi(2, 0, 1);
+    a.syscall();
+    a.addi(4, 0, '\n');
+    a.addi(2, 0, 11);
+    a.syscall();
+    a.addi(2, 0, 10);
+    a.syscall();
+    sbrkFailed(a);
+    return a.finish();
+}
+
+/*
+"sort": insertion sort of 1500 pseudo-random numbers on the heap, then prints
+"ok" or "FAILED" after checking the order, and the smallest, middle and
+largest value (about 5 million instructions). Needs a syscall handler.
+*/
+inline std::vector<uint32_t> sortKernel() {
+    const int N = 1500;
+    Assembler a;
+    a.ori(4, 0, N * 4);        // sbrk(N words)
+    a.addi(2, 0, 9);
+    a.syscall();
+    checkSbrk(a);
+    a.srl(16, 2, 2);           // $16 = array (word address)
+    a.ori(9, 0, N);            // $9 = N
+
+    // a[i] = (x >> 16) & 0x7FFF with x = x * 1103515245 + 12345
+    a.addi(8, 0, 0);
+    a.ori(10, 0, 12345);
+    a.lui(11, 0x41C6);
+    a.ori(11, 11, 0x4E6D);
+    a.label("gen");
+    a.mult(10, 11);
+    a.mflo(10);
+    a.addi(10, 10, 12345);
+    a.srl(12, 10, 16);
+    a.andi(12, 12, 0x7FFF);
+    a.add(13, 16, 8);
+    a.sw(12, 0, 13);
+    a.addi(8, 8, 1);
+    a.bne(8, 9, "gen");
+
+    a.addi(8, 0, 1);           // i = 1
+    a.label("outer");
+    a.add(13, 16, 8);
+    a.lw(14, 0, 13);           // key = a[i]
+    a.addi(15, 8, -1);         // j = i - 1
+    a.label("inner");
+    a.slt(17, 15, 0);
+    a.bne(17, 0, "place");     // j < 0
+    a.add(18, 16, 15);
+    a.lw(19, 0, 18);
+    a.slt(17, 14, 19);
+    a.beq(17, 0, "place");     // a[j] <= key
+    a.sw(19, 1, 18);           // a[j + 1] = a[j]
+    a.addi(15, 15, -1);
+    a.beq(0, 0, "inner");
+    a.label("place");
+    a.add(18, 16, 15);
+    a.sw(14, 1, 18);           // a[j + 1] = key
+    a.addi(8, 8, 1);
+    a.bne(8, 9, "outer");
+
+    // Count neighbours out of order
+    a.addi(8, 0, 1);
+    a.addi(20, 0, 0);
+    a.label("verify");
+    a.add(13, 16, 8);
+    a.lw(10, -1, 13);
+    a.lw(11, 0, 13);
+    a.slt(12, 11, 10);
+    a.add(20, 20, 12);
+    a.addi(8, 8, 1);
+    a.bne(8, 9, "verify");
+
+    // Build "ok\n" or "FAILED\n" in an 8-byte heap block and print it
+    a.addi(4, 0, 8);
+    a.addi(2, 0, 9);
+    a.syscall();
+    checkSbrk(a);
+    a.addi(21, 2, 0);          // $21 = string (byte address)
+    a.bne(20, 0, "failed");
+    a.addi(10, 0, 'o');
+    a.sb(10, 0, 21);
+    a.addi(10, 0, 'k');
+    a.sb(10, 1, 21);
+    a.addi(10, 0, '\n');
+    a.sb(10, 2, 21);
+    a.beq(0, 0, "print");
+    a.label("failed");
+    a.lui(10, 0x4C49);         // "FAIL" (little-endian bytes)
+    a.ori(10, 10, 0x4146);
+    a.srl(11, 21, 2);
+    a.sw(10, 0, 11);
+    a.ori(10, 0, 0x0A44);      // "D\n"
+    a.sll(10, 10, 8);
+    a.ori(10, 10, 0x45);       // "ED\n"
+    a.sw(10, 1, 11);
+    a.label("print");
+    a.addi(4, 21, 0);
+    a.addi(2, 0, 4);
+    a.syscall();
+
+    // print_int(min), ' ', print_int(middle), ' ', print_int(max), '\n'
+    a.lw(4, 0, 16);
+    a.addi(2, 0, 1);
+    a.syscall();
+    a.addi(4, 0, ' ');
+    a.addi(2, 0, 11);
+    a.syscall();
+    a.lw(4, N / 2, 16);
+    a.addi(2, 0, 1);
+    a.syscall();
+    a.addi(4, 0, ' ');
+    a.addi(2, 0, 11);
+    a.syscall();
+    a.lw(4, N - 1, 16);
+    a.addi(2, 0, 1);
+    a.syscall();
+    a.addi(4, 0, '\n');
+    a.addi(2, 0, 11);
+    a.syscall();
+    a.addi(2, 0, 10);
+    a.syscall();
+    sbrkFailed(a);
+    return a.finish();
+}
+
+/*
+"falseshare" and "padded": every core of a multi-core run (mips_multicore.h)
+adds 1 to its own counter 100000 times. In "falseshare" the counters are
+neighbouring words M[200 + core], so they share cache lines and every write
+invalidates the other cores' copies although no data is shared; "padded"
+puts them 16 words apart, M[128 + 16 * core] (room for 8 cores).
+*/
+inline std::vector<uint32_t> counterKernel(bool padded) {
+    Assembler a;
+    if (padded) {
+        a.sll(9, 26, 4);
+        a.addi(9, 9, 128);     // $9 = &M[128 + 16 * core]
+    } else {
+        a.addi(9, 26, 200);    // $9 = &M[200 + core]
+    }
+    a.sw(0, 0, 9);
+    a.ori(10, 0, 50000);
+    a.sll(10, 10, 1);          // $10 = 100000 iterations
+    a.label("loop");
+    a.lw(8, 0, 9);
+    a.addi(8, 8, 1);
+    a.sw(8, 0, 9);
+    a.addi(10, 10, -1);
+    a.bne(10, 0, "loop");
+    return a.finish();
+}
+
+/*
+"memops": the copy/clear/scan loops of string and buffer code, 200 times over:
+clear a 4096-word buffer, copy it to a second one, fill a 4095-character
+string and take its length, copy the string with a strcpy loop. Prints a
+checksum and exits (about 16 million instructions). These are the loop
+shapes mips_idiom.h runs in bulk. Needs a syscall handler.
+*/
+inline std::vector<uint32_t> memopsKernel() {
+    const int N = 4096;
+    const int S = 4096;                // string buffer bytes, terminator included
+    Assembler a;
+    a.ori(4, 0, 2 * N * 4 + 2 * S);    // sbrk(two buffers and two strings)
+    a.addi(2, 0, 9);
+    a.syscall();
+    checkSbrk(a);
+    a.srl(16, 2, 2);           // $16 = A (word address)
+    a.addi(17, 16, N);         // $17 = B
+    a.ori(18, 0, 2 * N);
+    a.add(18, 18, 16);
+    a.sll(18, 18, 2);          // $18 = string (byte address)
+    a.ori(19, 0, S);
+    a.add(19, 19, 18);         // $19 = copy of the string
+    a.addi(20, 0, 200);        // $20 = rounds
+    a.addi(21, 0, 0);          // $21 = checksum
+
+    a.label("round");
+    // memset(A, round, N)
+    a.addi(8, 16, 0);
+    a.ori(9, 0, N);
+    a.label("clear");
+    a.sw(20, 0, 8);
+    a.addi(8, 8, 1);
+    a.addi(9, 9, -1);
+    a.bne(9, 0, "clear");
+    // memcpy(B, A, N): pointer compared to an end pointer
+    a.addi(8, 16, 0);
+    a.addi(10, 17, 0);
+    a.addi(11, 17, 0);
+    a.label("copy");
+    a.lw(12, 0, 8);
+    a.addi(8, 8, 1);
+    a.sw(12, 0, 10);
+    a.addi(10, 10, 1);
+    a.bne(8, 11, "copy");
+    a.lw(12, N - 1, 17);
+    a.add(21, 21, 12);
+    // memset(string, 'a' + round % 16, S - 1), then the terminator
+    a.andi(13, 20, 15);
+    a.addi(13, 13, 'a');
+    a.addi(8, 18, 0);
+    a.ori(9, 0, S - 1);
+    a.add(9, 9, 18);
+    a.label("fill");
+    a.sb(13, 0, 8);
+    a.addi(8, 8, 1);
+    a.bne(8, 9, "fill");
+    a.sb(0, 0, 8);
+    // strlen(string)
+    a.addi(8, 18, 0);
+    a.label("strlen");
+    a.lbu(12, 0, 8);
+    a.addi(8, 8, 1);
+    a.bne(12, 0, "strlen");
+    a.sub(12, 8, 18);
+    a.add(21, 21, 12);
+    // strcpy(copy, string)
+    a.addi(8, 18, 0);
+    a.addi(10, 19, 0);
+    a.label("strcpy");
+    a.lbu(12, 0, 8);
+    a.sb(12, 0, 10);
+    a.addi(8, 8, 1);
+    a.addi(10, 10, 1);
+    a.bne(12, 0, "strcpy");
+    a.lbu(12, -2, 10);
+    a.add(21, 21, 12);
+
+    a.addi(20, 20, -1);
+    a.bne(20, 0, "round");
+
+    // print_int(checksum), print_char('\n'), exit
+    a.add(4, 21, 0);
+    a.addi(2, 0, 1);
+    a.syscall();
+    a.addi(4, 0, '\n');
+    a.addi(2, 0, 11);
+    a.syscall();
+    a.addi(2, 0, 10);
+    a.syscall();
+    sbrkFailed(a);
+    return a.finish();
+}
+
+// Looks up a built-in kernel by name. Returns false if there is no such kernel.
+inline bool kernelProgram(const std::string& name, std::vector<uint32_t>& program) {
+    if (name == "sum") {
+        program = sumKernel();
+        return true;
+    }
+    if (name == "matmul") {
+        program = matmulKernel();
+        return true;
+    }
+    if (name == "sort") {
+        program = sortKernel();
+        return true;
+    }
+    if (name == "memops") {
+        program = memopsKernel();
+        return true;
+    }
+    if (name == "falseshare" || name == "padded") {
+        program = counterKernel(name == "padded");
+        return true;
+    }
+    return false;
+}
+
+// Names accepted by kernelProgram(), for the usage message
+inline std::vector<std::string> kernelNames() {
+    return {"sum", "matmul", "sort", "memops", "falseshare", "padded"};
+}
+
+#endif
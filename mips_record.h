@@ -0,0 +1,305 @@
+/*
+================================================================================
+                        DETERMINISTIC RECORD / REPLAY
+================================================================================
+
+The engines and timing models are deterministic: the same program, options
+and inputs always give the same state and the same cycle count. What can
+differ from one run to the next is only what comes from outside:
+
+    initial state      the program (possibly typed in) and the command line
+    syscall inputs     read_int, read_string and read_char (stdin)
+    interleaving       which core runs for how long in a multi-core run
+
+--record LOG writes those into a compact log, and --replay-log LOG runs the
+program again from the log alone: the program and the options come from the
+log, input syscalls get the recorded results instead of reading stdin, and
+the cores take exactly the recorded turns. At the end the final state (a hash
+of registers, pc and memory), the instruction count and the cycle count are
+compared with what the recording ended with.
+
+Log format (host byte order):
+    "MIPSLOG1"
+    argument count, then each argument (u32 length + bytes)
+    program words (u32 count + words), initial state hash (u64)
+    entries:  'S' u32 length, bytes      result of one input syscall
+              'R' turns                  that many round-robin turns in a row
+                                         (next core that has not stopped, a
+                                         whole quantum each)
+              'T' u8 core, count         one other multi-core turn
+              'E' u64 instructions, u64 cycles, u64 final state hash
+    (turns and counts are varints: 7 bits per byte, high bit = more)
+
+Only input syscalls and turns are logged. Turns are run-length encoded: the
+multi-core scheduler is round robin, so a whole run is usually one 'R' entry
+of a few bytes, and only turns that break the pattern (one cut short by
+--max) cost an entry of their own. An input syscall costs its result plus 5
+bytes. So recording and replaying cost next to nothing over a normal run.
+================================================================================
+*/
+#ifndef MIPS_RECORD_H
+#define MIPS_RECORD_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "mips_cpu.h"
+
+class RunLog {
+public:
+    enum Mode { OFF, RECORD, REPLAY };
+
+    Mode mode = OFF;
+    std::vector<std::string> args;          // command line of the recorded run
+    std::vector<uint32_t> program;
+    uint64_t initialHash = 0;
+    std::string problem;                    // why a replay went off the log ("" = it did not)
+
+    // FNV-1a over everything the program can change
+    static uint64_t stateHash(const std::vector<const Machine*>& machines) {
+        uint64_t h = 14695981039346656037ull;
+        auto mix = [&h](const void* p, size_t n) {
+            const uint8_t* bytes = (const uint8_t*)p;
+            for (size_t i = 0; i < n; i++) {
+                h = (h ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+        for (const Machine* m : machines) {
+            mix(m->registers, sizeof(m->registers));
+            mix(&m->hi, sizeof(m->hi));
+            mix(&m->lo, sizeof(m->lo));
+            mix(&m->pc, sizeof(m->pc));
+            mix(m->memory.data(), m->memory.size() * sizeof(int));
+        }
+        return h;
+    }
+
+    // RECORD: the start of the log
+    void startRecording(const std::vector<std::string>& commandLine, const std::vector<uint32_t>& words,
+                        const Machine& m) {
+        mode = RECORD;
+        args = commandLine;
+        program = words;
+        initialHash = stateHash({&m});
+        data.assign("MIPSLOG1", 8);
+        put((uint32_t)args.size());
+        for (const std::string& a : args) {
+            put((uint32_t)a.size());
+            data += a;
+        }
+        put((uint32_t)program.size());
+        for (uint32_t w : program) put(w);
+        put(initialHash);
+    }
+
+    void recordInput(const void* bytes, uint32_t length) {
+        flushTurns();           // the turn that reads comes before its input
+        data += 'S';
+        put(length);
+        data.append((const char*)bytes, length);
+    }
+
+    // A multi-core turn; roundRobin: it is the turn the round robin would take anyway
+    void recordTurn(int core, uint64_t count, bool roundRobin) {
+        if (roundRobin) {
+            roundRobinTurns++;
+            return;
+        }
+        flushTurns();
+        data += 'T';
+        data += (char)(uint8_t)core;
+        putVarint(count);
+    }
+
+    void recordEnd(uint64_t instructions, uint64_t cycles, uint64_t finalHash) {
+        flushTurns();
+        data += 'E';
+        put(instructions);
+        put(cycles);
+        put(finalHash);
+    }
+
+    bool save(const std::string& path) const {
+        FILE* out = fopen(path.c_str(), "wb");
+        if (!out) return false;
+        bool ok = fwrite(data.data(), 1, data.size(), out) == data.size();
+        return fclose(out) == 0 && ok;
+    }
+
+    size_t bytes() const { return data.size(); }
+
+    // REPLAY: reads the whole log and its header
+    bool load(const std::string& path) {
+        FILE* in = fopen(path.c_str(), "rb");
+        if (!in) return false;
+        data.clear();
+        char buffer[1 << 16];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) data.append(buffer, n);
+        fclose(in);
+
+        cursor = 8;
+        if (data.compare(0, 8, "MIPSLOG1") != 0) return false;
+        uint32_t count = 0;
+        if (!get(count)) return false;
+        args.clear();
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t length = 0;
+            if (!get(length) || cursor + length > data.size()) return false;
+            args.push_back(data.substr(cursor, length));
+            cursor += length;
+        }
+        if (!get(count)) return false;
+        program.assign(count, 0);
+        for (uint32_t& w : program) {
+            if (!get(w)) return false;
+        }
+        if (!get(initialHash)) return false;
+        mode = REPLAY;
+        return true;
+    }
+
+    // The result of the next input syscall; false if the log has none of that size here
+    bool replayInput(std::string& bytes, uint32_t expected) {
+        uint32_t length = 0;
+        if (!expect('S') || !get(length) || length != expected || cursor + length > data.size()) {
+            return fail("input syscall");
+        }
+        bytes = data.substr(cursor, length);
+        cursor += length;
+        return true;
+    }
+
+    // The next multi-core turn, or with core = ROUND_ROBIN the next count round-robin turns;
+    // false once the turns are over
+    static const int ROUND_ROBIN = -1;
+    bool replayTurn(int& core, uint64_t& count) {
+        if (cursor >= data.size() || (data[cursor] != 'T' && data[cursor] != 'R')) return false;
+        bool roundRobin = data[cursor++] == 'R';
+        if (roundRobin) {
+            core = ROUND_ROBIN;
+        } else {
+            if (cursor >= data.size()) return fail("turn");
+            core = (uint8_t)data[cursor++];
+        }
+        return getVarint(count) || fail("turn");
+    }
+
+    // Compares the end of the replay with the end of the recording
+    bool checkEnd(uint64_t instructions, uint64_t cycles, uint64_t finalHash, std::ostream& out) {
+        uint64_t logged[3] = {};
+        if (problem.empty() && !(expect('E') && get(logged[0]) && get(logged[1]) && get(logged[2]))) {
+            fail("end of run");
+        }
+        if (!problem.empty()) {
+            out << "Replay diverged: the log has no " << problem << " where the run needed one" << std::endl;
+            return false;
+        }
+        bool same = logged[0] == instructions && logged[1] == cycles && logged[2] == finalHash;
+        out << "Replay " << (same ? "matches the recording" : "DIFFERS from the recording") << ": instructions "
+            << instructions << " (recorded " << logged[0] << "), cycles " << cycles << " (recorded " << logged[1]
+            << "), final state " << (logged[2] == finalHash ? "identical" : "different") << std::endl;
+        return same;
+    }
+
+private:
+    std::string data;
+    size_t cursor = 0;
+    uint64_t roundRobinTurns = 0;           // recorded, not written yet
+
+    void flushTurns() {
+        if (roundRobinTurns == 0) return;
+        data += 'R';
+        putVarint(roundRobinTurns);
+        roundRobinTurns = 0;
+    }
+
+    void putVarint(uint64_t value) {
+        for (; value >= 0x80; value >>= 7) data += (char)(uint8_t)(value | 0x80);
+        data += (char)(uint8_t)value;
+    }
+
+    bool getVarint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; cursor < data.size() && shift < 64; shift += 7) {
+            uint8_t b = (uint8_t)data[cursor++];
+            value |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    template <class T>
+    void put(T value) {
+        data.append((const char*)&value, sizeof(value));
+    }
+
+    template <class T>
+    bool get(T& value) {
+        if (cursor + sizeof(value) > data.size()) return false;
+        memcpy(&value, data.data() + cursor, sizeof(value));
+        cursor += sizeof(value);
+        return true;
+    }
+
+    bool expect(char tag) {
+        if (cursor >= data.size() || data[cursor] != tag) return false;
+        cursor++;
+        return true;
+    }
+
+    bool fail(const char* what) {
+        if (problem.empty()) problem = what;
+        return false;
+    }
+};
+
+/*
+LoggedSyscalls: sits in front of the real syscall handler. Recording, it
+logs what the input services produced; replaying, it hands out the logged
+results without reading anything. Every other service is deterministic and
+simply goes to the real handler.
+*/
+class LoggedSyscalls : public SyscallHandler {
+public:
+    LoggedSyscalls(SyscallHandler& os, RunLog& log) : os(os), log(log) {}
+
+    bool handle(Machine& m) override {
+        int* R = m.registers;
+        int service = R[2];
+        bool input = service == 5 || service == 8 || service == 12;
+        if (!input || log.mode == RunLog::OFF) return os.handle(m);
+
+        // read_string fills whole words of its buffer; read_int and read_char set $v0
+        uint32_t first = 0, words = 1;
+        if (service == 8) {
+            first = (uint32_t)R[4] >> 2;
+            words = R[5] > 0 ? ((uint32_t)R[4] + R[5] - 1) / 4 - first + 1 : 0;
+            if (first >= m.memory.size()) words = 0;
+            else if (words > m.memory.size() - first) words = (uint32_t)(m.memory.size() - first);
+        }
+        if (log.mode == RunLog::RECORD) {
+            bool running = os.handle(m);
+            if (service == 8) log.recordInput(m.memory.data() + first, words * 4);
+            else log.recordInput(&R[2], 4);
+            return running;
+        }
+
+        std::string bytes;
+        if (!log.replayInput(bytes, words * 4)) return false;     // off the log: stop the program here
+        memcpy(service == 8 ? (void*)(m.memory.data() + first) : (void*)&R[2], bytes.data(), bytes.size());
+        if (service == 8) m.memory.markDirty(first, words);
+        return true;
+    }
+
+    void flush() override { os.flush(); }
+
+private:
+    SyscallHandler& os;
+    RunLog& log;
+};
+
+#endif
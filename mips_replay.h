@@ -0,0 +1,112 @@
+/*
+================================================================================
+                        TRACE REPLAY
+================================================================================
+
+A trace written with --trace (the BinaryTrace policy) already holds
+everything the timing models look at: the fetch address (pc), the data
+address of every load and store, branch outcomes (EV_TAKEN) and the
+registers each instruction reads and writes. Replaying it drives only the
+timing model: no decoding, no ALU, no data memory.
+
+The file is mapped into memory (mmap) instead of read, so the replay loop
+walks the records straight out of the page cache and the operating system
+reads the file ahead for us. Where mmap is not available the file is read
+into a buffer instead.
+================================================================================
+*/
+#ifndef MIPS_REPLAY_H
+#define MIPS_REPLAY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "mips_isa.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MIPS_REPLAY_MMAP 1
+#endif
+
+// A --trace file as an array of InstrEvents
+class TraceFile {
+public:
+    TraceFile() {}
+    ~TraceFile() { close(); }
+
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    bool open(const std::string& path) {
+        close();
+#ifdef MIPS_REPLAY_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        mappedBytes = (size_t)info.st_size;
+        count = mappedBytes / sizeof(InstrEvent);
+        if (count > 0) {
+            void* p = mmap(nullptr, mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                count = mappedBytes = 0;
+                return false;
+            }
+            // The replay reads the file front to back exactly once
+            madvise(p, mappedBytes, MADV_SEQUENTIAL);
+            records = (const InstrEvent*)p;
+        }
+        ::close(fd);
+        return true;
+#else
+        FILE* in = fopen(path.c_str(), "rb");
+        if (!in) return false;
+        InstrEvent ev;
+        while (fread(&ev, sizeof(ev), 1, in) == 1) buffer.push_back(ev);
+        fclose(in);
+        records = buffer.data();
+        count = buffer.size();
+        return true;
+#endif
+    }
+
+    void close() {
+#ifdef MIPS_REPLAY_MMAP
+        if (records && mappedBytes) munmap((void*)records, mappedBytes);
+        mappedBytes = 0;
+#endif
+        buffer.clear();
+        records = nullptr;
+        count = 0;
+    }
+
+    const InstrEvent* begin() const { return records; }
+    const InstrEvent* end() const { return records + count; }
+    size_t size() const { return count; }
+
+private:
+    const InstrEvent* records = nullptr;
+    size_t count = 0;
+    size_t mappedBytes = 0;
+    std::vector<InstrEvent> buffer;     // used when there is no mmap
+};
+
+// Feeds up to maxInstructions records to a timing policy; returns how many
+template <class Timing>
+uint64_t replayTrace(const TraceFile& trace, Timing& timing, uint64_t maxInstructions) {
+    const InstrEvent* ev = trace.begin();
+    const InstrEvent* end = trace.end();
+    if ((uint64_t)(end - ev) > maxInstructions) end = ev + maxInstructions;
+    for (; ev != end; ++ev) timing.retire(*ev);
+    return (uint64_t)(end - trace.begin());
+}
+
+#endif
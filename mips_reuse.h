@@ -0,0 +1,269 @@
+/*
+================================================================================
+                        REUSE DISTANCES AND MISS-RATIO CURVES
+================================================================================
+
+Simulating a cache answers "how often does THIS cache miss"; a sweep over
+cache sizes needs one simulation per size. The reuse (LRU stack) distance
+of an access answers it for every size at once:
+
+    distance  = how many OTHER lines were touched since the last access to
+                this line (first touches have an infinite distance)
+
+A fully associative LRU cache of C lines hits exactly the accesses whose
+distance is less than C, so one histogram of distances gives the miss ratio
+of every capacity: the MISS-RATIO CURVE. ReuseProfiler builds the histogram
+in one pass over the lw/sw (and, separately, instruction fetch) line
+addresses:
+
+    exact     every line's last access time is kept, and a Fenwick tree over
+              the access times marks the latest access of each line; the
+              distance is the number of marks after the line's previous
+              access (O(log n) per access). When the times run out the live
+              marks are renumbered, so memory stays proportional to the
+              number of distinct lines, not to the length of the run.
+    sampled   SHARDS: only lines whose hash falls under a threshold are
+              tracked (rate R), and their distances are scaled by 1/R. With
+              a cap on the tracked lines (fixed-size SHARDS) the threshold is
+              lowered whenever the cap is exceeded, dropping the lines with
+              the highest hashes and rescaling the histogram, so the memory
+              is bounded whatever the program touches.
+              A sampled distance only comes in steps of about 1/R lines, so
+              sampled curves are good for capacities above that.
+
+Distances are counted exactly up to 15 and in 8 buckets per power of two
+above that, so the curve is exact at power-of-two capacities (in exact mode).
+================================================================================
+*/
+#ifndef MIPS_REUSE_H
+#define MIPS_REUSE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "mips_cpu.h"
+
+struct ReuseConfig {
+    uint32_t lineWords = 4;           // words per cache line (the L1 line size)
+    double rate = 1.0;                // SHARDS sampling rate (1 = every line, exact)
+    size_t maxLines = 0;              // fixed-size SHARDS: most lines tracked at once (0 = no cap)
+};
+
+class ReuseProfiler {
+public:
+    static const uint32_t HASH_RANGE = 1u << 24;
+    static const size_t EXACT = 16;   // distances below this get a bucket each
+
+    ReuseConfig config;
+    uint64_t accesses = 0;            // all accesses seen
+    uint64_t sampled = 0;             // accesses to tracked lines
+
+    explicit ReuseProfiler(const ReuseConfig& c = ReuseConfig()) : config(c) {
+        threshold = c.rate >= 1.0 ? HASH_RANGE : (uint32_t)(c.rate * HASH_RANGE);
+        if (threshold == 0) threshold = 1;
+        tree.assign(MIN_SLOTS + 1, 0);
+    }
+
+    void access(uint64_t addr) {
+        accesses++;
+        uint64_t line = addr / config.lineWords;
+        uint32_t hash = (uint32_t)(mix(line) % HASH_RANGE);
+        if (hash >= threshold) return;
+        sampled++;
+        weight++;
+        if (now == tree.size()) compact();
+
+        auto [it, cold] = last.try_emplace(line, now);
+        if (cold) {
+            coldWeight++;
+            distinct++;
+            live++;
+            if (config.maxLines) hashes.push({hash, line});
+        } else {
+            uint64_t distance = live - prefix(it->second);
+            if (threshold < HASH_RANGE) distance = (uint64_t)(distance * (double)HASH_RANGE / threshold + 0.5);
+            size_t b = bucketOf(distance);
+            if (b >= histogram.size()) histogram.resize(b + 1, 0.0);
+            histogram[b] += 1.0;
+            add(it->second, -1);
+            it->second = now;
+        }
+        add(now++, 1);
+        if (config.maxLines && live > config.maxLines) shrink();
+    }
+
+    // Miss ratio of a fully associative LRU cache of the given number of lines
+    double missRatio(uint64_t lines) const {
+        if (weight == 0) return 0.0;
+        double misses = coldWeight;
+        for (size_t b = 0; b < histogram.size(); b++) {
+            if (bucketStart(b) >= lines) misses += histogram[b];
+        }
+        return misses / weight;
+    }
+
+    // Miss ratio of a cache big enough for everything: first touches only
+    double coldRatio() const { return weight ? coldWeight / weight : 0.0; }
+
+    double samplingRate() const { return (double)threshold / HASH_RANGE; }
+    size_t trackedLines() const { return live; }
+    // Distinct lines seen, estimated from the sampled ones
+    uint64_t footprint() const { return (uint64_t)(distinct / samplingRate() + 0.5); }
+    size_t memoryBytes() const {
+        return last.size() * (sizeof(uint64_t) + sizeof(uint32_t) + 16) + tree.size() * sizeof(int32_t) +
+               histogram.size() * sizeof(double) + hashes.size() * sizeof(std::pair<uint32_t, uint64_t>);
+    }
+
+private:
+    static const uint32_t MIN_SLOTS = 1 << 16;
+
+    uint32_t threshold;                                   // lines with hash < threshold are tracked
+    std::unordered_map<uint64_t, uint32_t> last;          // line -> time of its latest access
+    std::vector<int32_t> tree;                            // Fenwick tree over times 1..size-1
+    uint32_t now = 1;                                     // the next time
+    uint64_t live = 0;                                    // tracked lines (= marks in the tree)
+    double distinct = 0;                                  // lines ever tracked, at the rate they were
+    std::vector<double> histogram;                        // accesses per distance bucket (weighted)
+    double coldWeight = 0;
+    double weight = 0;
+    std::priority_queue<std::pair<uint32_t, uint64_t>> hashes;   // fixed-size SHARDS: tracked lines by hash
+
+    // splitmix64: spreads line numbers evenly over the hash range
+    static uint64_t mix(uint64_t x) {
+        x += 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    // Buckets: one per distance below 16, then 8 per power of two (each starts on a power of two)
+    static size_t bucketOf(uint64_t d) {
+        if (d < EXACT) return (size_t)d;
+        int octave = 63 - __builtin_clzll(d);
+        return EXACT + (size_t)(octave - 4) * 8 + ((d >> (octave - 3)) & 7);
+    }
+    static uint64_t bucketStart(size_t b) {
+        if (b < EXACT) return b;
+        size_t octave = (b - EXACT) / 8 + 4;
+        return (8 + (b - EXACT) % 8) << (octave - 3);
+    }
+
+    void add(uint32_t i, int32_t v) {
+        for (; i < tree.size(); i += i & (0 - i)) tree[i] += v;
+    }
+    uint64_t prefix(uint32_t i) const {
+        uint64_t sum = 0;
+        for (; i > 0; i -= i & (0 - i)) sum += tree[i];
+        return sum;
+    }
+
+    // Out of times: renumber the latest accesses 1..live in order and rebuild the tree
+    void compact() {
+        std::vector<std::pair<uint32_t, uint64_t>> order;
+        order.reserve(last.size());
+        for (const auto& [line, time] : last) order.push_back({time, line});
+        std::sort(order.begin(), order.end());
+        size_t slots = std::max<size_t>(MIN_SLOTS, order.size() * 2);
+        tree.assign(slots + 1, 0);
+        for (size_t i = 0; i < order.size(); i++) {
+            last[order[i].second] = (uint32_t)(i + 1);
+            tree[i + 1] = 1;
+        }
+        // Linear-time Fenwick build
+        for (size_t i = 1; i < tree.size(); i++) {
+            size_t parent = i + (i & (0 - i));
+            if (parent < tree.size()) tree[parent] += tree[i];
+        }
+        now = (uint32_t)order.size() + 1;
+    }
+
+    // Fixed-size SHARDS: lower the threshold until the tracked lines fit again
+    void shrink() {
+        uint32_t old = threshold;
+        while (live > config.maxLines) {
+            threshold = hashes.top().first;
+            while (!hashes.empty() && hashes.top().first >= threshold) {
+                auto found = last.find(hashes.top().second);
+                add(found->second, -1);
+                last.erase(found);
+                live--;
+                hashes.pop();
+            }
+        }
+        // Counts so far were taken at the old rate: scale them to the new one
+        double scale = (double)threshold / old;
+        for (double& c : histogram) c *= scale;
+        coldWeight *= scale;
+        weight *= scale;
+        distinct *= scale;
+    }
+};
+
+/*
+ReuseTrace: feeds instruction fetches and lw/sw (and byte/halfword) accesses
+into two ReuseProfilers, like the split L1 caches of the timing models.
+*/
+struct ReuseTrace {
+    static constexpr const char* name = "ReuseTrace";
+    static constexpr bool enabled = true;
+    ReuseProfiler* fetch = nullptr;
+    ReuseProfiler* data = nullptr;
+
+    void record(const Machine&, const Decoded&, const InstrEvent& ev) {
+        fetch->access(ev.pc);
+        if ((isLoad(ev.op) || isStore(ev.op)) && !(ev.flags & EV_FAULT)) data->access((uint32_t)ev.addr);
+    }
+};
+
+// Capacities of the curve: powers of two lines, until both curves have reached their cold misses
+inline std::vector<uint64_t> curveCapacities(const ReuseProfiler& fetch, const ReuseProfiler& data) {
+    std::vector<uint64_t> sizes;
+    for (uint64_t lines = 1; lines <= (1ull << 40); lines *= 2) {
+        sizes.push_back(lines);
+        if (fetch.missRatio(lines) <= fetch.coldRatio() && data.missRatio(lines) <= data.coldRatio()) break;
+    }
+    return sizes;
+}
+
+inline void printMissRatioCurves(const ReuseProfiler& fetch, const ReuseProfiler& data, std::ostream& out) {
+    uint32_t lineBytes = data.config.lineWords * 4;
+    out << "Miss-ratio curves (fully associative LRU, " << lineBytes << "-byte lines";
+    if (data.samplingRate() < 1.0) out << ", SHARDS sampling rate " << data.samplingRate();
+    out << "):" << std::endl;
+    out << "  " << std::setw(12) << "lines" << std::setw(12) << "capacity" << std::setw(12) << "I miss %"
+        << std::setw(12) << "D miss %" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for (uint64_t lines : curveCapacities(fetch, data)) {
+        uint64_t bytes = lines * lineBytes;
+        std::string capacity = bytes >= (1 << 20) ? std::to_string(bytes >> 20) + " MB"
+                               : bytes >= 1024    ? std::to_string(bytes >> 10) + " KB"
+                                                  : std::to_string(bytes) + " B";
+        out << "  " << std::setw(12) << lines << std::setw(12) << capacity << std::setw(12)
+            << fetch.missRatio(lines) * 100 << std::setw(12) << data.missRatio(lines) * 100 << std::endl;
+    }
+    out << std::defaultfloat;
+    out << "  fetches " << fetch.accesses << ", data accesses " << data.accesses << "; footprint " << fetch.footprint()
+        << " instruction lines, " << data.footprint() << " data lines; profiler memory "
+        << (fetch.memoryBytes() + data.memoryBytes()) / 1024 << " KB" << std::endl;
+}
+
+// CSV: lines,bytes,fetch_miss_ratio,data_miss_ratio
+inline bool writeMissRatioCsv(const std::string& path, const ReuseProfiler& fetch, const ReuseProfiler& data) {
+    std::ofstream out(path);
+    if (!out) return false;
+    out << "lines,bytes,fetch_miss_ratio,data_miss_ratio\n";
+    for (uint64_t lines : curveCapacities(fetch, data)) {
+        out << lines << "," << lines * data.config.lineWords * 4 << "," << fetch.missRatio(lines) << ","
+            << data.missRatio(lines) << "\n";
+    }
+    return (bool)out;
+}
+
+#endif
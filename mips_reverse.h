@@ -0,0 +1,272 @@
+/*
+================================================================================
+                        REVERSE EXECUTION
+================================================================================
+
+Lets a run go BACKWARDS: step back one instruction, or jump to any earlier
+(or later) instruction number, without running the program again from the
+start. Two kinds of history are kept while the program runs:
+
+    checkpoints   a copy of the machine (registers, HI/LO, pc, memory)
+                  every "spacing" instructions, and around every syscall;
+                  the memory is a MemorySnapshot (mips_datamem.h), which
+                  copies only the pages written since the last checkpoint
+    undo log      for each instruction since the last checkpoint, what it
+                  overwrote: a register, HI/LO or a memory word (and the pc)
+
+    step back     pop the instruction's undo entries: O(1)
+    go to N       restore the last checkpoint at or before N, then execute
+                  forward to N: at most "spacing" instructions
+
+A smaller spacing means faster seeks and more memory for checkpoints (the
+pages written in between each, plus a pointer per page); the undo log never
+holds more than "spacing" entries. Restoring a checkpoint copies only the
+pages that differ from it or were written since the memory was last in a
+checkpoint's state.
+
+Syscalls talk to the outside world (stdin, stdout), so they are never
+executed twice: there is a checkpoint just before and just after each one,
+and a seek always starts from the nearest checkpoint, so re-execution never
+crosses a syscall. Moving forward past the furthest point reached so far
+runs the program for real again.
+
+The UndoTrace policy does the logging: besides record() (after each
+instruction) it has a before() hook, which Cpu::run calls ahead of executing
+an instruction for trace policies that have one.
+================================================================================
+*/
+#ifndef MIPS_REVERSE_H
+#define MIPS_REVERSE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "mips_cpu.h"
+
+// The whole machine state at one instruction number
+struct Checkpoint {
+    uint64_t position = 0;            // instructions executed before this point
+    int registers[32];
+    int hi = 0, lo = 0;
+    uint32_t pc = 0;
+    MemorySnapshot memory;
+    uint64_t unknown = 0, faults = 0;
+    int64_t lastFault = 0;
+    int exitCode = 0;
+};
+
+// One value an instruction overwrote
+struct UndoEntry {
+    enum : uint8_t { NONE, REG, HILO, MEM, FAULT, UNKNOWN };
+    uint32_t pc;                      // pc of the instruction (first entry only)
+    uint8_t kind;
+    uint8_t first;                    // the instruction's first entry: undoing it finishes the instruction
+    uint32_t index;                   // register number or word address
+    int64_t old;                      // old value (HI:LO together, or the old lastFault)
+};
+
+// The history a run leaves behind, filled in by UndoTrace
+struct History {
+    uint64_t spacing = 100000;        // instructions between periodic checkpoints
+    uint64_t position = 0;            // instructions executed (the machine's place in time)
+    uint64_t frontier = 0;            // furthest position reached so far
+    uint64_t undoBase = 0;            // position the undo log starts at (the last checkpoint)
+    std::vector<Checkpoint> checkpoints;  // in position order
+    size_t base = 0;                  // the checkpoint the memory was last saved as or restored from
+    std::vector<UndoEntry> undo;
+    bool afterSyscall = false;        // a checkpoint is due right after the syscall just executed
+
+    uint64_t restores = 0;            // seeks that restored a checkpoint
+    uint64_t reexecuted = 0;          // instructions executed again by seeks
+    uint64_t undone = 0;              // instructions stepped back through the undo log
+    uint64_t pagesRestored = 0;       // memory pages copied back by restores
+
+    // Takes a checkpoint at the current position (unless there is one) and starts a new undo log
+    void save(Machine& m, uint32_t pc) {
+        if (checkpoints.empty() || checkpoints.back().position < position) {
+            bool first = checkpoints.empty();
+            checkpoints.emplace_back();
+            Checkpoint& c = checkpoints.back();
+            c.position = position;
+            std::copy(m.registers, m.registers + 32, c.registers);
+            c.hi = m.hi;
+            c.lo = m.lo;
+            c.pc = pc;
+            c.memory.take(m.memory, first ? nullptr : &checkpoints[base].memory);
+            base = checkpoints.size() - 1;
+            c.unknown = m.unknown;
+            c.faults = m.faults;
+            c.lastFault = m.lastFault;
+            c.exitCode = m.exitCode;
+        }
+        undo.clear();
+        undoBase = position;
+        afterSyscall = false;
+    }
+
+    size_t checkpointBytes() const {
+        size_t bytes = 0;
+        for (const Checkpoint& c : checkpoints) bytes += sizeof(Checkpoint) + c.memory.bytes();
+        return bytes;
+    }
+};
+
+// UndoTrace: logs what every instruction overwrites into a History
+struct UndoTrace {
+    static constexpr const char* name = "UndoTrace";
+    static constexpr bool enabled = true;
+    History* history = nullptr;
+
+    // Called before the instruction at pc executes (also for the halt sentinel)
+    void before(Machine& m, const Decoded& d, uint32_t pc) {
+        History& h = *history;
+        if (h.afterSyscall) h.save(m, pc);
+        if (d.op == OP_HALT) return;
+        if (d.op == OP_SYSCALL) {
+            h.save(m, pc);
+            h.afterSyscall = true;
+        }
+        savedLastFault = m.lastFault;
+        savedUnknown = m.unknown;
+
+        UndoEntry e = {pc, UndoEntry::NONE, 1, 0, 0};
+        if (isStore(d.op)) {
+            int32_t addr = (int32_t)((uint32_t)m.registers[d.rs] + (uint32_t)d.imm);
+            if (d.op != OP_SW) addr >>= 2;
+            if (addr >= 0 && (size_t)addr < m.memory.size()) {
+                e.kind = UndoEntry::MEM;
+                e.index = (uint32_t)addr;
+                e.old = m.memory[addr];
+            }
+        } else if (d.dst == REG_HILO) {
+            e.kind = UndoEntry::HILO;
+            e.old = (int64_t)((uint64_t)(uint32_t)m.hi << 32 | (uint32_t)m.lo);
+        } else if (d.dst != NO_REG) {
+            e.kind = UndoEntry::REG;
+            e.index = d.dst;
+            e.old = m.registers[d.dst];
+        }
+        h.undo.push_back(e);
+    }
+
+    void record(const Machine& m, const Decoded&, const InstrEvent& ev) {
+        History& h = *history;
+        if (ev.flags & EV_FAULT) h.undo.push_back({0, UndoEntry::FAULT, 0, 0, savedLastFault});
+        if (m.unknown != savedUnknown) h.undo.push_back({0, UndoEntry::UNKNOWN, 0, 0, 0});
+        h.position++;
+    }
+
+private:
+    int64_t savedLastFault = 0;
+    uint64_t savedUnknown = 0;
+};
+
+/*
+ReverseDebugger: runs a loaded Machine with an UndoTrace engine and moves it
+to any instruction number, forwards or backwards.
+*/
+template <class Memory>
+class ReverseDebugger {
+public:
+    Machine& machine;
+    History history;
+    Cpu<UndoTrace, Memory, NoTiming> cpu;
+
+    ReverseDebugger(Machine& m, uint64_t spacing) : machine(m), cpu(m) {
+        cpu.trace.history = &history;
+        history.spacing = spacing ? spacing : 1;
+        history.position = history.frontier = m.instructions;
+        history.save(m, m.pc);
+    }
+
+    uint64_t position() const { return history.position; }
+
+    // Moves to instruction number target (or as far as the program goes); returns the new position
+    uint64_t seek(uint64_t target) {
+        History& h = history;
+        if (target >= h.undoBase && target <= h.position) {
+            while (h.position > target) undoOne();
+            return h.position;
+        }
+        // The last checkpoint at or before the target; going on from where we are is fine if that is after it
+        auto it = std::upper_bound(h.checkpoints.begin(), h.checkpoints.end(), target,
+                                   [](uint64_t t, const Checkpoint& c) { return t < c.position; });
+        const Checkpoint& c = *(it - 1);
+        if (h.position < c.position || h.position > target) restore(it - 1 - h.checkpoints.begin());
+        uint64_t from = h.position, frontier = h.frontier;
+        runTo(target);
+        h.reexecuted += std::min(h.position, frontier) - std::min(from, frontier);
+        return h.position;
+    }
+
+    uint64_t forward(uint64_t n) { return seek(history.position + n); }
+    uint64_t backward(uint64_t n) { return seek(n < history.position ? history.position - n : 0); }
+
+private:
+    void restore(size_t index) {
+        Machine& m = machine;
+        const Checkpoint& c = history.checkpoints[index];
+        std::copy(c.registers, c.registers + 32, m.registers);
+        m.hi = c.hi;
+        m.lo = c.lo;
+        m.pc = c.pc;
+        history.pagesRestored += c.memory.restore(m.memory, &history.checkpoints[history.base].memory);
+        history.base = index;
+        m.unknown = c.unknown;
+        m.faults = c.faults;
+        m.lastFault = c.lastFault;
+        m.exitCode = c.exitCode;
+        m.instructions = c.position;
+        m.halted = false;
+        history.position = c.position;
+        history.undo.clear();
+        history.undoBase = c.position;
+        history.afterSyscall = false;
+        history.restores++;
+    }
+
+    // Takes back the last instruction executed
+    void undoOne() {
+        Machine& m = machine;
+        History& h = history;
+        while (true) {
+            UndoEntry e = h.undo.back();
+            h.undo.pop_back();
+            switch (e.kind) {
+                case UndoEntry::REG: m.registers[e.index] = (int)e.old; break;
+                case UndoEntry::HILO:
+                    m.hi = (int)(uint32_t)((uint64_t)e.old >> 32);
+                    m.lo = (int)(uint32_t)e.old;
+                    break;
+                case UndoEntry::MEM: m.memory[e.index] = (int)e.old; break;
+                case UndoEntry::FAULT:
+                    m.faults--;
+                    m.lastFault = e.old;
+                    break;
+                case UndoEntry::UNKNOWN: m.unknown--; break;
+            }
+            if (e.first) {
+                m.pc = e.pc;
+                break;
+            }
+        }
+        h.position--;
+        h.undone++;
+        m.instructions = h.position;
+        m.halted = false;
+    }
+
+    // Executes forward to target, with a checkpoint at every multiple of the spacing
+    void runTo(uint64_t target) {
+        Machine& m = machine;
+        History& h = history;
+        while (h.position < target && !m.halted) {
+            uint64_t boundary = (h.position / h.spacing + 1) * h.spacing;
+            if (cpu.run(std::min(target, boundary) - h.position) == 0 && !m.halted) break;
+            if (h.afterSyscall || h.position % h.spacing == 0) h.save(m, m.pc);
+            h.frontier = std::max(h.frontier, h.position);
+        }
+    }
+};
+
+#endif
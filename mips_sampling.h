@@ -0,0 +1,174 @@
+/*
+================================================================================
+                        SAMPLED SIMULATION (FAST-FORWARD + DETAIL)
+================================================================================
+
+Running the PipelineTiming model on every instruction is several times slower
+than plain functional execution. Sampling runs most of the program on the
+fast engine and only measures short DETAILED windows:
+
+   |---- fast-forward ----|-- warm-up --|-- detail --|---- fast-forward ----| ...
+     Cpu<NoTrace,..,NoTiming>  caches and   full pipeline
+                               predictor    model, CPI
+                               updated      measured
+
+All three engines share the same Machine, so switching between them costs
+nothing; the caches and branch predictor live in the detailed engine's
+PipelineTiming and keep their contents between samples. So do the L2/DRAM
+and the TLBs, when the setup function attaches them to that PipelineTiming:
+the warm-up fills them as well.
+
+Where the samples go:
+  - periodic:          one sample at the end of every PERIOD instructions
+  - simulation points: a list of starting offsets, each with a weight
+                       (for example picked by clustering program phases)
+
+The whole-program CPI is the (weighted) mean of the sample CPIs and the error
+bound is the 95% confidence interval of that mean (1.96 standard errors).
+================================================================================
+*/
+#ifndef MIPS_SAMPLING_H
+#define MIPS_SAMPLING_H
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "mips_cpu.h"
+
+// Where one detailed sample starts (instruction count) and how much it counts
+struct SamplePoint {
+    uint64_t start;
+    double weight;
+};
+
+struct SamplingConfig {
+    uint64_t period = 0;               // periodic sampling interval (0 = use points)
+    uint64_t warmup = 10000;           // instructions of cache/predictor warm-up before each sample
+    uint64_t detail = 10000;           // instructions measured in each sample
+    std::vector<SamplePoint> points;   // simulation points, sorted by start
+};
+
+// What one detailed window measured
+struct SampleResult {
+    uint64_t start;
+    uint64_t instructions;
+    uint64_t cycles;
+    double weight;
+};
+
+struct SamplingReport {
+    std::vector<SampleResult> samples;
+    uint64_t totalInstructions = 0;
+    uint64_t detailedInstructions = 0;
+    double cpi = 0;                    // estimated whole-program CPI
+    double errorBound = 0;             // +/- on cpi, 95% confidence
+};
+
+// Combines the samples into the CPI estimate and its confidence interval
+inline void estimateCpi(SamplingReport& report) {
+    double sumW = 0, sumW2 = 0, sumWX = 0;
+    for (const SampleResult& s : report.samples) {
+        double cpi = (double)s.cycles / s.instructions;
+        sumW += s.weight;
+        sumW2 += s.weight * s.weight;
+        sumWX += s.weight * cpi;
+    }
+    if (sumW <= 0) {
+        return;
+    }
+    report.cpi = sumWX / sumW;
+
+    // Weighted variance, and the "effective" number of samples for unequal weights
+    double var = 0;
+    for (const SampleResult& s : report.samples) {
+        double d = (double)s.cycles / s.instructions - report.cpi;
+        var += s.weight * d * d;
+    }
+    var /= sumW;
+    double nEff = sumW * sumW / sumW2;
+    if (nEff > 1) {
+        // Standard error of the mean, with the n-1 correction for a sample variance
+        report.errorBound = 1.96 * std::sqrt(var / (nEff - 1));
+    }
+}
+
+// setup(PipelineTiming&) configures the detailed model (memory system, issue width) before anything runs
+template <class Memory, class Setup>
+SamplingReport runSampled(Machine& m, const SamplingConfig& config, uint64_t maxInstructions, Setup setup) {
+    Cpu<NoTrace, Memory, NoTiming> fast(m);
+    Cpu<NoTrace, Memory, WarmingTiming> warming(m);
+    Cpu<NoTrace, Memory, PipelineTiming> detailed(m);
+    setup(detailed.timing);
+    warming.timing.model = &detailed.timing;
+    SamplingReport report;
+
+    // Runs one engine until the machine has executed "target" instructions in total
+    auto runUntil = [&](auto& cpu, uint64_t target) {
+        if (target > maxInstructions) target = maxInstructions;
+        if (!m.halted && m.instructions < target) cpu.run(target - m.instructions);
+    };
+
+    for (size_t k = 0; !m.halted; k++) {
+        // Pick the next sample
+        SamplePoint point;
+        if (config.period > 0) {
+            uint64_t end = (k + 1) * config.period;
+            point = {end > config.detail ? end - config.detail : 0, 1.0};
+        } else if (k < config.points.size()) {
+            point = config.points[k];
+        } else {
+            break;
+        }
+        if (point.start >= maxInstructions) break;
+        // Overlapping simulation points just start where the last sample ended
+        if (point.start < m.instructions) point.start = m.instructions;
+
+        // Fast-forward, then warm up right before the sample
+        uint64_t warmStart = point.start > config.warmup ? point.start - config.warmup : 0;
+        runUntil(fast, warmStart);
+        runUntil(warming, point.start);
+        if (m.halted) break;
+
+        // Measure the detailed window
+        uint64_t startCycle = detailed.timing.cycle;
+        uint64_t startCount = m.instructions;
+        runUntil(detailed, point.start + config.detail);
+        uint64_t n = m.instructions - startCount;
+        if (n > 0) {
+            report.samples.push_back({startCount, n, detailed.timing.cycle - startCycle, point.weight});
+            report.detailedInstructions += n;
+        }
+    }
+
+    // Finish the program functionally so we know how long it really is
+    runUntil(fast, maxInstructions);
+    report.totalInstructions = m.instructions;
+    estimateCpi(report);
+    return report;
+}
+
+inline void printSamplingReport(const SamplingReport& report, std::ostream& out) {
+    out << "Sampling: " << report.samples.size() << " detailed samples, "
+        << report.detailedInstructions << " of " << report.totalInstructions << " instructions simulated in detail ("
+        << std::fixed << std::setprecision(2)
+        << (report.totalInstructions ? 100.0 * report.detailedInstructions / report.totalInstructions : 0.0) << "%)" << std::endl;
+    out << "  sample      start   instructions    CPI   weight" << std::endl;
+    for (size_t i = 0; i < report.samples.size() && i < 20; i++) {
+        const SampleResult& s = report.samples[i];
+        out << "  " << std::setw(6) << i << std::setw(11) << s.start << std::setw(15) << s.instructions
+            << std::setprecision(3) << std::setw(7) << (double)s.cycles / s.instructions
+            << std::setw(9) << s.weight << std::endl;
+    }
+    if (report.samples.size() > 20) {
+        out << "  ... (" << report.samples.size() - 20 << " more)" << std::endl;
+    }
+    out << "Estimated CPI: " << std::setprecision(3) << report.cpi << " +/- " << report.errorBound
+        << " (95% confidence)" << std::endl;
+    out << "Estimated cycles: " << std::setprecision(0) << report.cpi * report.totalInstructions
+        << " +/- " << report.errorBound * report.totalInstructions << std::endl;
+    out << std::defaultfloat;
+}
+
+#endif
@@ -0,0 +1,464 @@
+/*
+================================================================================
+                        SUPERBLOCK INTERPRETER WITH BLOCK CHAINING
+================================================================================
+
+Cpu::run goes back to its switch after every instruction, and that one
+indirect jump has to guess among all the opcodes every time. SuperblockCpu
+(the plain engine: no trace, no timing model) runs the program as
+SUPERBLOCKS instead:
+
+    superblock    a straight run of predecoded instructions copied out of the
+                  text, that goes THROUGH beq/bne along the direction they
+                  usually take; a branch going the other way leaves the block
+                  by a "side exit"
+    threaded code each instruction in a block holds the address of its
+                  handler, and each handler jumps straight to the next one's
+                  (GCC/Clang "labels as values"; other compilers get a switch)
+    chaining      the ordinary exits at the end of a block (both ways of the
+                  last branch, or falling into code that starts another
+                  block) are linked to the block they lead to the first time
+                  they are taken, so a loop runs block to block without ever
+                  going back to the dispatcher
+
+The dispatcher (look up or form the block starting at the pc) is only entered
+on side exits, exits into code that blocks do not cover (syscalls, unknown
+instructions, the end of the program) and after invalidations.
+
+Block formation guesses backward branches taken and forward ones not taken.
+Each side exit is counted; when one is taken on more than half of its
+block's runs, the branch's guess is flipped and all blocks are thrown away
+(an invalidation) so they are formed again along the better path. A branch
+that keeps flipping ends blocks instead (both ways are then ordinary exits).
+
+A block never runs unless the --max budget covers all of it; the last few
+instructions before the limit go through the plain Cpu engine. Bulk loops
+(mips_idiom.h) are run in bulk here as well, so the results are always the
+same as Cpu<NoTrace, Memory, NoTiming>'s.
+================================================================================
+*/
+#ifndef MIPS_SUPERBLOCK_H
+#define MIPS_SUPERBLOCK_H
+
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "mips_cpu.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MIPS_THREADED_CODE 1
+#else
+#define MIPS_THREADED_CODE 0
+#endif
+
+// What a block slot does: the Op itself for straight-line instructions, or one of these
+enum SuperblockKind : uint8_t {
+    SB_BEQ_STAY_TAKEN = OP_COUNT,     // branch inside a block: the block continues at the target...
+    SB_BEQ_STAY_NOT,                  // ...or at the next instruction; the other way is a side exit
+    SB_BNE_STAY_TAKEN,
+    SB_BNE_STAY_NOT,
+    SB_BEQ_END,                       // branch ending a block: both ways are chained exits
+    SB_BNE_END,
+    SB_END,                           // not an instruction: the block falls through to its exit
+    SB_KINDS
+};
+
+struct Superblock;
+
+// One way out of a block
+struct SuperblockExit {
+    uint32_t pc;                      // where execution goes on
+    uint32_t instructions;            // instructions of the block executed on the way out
+    uint32_t branch;                  // pc of the branch it leaves by (side exits)
+    bool side;
+    uint64_t taken = 0;               // side exits: times taken since the block was formed
+    Superblock* next = nullptr;       // chained successor (found the first time it is needed)
+};
+
+struct SuperblockSlot {
+    const void* handler;              // label of the kind's handler (threaded code)
+    uint8_t kind;
+    uint8_t exit;                     // branches: index of the first exit they use
+    Decoded d;
+};
+
+struct Superblock {
+    uint32_t entry;                   // pc of the first instruction
+    uint32_t length = 0;              // most instructions a run of the block executes
+    uint64_t runs = 0;
+    std::vector<SuperblockSlot> slots;
+    std::vector<SuperblockExit> exits;
+};
+
+template <class Memory>
+class SuperblockCpu {
+public:
+    static const uint32_t MAX_LENGTH = 64;     // instructions per superblock
+    static const uint32_t MAX_FLIPS = 3;       // guess changes before a branch just ends blocks
+
+    Machine& machine;
+    uint64_t dispatches = 0;          // times the dispatcher picked the next block (or instruction)
+    uint64_t chained = 0;             // block-to-block transfers through a chained exit
+    uint64_t sideExits = 0;
+    uint64_t formed = 0;              // blocks formed (again, after invalidations)
+    uint64_t invalidations = 0;
+    uint64_t executed = 0;            // instructions executed by run()
+
+    explicit SuperblockCpu(Machine& m) : machine(m) {}
+
+    static std::string name() { return std::string("SuperblockCpu<") + Memory::name + ">"; }
+
+    // Same contract as Cpu::run: up to maxInstructions, returns how many were executed
+    uint64_t run(uint64_t maxInstructions);
+
+    // Most instructions the block at the machine's pc executes, 0 if it is not formed (yet).
+    // A run() with that budget goes through the block as a block, not through the plain Cpu
+    // (mips_lockstep.h uses it to compare states block by block).
+    uint32_t formedBlockLength() const {
+        uint32_t pc = machine.pc;
+        if (formedFor != machine.text.program.get() || pc >= blockAt.size() || !blockAt[pc]) return 0;
+        return blockAt[pc]->length;
+    }
+
+    void report(std::ostream& out) const {
+        out << std::fixed << std::setprecision(1);
+        out << "Superblocks: " << formed << " formed (" << blocks.size() << " live, "
+            << (blocks.empty() ? 0.0 : (double)liveLength() / blocks.size()) << " instructions each), "
+            << invalidations << " invalidations" << std::endl;
+        out << "  dispatches " << dispatches << ", chained exits " << chained << ", side exits " << sideExits
+            << ", instructions per dispatch " << (dispatches ? (double)executed / dispatches : 0.0) << std::endl;
+        out << std::defaultfloat;
+    }
+
+private:
+    enum : uint8_t { GUESS, TAKEN, NOT_TAKEN, UNBIASED };
+
+    std::deque<Superblock> blocks;    // a deque: chained exits point into it
+    std::vector<Superblock*> blockAt; // by entry pc
+    std::vector<uint8_t> direction;   // by branch pc: GUESS, TAKEN, NOT_TAKEN or UNBIASED
+    std::vector<uint8_t> flips;
+    const void* const* handlers = nullptr;
+    const DecodedProgram* formedFor = nullptr;   // the program the blocks were formed from
+
+    uint64_t liveLength() const {
+        uint64_t n = 0;
+        for (const Superblock& b : blocks) n += b.length;
+        return n;
+    }
+
+    static bool inBlocks(uint8_t op) { return op < OP_SYSCALL; }
+
+    void invalidate() {
+        blocks.clear();
+        blockAt.assign(machine.text.size(), nullptr);
+        invalidations++;
+    }
+
+    // The block starting at pc, formed on first use; nullptr if pc holds something blocks do not cover
+    Superblock* blockFor(uint32_t pc) {
+        Superblock* b = blockAt[pc];
+        return b ? b : form(pc);
+    }
+
+    Superblock* form(uint32_t entry) {
+        const ProgramText& text = machine.text;
+        if (!inBlocks(text[entry].op)) return nullptr;
+        blocks.emplace_back();
+        Superblock& b = blocks.back();
+        b.entry = entry;
+        std::vector<uint32_t> visited;
+        auto seen = [&visited](uint32_t pc) {
+            for (uint32_t v : visited) {
+                if (v == pc) return true;
+            }
+            return false;
+        };
+        auto slot = [&b](uint8_t kind, const Decoded& d, size_t exit) {
+            b.slots.push_back({nullptr, kind, (uint8_t)exit, d});
+        };
+
+        uint32_t pc = entry;
+        while (true) {
+            const Decoded& d = text[pc];
+            if (!inBlocks(d.op) || b.length == MAX_LENGTH || seen(pc)) {
+                slot(SB_END, d, b.exits.size());
+                b.exits.push_back({pc, b.length, 0, false});
+                break;
+            }
+            visited.push_back(pc);
+            b.length++;
+            if (!isBranch(d.op)) {
+                slot(d.op, d, 0);
+                pc++;
+                continue;
+            }
+            bool beq = d.op == OP_BEQ;
+            uint8_t way = direction[pc];
+            if (way == GUESS) way = d.target <= pc || (beq && d.rs == d.rt) ? TAKEN : NOT_TAKEN;
+            uint32_t stay = way == TAKEN ? d.target : pc + 1;
+            if (d.loop || way == UNBIASED || stay == entry || seen(stay)) {
+                slot(beq ? SB_BEQ_END : SB_BNE_END, d, b.exits.size());
+                b.exits.push_back({d.target, b.length, pc, false});
+                b.exits.push_back({pc + 1, b.length, pc, false});
+                break;
+            }
+            uint8_t kind = way == TAKEN ? (beq ? SB_BEQ_STAY_TAKEN : SB_BNE_STAY_TAKEN)
+                                        : (beq ? SB_BEQ_STAY_NOT : SB_BNE_STAY_NOT);
+            slot(kind, d, b.exits.size());
+            b.exits.push_back({way == TAKEN ? pc + 1 : d.target, b.length, pc, true});
+            pc = stay;
+        }
+        for (SuperblockSlot& s : b.slots) s.handler = handlers ? handlers[s.kind] : nullptr;
+        blockAt[entry] = &b;
+        formed++;
+        return &b;
+    }
+
+    // A side exit was taken: flips the branch's guess (and starts over) once it is the usual way
+    bool retrain(const Superblock& b, SuperblockExit& e) {
+        if (++e.taken < 32 || e.taken * 2 <= b.runs) return false;
+        uint32_t pc = e.branch;
+        bool fellThrough = e.pc == pc + 1;
+        direction[pc] = ++flips[pc] >= MAX_FLIPS ? UNBIASED : fellThrough ? NOT_TAKEN : TAKEN;
+        invalidate();
+        return true;
+    }
+};
+
+template <class Memory>
+uint64_t SuperblockCpu<Memory>::run(uint64_t maxInstructions) {
+#if MIPS_THREADED_CODE
+    // Indexed by slot kind; Ops that never appear in a block point at the end handler
+    static const void* const table[SB_KINDS] = {
+        &&op_OP_ADD, &&op_OP_SUB, &&op_OP_AND, &&op_OP_OR, &&op_OP_XOR, &&op_OP_ADDI, &&op_OP_LW, &&op_OP_SW,
+        &&op_SB_END, &&op_SB_END,                                         // OP_BEQ, OP_BNE
+        &&op_OP_SLL, &&op_OP_SRL, &&op_OP_SRA, &&op_OP_SLLV, &&op_OP_SLT, &&op_OP_SLTU, &&op_OP_SLTI,
+        &&op_OP_ANDI, &&op_OP_ORI, &&op_OP_XORI, &&op_OP_LUI, &&op_OP_MULT, &&op_OP_DIV, &&op_OP_MFHI, &&op_OP_MFLO,
+        &&op_OP_LB, &&op_OP_LH, &&op_OP_LBU, &&op_OP_SB, &&op_OP_SH,
+        &&op_SB_END, &&op_SB_END, &&op_SB_END,                               // OP_SYSCALL, OP_UNKNOWN, OP_HALT
+        &&op_SB_BEQ_STAY_TAKEN, &&op_SB_BEQ_STAY_NOT, &&op_SB_BNE_STAY_TAKEN, &&op_SB_BNE_STAY_NOT,
+        &&op_SB_BEQ_END, &&op_SB_BNE_END, &&op_SB_END};
+    static_assert(OP_SYSCALL == 30 && OP_COUNT == 33, "the handler table follows the Op order");
+    handlers = table;
+#define SB_OP(kind) op_##kind:
+#define SB_START goto *s->handler
+#define SB_NEXT do { s++; goto *s->handler; } while (0)
+#else
+#define SB_OP(kind) case kind:
+#define SB_START goto dispatch
+#define SB_NEXT do { s++; goto dispatch; } while (0)
+#endif
+
+    Machine& m = machine;
+    if (formedFor != m.text.program.get()) {
+        // A new program (or the first run): nothing formed so far is any good
+        blocks.clear();
+        blockAt.assign(m.text.size(), nullptr);
+        direction.assign(m.text.size(), GUESS);
+        flips.assign(m.text.size(), 0);
+        formedFor = m.text.program.get();
+    }
+    int* R = m.registers;
+    int* M = m.memory.data();
+    uint8_t* D = m.memory.dirtyMap();
+    uint32_t pc = m.pc;
+    uint64_t count = 0;
+    int32_t addr = 0, byteAddr = 0;
+    uint32_t shift = 0;
+    Superblock* b = nullptr;
+    const SuperblockSlot* s = nullptr;
+    SuperblockExit* e = nullptr;
+
+    while (count < maxInstructions) {
+        dispatches++;
+        b = blockFor(pc);
+        if (!b) {
+            // Syscalls, unknown instructions and the end of the program, one at a time as in Cpu::run
+            const Decoded& d = m.text[pc];
+            if (d.op == OP_HALT) {
+                m.halted = true;
+                break;
+            }
+            uint32_t nextPc = pc + 1;
+            if (d.op == OP_SYSCALL && m.os) {
+                if (!m.os->handle(m)) nextPc = (uint32_t)m.text.size() - 1;
+                M = m.memory.data();
+                D = m.memory.dirtyMap();
+            } else {
+                m.unknown++;
+            }
+            pc = nextPc;
+            count++;
+            continue;
+        }
+
+        while (true) {
+            if (maxInstructions - count < b->length) {
+                // Not enough budget for the whole block: the plain engine does the rest
+                m.pc = pc;
+                m.instructions += count;
+                executed += count;
+                uint64_t rest = Cpu<NoTrace, Memory, NoTiming>(m).run(maxInstructions - count);
+                executed += rest;
+                return count + rest;
+            }
+            b->runs++;
+            s = b->slots.data();
+            SB_START;
+
+#if !MIPS_THREADED_CODE
+        dispatch:
+            switch (s->kind) {
+#endif
+            // Same arithmetic as Cpu::run
+            SB_OP(OP_ADD) R[s->d.rd] = (int)((uint32_t)R[s->d.rs] + (uint32_t)R[s->d.rt]); SB_NEXT;
+            SB_OP(OP_SUB) R[s->d.rd] = (int)((uint32_t)R[s->d.rs] - (uint32_t)R[s->d.rt]); SB_NEXT;
+            SB_OP(OP_AND) R[s->d.rd] = R[s->d.rs] & R[s->d.rt]; SB_NEXT;
+            SB_OP(OP_OR)  R[s->d.rd] = R[s->d.rs] | R[s->d.rt]; SB_NEXT;
+            SB_OP(OP_XOR) R[s->d.rd] = R[s->d.rs] ^ R[s->d.rt]; SB_NEXT;
+            SB_OP(OP_ADDI) R[s->d.rt] = (int)((uint32_t)R[s->d.rs] + (uint32_t)s->d.imm); SB_NEXT;
+            SB_OP(OP_SLL)  R[s->d.rd] = (int)((uint32_t)R[s->d.rt] << s->d.shamt); SB_NEXT;
+            SB_OP(OP_SRL)  R[s->d.rd] = (int)((uint32_t)R[s->d.rt] >> s->d.shamt); SB_NEXT;
+            SB_OP(OP_SRA)  R[s->d.rd] = R[s->d.rt] >> s->d.shamt; SB_NEXT;
+            SB_OP(OP_SLLV) R[s->d.rd] = (int)((uint32_t)R[s->d.rt] << (R[s->d.rs] & 31)); SB_NEXT;
+            SB_OP(OP_SLT)  R[s->d.rd] = R[s->d.rs] < R[s->d.rt]; SB_NEXT;
+            SB_OP(OP_SLTU) R[s->d.rd] = (uint32_t)R[s->d.rs] < (uint32_t)R[s->d.rt]; SB_NEXT;
+            SB_OP(OP_SLTI) R[s->d.rt] = R[s->d.rs] < s->d.imm; SB_NEXT;
+            SB_OP(OP_ANDI) R[s->d.rt] = R[s->d.rs] & s->d.imm; SB_NEXT;
+            SB_OP(OP_ORI)  R[s->d.rt] = R[s->d.rs] | s->d.imm; SB_NEXT;
+            SB_OP(OP_XORI) R[s->d.rt] = R[s->d.rs] ^ s->d.imm; SB_NEXT;
+            SB_OP(OP_LUI)  R[s->d.rt] = s->d.imm; SB_NEXT;
+            SB_OP(OP_MULT) {
+                int64_t product = (int64_t)R[s->d.rs] * R[s->d.rt];
+                m.hi = (int)(product >> 32);
+                m.lo = (int)(uint32_t)product;
+                SB_NEXT;
+            }
+            SB_OP(OP_DIV)
+                if (R[s->d.rt] == 0) SB_NEXT;
+                if (R[s->d.rs] == INT32_MIN && R[s->d.rt] == -1) {
+                    m.lo = INT32_MIN;
+                    m.hi = 0;
+                } else {
+                    m.lo = R[s->d.rs] / R[s->d.rt];
+                    m.hi = R[s->d.rs] % R[s->d.rt];
+                }
+                SB_NEXT;
+            SB_OP(OP_MFHI) R[s->d.rd] = m.hi; SB_NEXT;
+            SB_OP(OP_MFLO) R[s->d.rd] = m.lo; SB_NEXT;
+            SB_OP(OP_LW)
+                addr = (int32_t)((uint32_t)R[s->d.rs] + (uint32_t)s->d.imm);
+                if (Memory::valid(m, addr)) R[s->d.rt] = M[addr];
+                else memoryFault(m, addr);
+                SB_NEXT;
+            SB_OP(OP_SW)
+                addr = (int32_t)((uint32_t)R[s->d.rs] + (uint32_t)s->d.imm);
+                if (Memory::valid(m, addr)) {
+                    M[addr] = R[s->d.rt];
+                    D[addr >> DataMemory::PAGE_SHIFT] = DataMemory::WRITTEN;
+                } else {
+                    memoryFault(m, addr);
+                }
+                SB_NEXT;
+            SB_OP(OP_LB)
+            SB_OP(OP_LBU)
+                byteAddr = (int32_t)((uint32_t)R[s->d.rs] + (uint32_t)s->d.imm);
+                addr = byteAddr >> 2;
+                shift = (byteAddr & 3) * 8;
+                if (!Memory::valid(m, addr)) memoryFault(m, byteAddr);
+                else if (s->d.op == OP_LB) R[s->d.rt] = (int8_t)((uint32_t)M[addr] >> shift);
+                else R[s->d.rt] = (uint8_t)((uint32_t)M[addr] >> shift);
+                SB_NEXT;
+            SB_OP(OP_LH)
+                byteAddr = (int32_t)((uint32_t)R[s->d.rs] + (uint32_t)s->d.imm);
+                addr = byteAddr >> 2;
+                shift = (byteAddr & 2) * 8;
+                if (Memory::valid(m, addr) && Memory::aligned(byteAddr, 2)) R[s->d.rt] = (int16_t)((uint32_t)M[addr] >> shift);
+                else memoryFault(m, byteAddr);
+                SB_NEXT;
+            SB_OP(OP_SB)
+                byteAddr = (int32_t)((uint32_t)R[s->d.rs] + (uint32_t)s->d.imm);
+                addr = byteAddr >> 2;
+                shift = (byteAddr & 3) * 8;
+                if (Memory::valid(m, addr)) {
+                    M[addr] = (int)(((uint32_t)M[addr] & ~(0xFFu << shift)) | (((uint32_t)R[s->d.rt] & 0xFFu) << shift));
+                    D[addr >> DataMemory::PAGE_SHIFT] = DataMemory::WRITTEN;
+                } else {
+                    memoryFault(m, byteAddr);
+                }
+                SB_NEXT;
+            SB_OP(OP_SH)
+                byteAddr = (int32_t)((uint32_t)R[s->d.rs] + (uint32_t)s->d.imm);
+                addr = byteAddr >> 2;
+                shift = (byteAddr & 2) * 8;
+                if (Memory::valid(m, addr) && Memory::aligned(byteAddr, 2)) {
+                    M[addr] = (int)(((uint32_t)M[addr] & ~(0xFFFFu << shift)) | (((uint32_t)R[s->d.rt] & 0xFFFFu) << shift));
+                    D[addr >> DataMemory::PAGE_SHIFT] = DataMemory::WRITTEN;
+                } else {
+                    memoryFault(m, byteAddr);
+                }
+                SB_NEXT;
+
+            // Branches inside the block: going the usual way is just the next slot
+            SB_OP(SB_BEQ_STAY_TAKEN) if (R[s->d.rs] == R[s->d.rt]) SB_NEXT; goto side;
+            SB_OP(SB_BEQ_STAY_NOT)   if (R[s->d.rs] != R[s->d.rt]) SB_NEXT; goto side;
+            SB_OP(SB_BNE_STAY_TAKEN) if (R[s->d.rs] != R[s->d.rt]) SB_NEXT; goto side;
+            SB_OP(SB_BNE_STAY_NOT)   if (R[s->d.rs] == R[s->d.rt]) SB_NEXT; goto side;
+
+            // The branch ending the block: exits[exit] is the taken way, exits[exit + 1] the other
+            SB_OP(SB_BEQ_END)
+                e = &b->exits[s->exit + (R[s->d.rs] == R[s->d.rt] ? 0 : 1)];
+                goto leave;
+            SB_OP(SB_BNE_END)
+                e = &b->exits[s->exit + (R[s->d.rs] != R[s->d.rt] ? 0 : 1)];
+                if (s->d.loop && e == &b->exits[s->exit]) {
+                    // A recognized copy/clear/scan loop: the remaining iterations in one go (mips_idiom.h)
+                    uint64_t skipped = runLoopIdiom(m.text.loops()[s->d.loop - 1], R, m.memory,
+                                                    maxInstructions - count - e->instructions);
+                    if (skipped) {
+                        count += skipped;
+                        m.idiomInstructions += skipped;
+                        e++;
+                    }
+                }
+                goto leave;
+            SB_OP(SB_END)
+                e = &b->exits[s->exit];
+                goto leave;
+#if !MIPS_THREADED_CODE
+            }
+#endif
+        side:
+            e = &b->exits[s->exit];
+            count += e->instructions;
+            pc = e->pc;
+            sideExits++;
+            retrain(*b, *e);
+            break;
+
+        leave:
+            count += e->instructions;
+            pc = e->pc;
+            if (!e->next) {
+                e->next = blockFor(pc);
+                if (!e->next) break;
+            }
+            b = e->next;
+            chained++;
+        }
+    }
+#undef SB_OP
+#undef SB_START
+#undef SB_NEXT
+
+    m.pc = pc;
+    m.instructions += count;
+    executed += count;
+    if (m.os) m.os->flush();
+    return count;
+}
+
+#endif
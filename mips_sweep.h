@@ -0,0 +1,278 @@
+/*
+================================================================================
+                        DESIGN-SPACE SWEEP
+================================================================================
+
+Evaluates many cache / branch predictor configurations in ONE run instead of
+one simulation per configuration. The timing models never change what the
+program computes, so they can all be fed from the same instruction stream:
+
+    producer    the functional engine runs the program once (with the
+                SweepTrace policy) or a trace recorded with --trace is read
+                back, and the InstrEvents are cut into chunks of 64K
+    fan-out     every chunk is handed to all worker threads (shared, read-only)
+    workers     each thread owns some of the configurations, one
+                PipelineTiming per configuration, and runs its models over
+                every chunk
+
+The program is executed once whatever the number of configurations, and the
+models run in parallel, so the wall time grows with configurations divided by
+threads. Only a few chunks are in flight at a time, so memory stays bounded
+however long the run.
+
+A grid is written as key=values pairs separated by ':', e.g.
+    dsets=16,64,256:dways=1,2,4:bp=256,4096
+keys: dsets dways dline (L1D sets, ways, words per line), isets iways iline
+(L1I) and bp (predictor entries). Every combination is evaluated; keys left
+out keep the default value. "default" is a grid of 240 L1D/predictor configs.
+================================================================================
+*/
+#ifndef MIPS_SWEEP_H
+#define MIPS_SWEEP_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mips_cpu.h"
+
+// One point of the design space
+struct SweepConfig {
+    CacheConfig icache;
+    CacheConfig dcache;
+    uint32_t predictorEntries = 1024;
+};
+
+struct SweepResult {
+    SweepConfig config;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    double icacheMissRate = 0;
+    double dcacheMissRate = 0;
+    double mispredictRate = 0;
+};
+
+// Expands a grid such as "dsets=16,64:dways=1,2,4:bp=1024" into its configurations
+inline bool parseSweepGrid(const std::string& spec, std::vector<SweepConfig>& configs) {
+    std::string text = spec == "default" ? "dsets=16,32,64,128,256:dways=1,2,4,8:dline=2,4,8,16:bp=64,1024,4096" : spec;
+    std::map<std::string, std::vector<uint32_t>> values;
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ':')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string key = item.substr(0, eq);
+        if (key != "dsets" && key != "dways" && key != "dline" && key != "isets" && key != "iways" &&
+            key != "iline" && key != "bp") {
+            return false;
+        }
+        std::stringstream list(item.substr(eq + 1));
+        std::string number;
+        while (std::getline(list, number, ',')) {
+            uint32_t v = (uint32_t)std::stoul(number);
+            if (v == 0) return false;
+            values[key].push_back(v);
+        }
+    }
+
+    configs.assign(1, SweepConfig());
+    for (const auto& entry : values) {
+        std::vector<SweepConfig> expanded;
+        for (const SweepConfig& base : configs) {
+            for (uint32_t v : entry.second) {
+                SweepConfig c = base;
+                if (entry.first == "dsets") c.dcache.sets = v;
+                else if (entry.first == "dways") c.dcache.ways = v;
+                else if (entry.first == "dline") c.dcache.lineWords = v;
+                else if (entry.first == "isets") c.icache.sets = v;
+                else if (entry.first == "iways") c.icache.ways = v;
+                else if (entry.first == "iline") c.icache.lineWords = v;
+                else c.predictorEntries = v;
+                expanded.push_back(c);
+            }
+        }
+        configs = expanded;
+    }
+    return true;
+}
+
+/*
+EventFanout: one producer, several consumers that each see every event.
+push() fills a chunk; full chunks go to the back of a queue, every worker
+walks the queue at its own pace, and a chunk leaves the queue once all
+workers have taken it (the last shared_ptr frees it).
+*/
+class EventFanout {
+public:
+    static const size_t CHUNK_EVENTS = 1 << 16;
+    static const size_t MAX_CHUNKS = 8;        // chunks waiting in the queue before push() blocks
+
+    typedef std::shared_ptr<const std::vector<InstrEvent>> Chunk;
+
+    explicit EventFanout(int workers) : taken(workers, 0) { current.reserve(CHUNK_EVENTS); }
+
+    void push(const InstrEvent& ev) {
+        current.push_back(ev);
+        if (current.size() == CHUNK_EVENTS) publish();
+    }
+
+    // Hands over a whole block of events (used when reading a trace file)
+    void pushChunk(std::vector<InstrEvent>&& events) {
+        publish();
+        current = std::move(events);
+        publish();
+    }
+
+    // No more events: workers drain the queue and stop
+    void finish() {
+        publish();
+        std::lock_guard<std::mutex> guard(lock);
+        done = true;
+        changed.notify_all();
+    }
+
+    // Worker side: waits for the next chunk; returns false once everything was seen
+    bool next(int worker, Chunk& chunk) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&] { return taken[worker] < firstIndex + queue.size() || done; });
+        if (taken[worker] == firstIndex + queue.size()) return false;
+        chunk = queue[taken[worker] - firstIndex];
+        taken[worker]++;
+        // Drop chunks every worker has taken, and let the producer go on
+        while (!queue.empty() && allTaken(firstIndex)) {
+            queue.pop_front();
+            firstIndex++;
+            changed.notify_all();
+        }
+        return true;
+    }
+
+private:
+    std::vector<InstrEvent> current;
+    std::deque<Chunk> queue;
+    uint64_t firstIndex = 0;             // number of the chunk at the front of the queue
+    std::vector<uint64_t> taken;         // chunks each worker has taken so far
+    bool done = false;
+    std::mutex lock;
+    std::condition_variable changed;
+
+    bool allTaken(uint64_t index) const {
+        for (uint64_t t : taken) {
+            if (t <= index) return false;
+        }
+        return true;
+    }
+
+    void publish() {
+        if (current.empty()) return;
+        Chunk chunk = std::make_shared<const std::vector<InstrEvent>>(std::move(current));
+        current = std::vector<InstrEvent>();
+        current.reserve(CHUNK_EVENTS);
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&] { return queue.size() < MAX_CHUNKS; });
+        queue.push_back(chunk);
+        changed.notify_all();
+    }
+};
+
+// SweepTrace: a trace policy that feeds every executed instruction to an EventFanout
+struct SweepTrace {
+    static constexpr const char* name = "SweepTrace";
+    static constexpr bool enabled = true;
+    EventFanout* fanout = nullptr;
+    void record(const Machine&, const Decoded&, const InstrEvent& ev) { fanout->push(ev); }
+};
+
+/*
+Runs every configuration over the events the producer function pushes into
+the fan-out. threads = 0 uses one thread per host core.
+*/
+template <class Producer>
+std::vector<SweepResult> runSweep(const std::vector<SweepConfig>& configs, unsigned threads, Producer produce) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (threads > configs.size()) threads = (unsigned)configs.size();
+
+    // One PipelineTiming per configuration
+    std::vector<std::unique_ptr<PipelineTiming>> models;
+    for (const SweepConfig& c : configs) {
+        models.emplace_back(new PipelineTiming());
+        models.back()->icache = Cache(c.icache);
+        models.back()->dcache = Cache(c.dcache);
+        models.back()->predictor = BranchPredictor(c.predictorEntries);
+    }
+
+    EventFanout fanout((int)threads);
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < threads; w++) {
+        workers.emplace_back([&, w] {
+            EventFanout::Chunk chunk;
+            while (fanout.next((int)w, chunk)) {
+                // Worker w owns configurations w, w + threads, ...; one model at a time keeps it in the host cache
+                for (size_t k = w; k < models.size(); k += threads) {
+                    PipelineTiming& model = *models[k];
+                    for (const InstrEvent& ev : *chunk) model.retire(ev);
+                }
+                chunk.reset();
+            }
+        });
+    }
+    produce(fanout);
+    fanout.finish();
+    for (std::thread& t : workers) t.join();
+
+    std::vector<SweepResult> results;
+    for (size_t k = 0; k < configs.size(); k++) {
+        const PipelineTiming& model = *models[k];
+        SweepResult r;
+        r.config = configs[k];
+        r.instructions = model.instructions;
+        r.cycles = model.cycles();
+        r.icacheMissRate = model.icache.missRate();
+        r.dcacheMissRate = model.dcache.missRate();
+        r.mispredictRate = model.predictor.mispredictRate();
+        results.push_back(r);
+    }
+    return results;
+}
+
+// Reads a --trace file back into the fan-out, one chunk at a time
+inline bool produceFromTrace(const std::string& path, EventFanout& fanout) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) return false;
+    while (true) {
+        std::vector<InstrEvent> events(EventFanout::CHUNK_EVENTS);
+        size_t n = fread(events.data(), sizeof(InstrEvent), events.size(), in);
+        if (n == 0) break;
+        events.resize(n);
+        fanout.pushChunk(std::move(events));
+    }
+    fclose(in);
+    return true;
+}
+
+// One CSV line per configuration
+inline void writeSweepCsv(std::ostream& out, const std::vector<SweepResult>& results) {
+    out << "l1i_sets,l1i_ways,l1i_line_words,l1d_sets,l1d_ways,l1d_line_words,predictor_entries,"
+           "instructions,cycles,cpi,l1i_miss_rate,l1d_miss_rate,branch_mispredict_rate"
+        << std::endl;
+    for (const SweepResult& r : results) {
+        const SweepConfig& c = r.config;
+        out << c.icache.sets << "," << c.icache.ways << "," << c.icache.lineWords << "," << c.dcache.sets << ","
+            << c.dcache.ways << "," << c.dcache.lineWords << "," << c.predictorEntries << "," << r.instructions << ","
+            << r.cycles << "," << std::fixed << std::setprecision(4)
+            << (r.instructions ? (double)r.cycles / r.instructions : 0.0) << "," << std::setprecision(6)
+            << r.icacheMissRate << "," << r.dcacheMissRate << "," << r.mispredictRate << std::defaultfloat << std::endl;
+    }
+}
+
+#endif
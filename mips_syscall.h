@@ -0,0 +1,179 @@
+/*
+================================================================================
+                        SYSCALL EMULATION
+================================================================================
+
+The SPIM/MARS system services, so that programs written for those simulators
+(or compiled for them) can print their results and exit on their own:
+
+    $v0  service        arguments               result
+    ---  -------------  ----------------------  -------------------------
+      1  print_int      $a0 = integer
+      4  print_string   $a0 = byte address
+      5  read_int                               $v0 = integer
+      8  read_string    $a0 = buffer, $a1 = size
+      9  sbrk           $a0 = bytes             $v0 = byte address of block
+     10  exit
+     11  print_char     $a0 = character
+     12  read_char                              $v0 = character
+     17  exit2          $a0 = exit code
+
+Addresses are BYTE addresses as for lb/sb: the string at byte address A
+starts in word A/4. sbrk returns a byte address too, so a program that wants
+to use the block with lw/sw shifts it right by 2 first. The heap starts at
+the end of the data memory and sbrk grows the memory, by up to 256 MB past
+its size at the first sbrk (so --mem-words of several GB still leaves room
+for a heap), and only as far as a positive byte address in $v0 can reach
+(2 GB); past that sbrk returns -1.
+
+Output goes to a host buffer that is written out in large pieces (and before
+every read, so prompts show up), so printing in a loop costs no system call
+per character.
+================================================================================
+*/
+#ifndef MIPS_SYSCALL_H
+#define MIPS_SYSCALL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "mips_cpu.h"
+
+class SpimSyscalls : public SyscallHandler {
+public:
+    uint64_t calls = 0;
+    uint64_t unsupported = 0;            // unknown service numbers (ignored)
+    bool exited = false;                 // the program called exit / exit2
+
+    // out == nullptr throws the output away (used when benchmarking)
+    explicit SpimSyscalls(FILE* out = stdout, FILE* in = stdin) : out(out), in(in) {}
+
+    ~SpimSyscalls() { flush(); }
+
+    SpimSyscalls(const SpimSyscalls&) = delete;
+    SpimSyscalls& operator=(const SpimSyscalls&) = delete;
+
+    bool handle(Machine& m) override {
+        calls++;
+        int* R = m.registers;
+        switch (R[2]) {
+            case 1:
+                write(std::to_string(R[4]));
+                break;
+            case 4:
+                printString(m, (uint32_t)R[4]);
+                break;
+            case 5: {
+                flush();
+                int value = 0;
+                R[2] = (in && fscanf(in, "%d", &value) == 1) ? value : 0;
+                break;
+            }
+            case 8:
+                readString(m, (uint32_t)R[4], R[5]);
+                break;
+            case 9:
+                R[2] = sbrk(m, R[4]);
+                break;
+            case 10:
+                return exit(m, 0);
+            case 11:
+                write(std::string(1, (char)R[4]));
+                break;
+            case 12: {
+                flush();
+                int c = in ? fgetc(in) : EOF;
+                R[2] = c == EOF ? 0 : c;
+                break;
+            }
+            case 17:
+                return exit(m, R[4]);
+            default:
+                unsupported++;
+                break;
+        }
+        return true;
+    }
+
+    // Writes whatever the program printed so far
+    void flush() override {
+        if (out && !buffer.empty()) {
+            fwrite(buffer.data(), 1, buffer.size(), out);
+            fflush(out);
+        }
+        buffer.clear();
+    }
+
+private:
+    // sbrk grows the data memory by at most this many words past its size at the first sbrk (256 MB)
+    static const size_t MAX_HEAP_WORDS = (size_t)1 << 26;
+    // ... and not past the last word a positive byte address can reach (2 GB)
+    static const size_t MAX_BREAK_WORDS = (size_t)1 << 29;
+    static const size_t FLUSH_BYTES = 1 << 16;
+
+    FILE* out;
+    FILE* in;
+    std::string buffer;
+    size_t heapBase = 0;                 // data memory words at the first sbrk (0 = none yet)
+
+    void write(const std::string& text) {
+        if (!out) return;
+        buffer += text;
+        if (buffer.size() >= FLUSH_BYTES) flush();
+    }
+
+    bool exit(Machine& m, int code) {
+        m.exitCode = code;
+        exited = true;
+        flush();
+        return false;
+    }
+
+    static bool byteInRange(const Machine& m, uint32_t byteAddr) {
+        return (byteAddr >> 2) < m.memory.size();
+    }
+
+    void printString(const Machine& m, uint32_t byteAddr) {
+        if (!out) return;
+        for (; byteInRange(m, byteAddr); byteAddr++) {
+            char c = (char)(m.memory[byteAddr >> 2] >> ((byteAddr & 3) * 8));
+            if (c == 0) break;
+            buffer += c;
+        }
+        if (buffer.size() >= FLUSH_BYTES) flush();
+    }
+
+    // Like fgets: at most size - 1 characters plus the terminating zero
+    void readString(Machine& m, uint32_t byteAddr, int size) {
+        flush();
+        if (size <= 0) return;
+        std::string line;
+        int c;
+        while (in && (int)line.size() < size - 1 && (c = fgetc(in)) != EOF) {
+            line += (char)c;
+            if (c == '\n') break;
+        }
+        line += '\0';
+        for (char ch : line) {
+            if (!byteInRange(m, byteAddr)) break;
+            int shift = (byteAddr & 3) * 8;
+            int& word = m.memory[byteAddr >> 2];
+            word = (int)(((uint32_t)word & ~(0xFFu << shift)) | ((uint32_t)(uint8_t)ch << shift));
+            byteAddr++;
+        }
+    }
+
+    // Returns the old break, or -1 if the memory cannot grow that far
+    int sbrk(Machine& m, int bytes) {
+        if (heapBase == 0) heapBase = m.memory.size();
+        if (m.memory.size() >= MAX_BREAK_WORDS) return -1;
+        uint32_t start = (uint32_t)m.memory.size() * 4;
+        if (bytes <= 0) return (int)start;
+        size_t words = m.memory.size() + ((size_t)bytes + 3) / 4;
+        if (words > heapBase + MAX_HEAP_WORDS || words > MAX_BREAK_WORDS) return -1;
+        m.memory.resize(words, 0);
+        return (int)start;
+    }
+};
+
+#endif
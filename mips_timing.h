@@ -0,0 +1,319 @@
+/*
+================================================================================
+                        TIMING MODELS (TIMING POLICIES)
+================================================================================
+
+A timing policy is plugged into the Cpu template (see mips_cpu.h) and is told
+about every instruction the CPU executes through retire(). It never changes
+what the program computes, it only counts how many CYCLES a real processor
+would have needed.
+
+Every timing policy provides:
+  - static constexpr const char* name (used in reports)
+  - static constexpr bool enabled   (false = the CPU does not even build events)
+  - void retire(const InstrEvent&)  (called once per executed instruction)
+  - uint64_t cycles() const         (total cycles so far)
+  - void report(std::ostream&)      (prints the model's statistics)
+================================================================================
+*/
+#ifndef MIPS_TIMING_H
+#define MIPS_TIMING_H
+
+#include <cstdint>
+#include <ostream>
+#include <iomanip>
+#include <vector>
+#include "mips_isa.h"
+#include "mips_cache.h"
+#include "mips_coherence.h"
+#include "mips_hierarchy.h"
+#include "mips_mmu.h"
+
+// NoTiming: functional simulation only, every hook compiles away
+struct NoTiming {
+    static constexpr const char* name = "NoTiming";
+    static constexpr bool enabled = false;
+    void retire(const InstrEvent&) {}
+    uint64_t cycles() const { return 0; }
+    void report(std::ostream&) const {}
+};
+
+/*
+BranchPredictor: a table of 2-bit saturating counters indexed by the branch PC
+(0,1 = predict not taken, 2,3 = predict taken). Correctly predicted branches
+cost nothing; a wrong guess flushes the instructions fetched behind the branch.
+*/
+struct BranchPredictor {
+    std::vector<uint8_t> counters;
+    uint64_t lookups = 0;
+    uint64_t mispredicts = 0;
+
+    explicit BranchPredictor(size_t entries = 1024)
+        : counters(entries, 1), mask((entries & (entries - 1)) == 0 ? entries - 1 : 0) {}
+
+    // Predicts, trains and counts one branch. Returns true if the guess was right.
+    bool predict(uint32_t pc, bool taken) {
+        lookups++;
+        bool correct = (counters[index(pc)] >= 2) == taken;
+        if (!correct) {
+            mispredicts++;
+        }
+        train(pc, taken);
+        return correct;
+    }
+
+    // Updates the counter without counting the branch (used while warming up)
+    void train(uint32_t pc, bool taken) {
+        uint8_t& c = counters[index(pc)];
+        if (taken && c < 3) c++;
+        if (!taken && c > 0) c--;
+    }
+
+    double mispredictRate() const { return lookups ? (double)mispredicts / lookups : 0.0; }
+
+private:
+    size_t mask;                      // entries - 1 for power-of-two tables, else 0 (divide)
+
+    size_t index(uint32_t pc) const { return mask ? pc & mask : pc % counters.size(); }
+};
+
+/*
+PipelineTiming: the classic 5-stage MIPS pipeline (IF ID EX MEM WB)
+
+We keep a small "scoreboard": for every register, the cycle at which its new
+value can be forwarded to an instruction entering EX. An instruction enters EX
+at the first cycle where the pipeline is free AND all of its source registers
+are ready; any difference is a data stall.
+  - ALU results forward from EX straight into the next instruction (no stall)
+  - load results only exist after MEM, so a dependent instruction right after
+    a load waits one cycle (the load-use hazard)
+  - mult/div run in their own unit; mfhi/mflo wait until HI/LO are ready
+  - beq/bne compare their registers in ID, one stage earlier than EX, so they
+    need their operands one cycle sooner
+  - branches go through a BranchPredictor; a wrong prediction flushes the
+    instruction fetched behind the branch (branchPenalty cycles)
+  - instruction fetch goes through the L1 instruction cache and lw/sw through
+    the L1 data cache; a miss freezes the pipeline for the cache's missPenalty,
+    or for as long as the L2/DRAM behind it takes when "memory" points at a
+    MemoryHierarchy (mips_hierarchy.h)
+  - on a multi-core machine lw/sw go through this core's coherent L1 in
+    "coherence" (mips_coherence.h) instead of dcache
+  - with an "mmu" (mips_mmu.h) every lw/sw address is translated first: an
+    L1 TLB miss costs the L2 TLB lookup, an L2 TLB miss a page walk whose
+    page-table reads go through the data cache; the caches see the physical
+    address
+
+SUPERSCALAR: with issueWidth > 1 up to that many instructions enter EX in the
+same cycle, still in program order. An instruction joins the group of the
+instruction before it unless the group is full, it needs a result produced
+inside the group, or every unit of its kind (ALU, memory, branch, mult/div) is
+already taken in that cycle (a structural stall). A freeze or a flush ends
+the group. issueSlots[k] counts the cycles in which k instructions issued.
+*/
+struct PipelineTiming {
+    static constexpr const char* name = "PipelineTiming";
+    static constexpr bool enabled = true;
+
+    int branchPenalty = 1;            // cycles lost on every mispredicted branch
+    int multLatency = 4;              // cycles until a mult result can be read from HI/LO
+    int divLatency = 20;              // cycles until a div result can be read from HI/LO
+    int issueWidth = 1;               // instructions that can enter EX per cycle
+    int aluUnits = 2;                 // functional units per kind (only matter when issueWidth > 1)
+    int memUnits = 1;
+    int branchUnits = 1;
+    int mulDivUnits = 1;
+    BranchPredictor predictor;
+    Cache icache;
+    Cache dcache;
+    MemoryHierarchy* memory = nullptr;  // L2 and DRAM behind the L1s (nullptr = fixed missPenalty)
+    CoherentCaches* coherence = nullptr;  // the cores' coherent L1Ds (nullptr = single core, use dcache)
+    int coreId = 0;                   // this core's cache in coherence
+    Mmu* mmu = nullptr;               // virtual memory: TLBs and page tables (nullptr = addresses are physical)
+
+    uint64_t cycle = 0;               // cycle the next instruction can enter EX
+    uint64_t regReady[NUM_TIMING_REGS] = {};  // cycle each register's value can be forwarded (32 = HI/LO)
+    uint64_t instructions = 0;
+    uint64_t dataStalls = 0;          // cycles lost waiting on register values
+    uint64_t controlStalls = 0;       // cycles lost to mispredicted branches
+    uint64_t memoryStalls = 0;        // cycles lost to cache misses
+    uint64_t structuralStalls = 0;    // instructions pushed to the next cycle by a busy unit
+    uint64_t dataAccessCycles = 0;    // lw/sw cycles in the memory system (1 per hit + miss time), for AMAT
+    uint64_t translationStalls = 0;   // cycles lost to TLB misses and page walks
+    std::vector<uint64_t> issueSlots; // cycles with 0, 1, ... issueWidth instructions issued
+
+    void retire(const InstrEvent& ev) {
+        // IF: an instruction cache miss delays everything behind it
+        if (!icache.access(ev.pc)) {
+            uint32_t penalty = missPenalty(icache, ev.pc, ev.pc, false);
+            cycle += penalty;
+            memoryStalls += penalty;
+        }
+
+        // Join the current issue group if it has room and nothing froze the pipeline since
+        uint64_t start = (groupCount < issueWidth && cycle == groupCycle + 1) ? groupCycle : cycle;
+
+        // Branches need their operands in ID, one cycle before EX
+        uint64_t early = isBranch(ev.op) ? 1 : 0;
+        uint64_t issue = start;
+        if (ev.src1 != NO_REG && regReady[ev.src1] + early > issue) issue = regReady[ev.src1] + early;
+        if (ev.src2 != NO_REG && regReady[ev.src2] + early > issue) issue = regReady[ev.src2] + early;
+        dataStalls += issue - start;
+
+        int unit = unitOf(ev.op);
+        if (issue == groupCycle && groupCount > 0 && unitsUsed[unit] >= unitCount(unit)) {
+            issue++;
+            structuralStalls++;
+        }
+        if (issue != groupCycle || groupCount == 0) {
+            startGroup(issue);
+        }
+        groupCount++;
+        unitsUsed[unit]++;
+        cycle = issue + 1;
+
+        // MEM: a data cache miss freezes the pipeline
+        if ((isLoad(ev.op) || isStore(ev.op)) && !(ev.flags & EV_FAULT)) {
+            dataAccessCycles++;
+            uint64_t addr = (uint32_t)ev.addr;
+            if (mmu) {
+                // Each page-table entry read is a load of its own: 1 cycle plus any miss
+                uint32_t translation = mmu->translate(addr, addr, [&](uint64_t pte) {
+                    return 1 + dataAccess(pte, false, ev.pc);
+                });
+                cycle += translation;
+                translationStalls += translation;
+            }
+            uint32_t penalty = dataAccess(addr, isStore(ev.op), ev.pc);
+            cycle += penalty;
+            memoryStalls += penalty;
+            dataAccessCycles += penalty;
+        }
+
+        // Loads produce their value after MEM, mult/div after their own unit, the rest after EX
+        if (ev.dst != NO_REG) {
+            if (isLoad(ev.op)) regReady[ev.dst] = cycle + 1;
+            else if (ev.op == OP_MULT) regReady[ev.dst] = issue + multLatency;
+            else if (ev.op == OP_DIV) regReady[ev.dst] = issue + divLatency;
+            else regReady[ev.dst] = issue + 1;
+        }
+        if (isBranch(ev.op) && !predictor.predict(ev.pc, ev.flags & EV_TAKEN)) {
+            cycle += branchPenalty;
+            controlStalls += branchPenalty;
+        }
+        instructions++;
+    }
+
+    // Warm-up: bring the caches and the predictor up to date without counting anything
+    void warm(const InstrEvent& ev) {
+        if (!icache.touch(ev.pc) && memory) memory->warm(ev.pc, false);
+        if ((isLoad(ev.op) || isStore(ev.op)) && !(ev.flags & EV_FAULT)) {
+            uint64_t addr = mmu ? mmu->warm((uint32_t)ev.addr) : (uint32_t)ev.addr;
+            if (!dcache.touch(addr) && memory) memory->warm(addr, true);
+        }
+        if (isBranch(ev.op)) {
+            predictor.train(ev.pc, ev.flags & EV_TAKEN);
+        }
+    }
+
+    // The last instruction still has to drain through MEM and WB (plus IF/ID fill at the start)
+    uint64_t cycles() const { return instructions ? cycle + 4 : 0; }
+
+    void report(std::ostream& out) const {
+        out << "Pipeline: " << cycles() << " cycles, CPI " << std::fixed << std::setprecision(3)
+            << (instructions ? (double)cycles() / instructions : 0.0) << std::endl;
+        out << "  data stalls:    " << dataStalls << std::endl;
+        out << "  control stalls: " << controlStalls << "  (branch mispredict rate "
+            << predictor.mispredictRate() * 100 << "%)" << std::endl;
+        out << "  memory stalls:  " << memoryStalls << "  (L1I miss rate " << icache.missRate() * 100
+            << "%, L1D miss rate " << (coherence ? coherence->missRate(coreId) : dcache.missRate()) * 100 << "%)"
+            << std::endl;
+        if (memory) {
+            uint64_t dataAccesses = coherence ? coherence->accesses(coreId) : dcache.accesses;
+            out << "  AMAT (lw/sw):   " << (dataAccesses ? (double)dataAccessCycles / dataAccesses : 0.0)
+                << " cycles" << std::endl;
+            memory->report(out, cycles());
+            out << std::fixed << std::setprecision(3);
+        }
+        if (mmu) {
+            out << "  translation stalls: " << translationStalls << std::endl;
+            mmu->report(out);
+            out << std::fixed << std::setprecision(3);
+        }
+        if (issueWidth > 1) {
+            out << "  structural stalls: " << structuralStalls << std::endl;
+            // The group still open at the end counts too
+            std::vector<uint64_t> slots = issueSlots;
+            slots.resize(issueWidth + 1, 0);
+            if (groupCount > 0) slots[groupCount]++;
+            uint64_t total = 0;
+            for (uint64_t n : slots) total += n;
+            out << "  issue slots used per cycle (" << issueWidth << "-wide):" << std::endl;
+            for (int k = 0; k <= issueWidth; k++) {
+                out << "    " << k << ": " << std::setw(12) << slots[k] << "  " << std::setw(6) << std::setprecision(1)
+                    << (total ? 100.0 * slots[k] / total : 0.0) << "%" << std::endl;
+            }
+            out << std::setprecision(3);
+        }
+        out << std::defaultfloat;
+    }
+
+private:
+    enum { UNIT_ALU, UNIT_MEM, UNIT_BRANCH, UNIT_MULDIV, NUM_UNITS };
+
+    uint64_t groupCycle = 0;          // cycle the current issue group enters EX
+    int groupCount = 0;               // instructions in the current group
+    int unitsUsed[NUM_UNITS] = {};
+
+    uint32_t missPenalty(const Cache& cache, uint64_t addr, uint32_t pc, bool data) {
+        return memory ? memory->access(addr, cycle, pc, data) : cache.config.missPenalty;
+    }
+
+    // Extra cycles of a data access through this core's L1D (0 = hit)
+    uint32_t dataAccess(uint64_t addr, bool write, uint32_t pc) {
+        if (coherence) return coherence->access(coreId, (uint32_t)addr, write, cycle, pc, memory);
+        return dcache.access(addr) ? 0 : missPenalty(dcache, addr, pc, true);
+    }
+
+    static int unitOf(uint8_t op) {
+        if (isLoad(op) || isStore(op)) return UNIT_MEM;
+        if (isBranch(op)) return UNIT_BRANCH;
+        if (isMulDiv(op)) return UNIT_MULDIV;
+        return UNIT_ALU;
+    }
+
+    int unitCount(int unit) const {
+        switch (unit) {
+            case UNIT_MEM: return memUnits;
+            case UNIT_BRANCH: return branchUnits;
+            case UNIT_MULDIV: return mulDivUnits;
+            default: return aluUnits;
+        }
+    }
+
+    // Closes the current group (and counts the empty cycles since it) and opens one at "at"
+    void startGroup(uint64_t at) {
+        if (issueSlots.size() < (size_t)issueWidth + 1) issueSlots.resize(issueWidth + 1, 0);
+        if (groupCount > 0) {
+            issueSlots[groupCount]++;
+            issueSlots[0] += at - groupCycle - 1;
+        }
+        groupCycle = at;
+        groupCount = 0;
+        for (int& used : unitsUsed) used = 0;
+    }
+};
+
+/*
+WarmingTiming: hands every instruction to PipelineTiming::warm(). Used by the
+sampling mode for the warm-up window just before a detailed sample.
+*/
+struct WarmingTiming {
+    static constexpr const char* name = "WarmingTiming";
+    static constexpr bool enabled = true;
+    PipelineTiming* model = nullptr;
+    void retire(const InstrEvent& ev) { model->warm(ev); }
+    uint64_t cycles() const { return 0; }
+    void report(std::ostream&) const {}
+};
+
+#endif
@@ -0,0 +1,1206 @@
+/*
+================================================================================
+                        MIPSSIM - WHOLE PROGRAM MIPS SIMULATOR
+================================================================================
+
+The classroom programs (finalreview.cpp etc.) read ONE instruction, execute
+it and print the state. mipssim loads a whole program, runs it with a fast
+predecoded engine (mips_cpu.h) and prints the final state and statistics.
+
+BUILD:
+    g++ -std=c++20 -O2 -pthread -o mipssim mipssim.cpp mips_cpu.cpp
+
+USAGE:
+    mipssim [options] [program.hex]
+
+    program.hex     one 8-digit hex instruction per line ('#' starts a comment)
+    --kernel NAME   run a built-in kernel instead of a file (see mips_programs.h)
+    --mem-words N   size of data memory in words (default 256); memories of 2 MB and up
+                    are put on host huge pages (mips_hostmem.h)
+    --no-huge-pages back the data memory with normal host pages
+    --no-numa       do not place memories on the host NUMA node of the thread using them
+    --max N         stop after N instructions (default 1000000000)
+    --unchecked     do not bounds-check lw/sw addresses (fastest engine)
+    --no-idioms     do not run copy/clear/scan loops as bulk host operations (mips_idiom.h);
+                    the results are the same, this is for checking that they are
+    --superblocks   run the plain engine as chained superblocks of threaded code and report
+                    instructions per dispatch (mips_superblock.h)
+    --timing        run the 5-stage pipeline timing model
+    --issue N       in-order pipeline issue width: 1 (default), 2 = dual, 4 = quad issue
+    --units A,M,B   ALU, memory and branch units of the superscalar pipeline (default 2,1,1)
+    --l2            put an L2 cache and a DRAM model behind the L1s (mips_hierarchy.h)
+    --prefetch K    L2 prefetcher: next or stride (implies --l2)
+    --cores N       run N cores on a shared memory, each with its own pipeline model and a
+                    MESI-coherent L1D; $k0 holds the core number (mips_multicore.h)
+    --quantum Q     instructions each core (or hart) runs per turn (default 1000)
+    --harts N       run N lightweight harts, each with its own memory, as coroutines on a
+                    pool of --threads host threads with work stealing (mips_harts.h);
+                    $k0 holds the hart number and --max applies to each hart
+    --private-l2    with --cores and --l2: one L2 per core instead of a shared one
+    --tlb           translate lw/sw addresses through TLBs and page tables (mips_mmu.h)
+    --page-kb N     page size in KB for --tlb: 4 (default) or a large page such as 2048
+    --tlb-entries L1,L2  entries of the L1 and L2 TLB (default 64,1024; implies --tlb)
+    --ooo           run the out-of-order core timing model (mips_ooo.h) instead
+    --decoupled     with --timing or --ooo: execute on one host thread and run the timing
+                    model on a second one, fed through a lock-free queue (mips_decoupled.h)
+    --width N       out-of-order fetch/dispatch/commit width (default 4)
+    --rob N         out-of-order reorder buffer entries (default 128)
+    --latencies A,L,M,D  out-of-order ALU, load (L1 hit), mult and div latencies in cycles
+                    (default 1,2,4,20)
+    --trace FILE    write a binary InstrEvent trace to FILE
+    --replay FILE   drive the pipeline model (or --ooo) from a --trace file without
+                    executing anything (mips_replay.h); no program is needed
+    --record LOG    log the run's inputs (program, options, syscall input, multi-core
+                    turns) to LOG (mips_record.h)
+    --replay-log LOG  run again from LOG alone and check that the final state and the
+                    cycle count are the same as recorded
+    --verbose       print every instruction and the state, like finalreview.cpp
+    --debug         step through the program forwards AND backwards; commands are read
+                    from standard input (mips_reverse.h):
+                      step [N], back [N], goto I, run, state, info, quit
+    --checkpoint-every N  instructions between --debug checkpoints (default 100000):
+                    less means faster seeks backwards and more memory
+    --bench         time the engine configurations against each other
+    --perf          also read the host's hardware counters (perf_event_open) around
+                    the run and report host cycles, branch misses and cache misses
+                    per simulated instruction for each engine
+
+  sampled timing (fast-forward, warm up, then measure a detailed window):
+    --sample P      one detailed sample every P instructions
+    --simpoints L   detailed samples at the given offsets, L = start[:weight],...
+    --warmup W      instructions of cache/predictor warm-up per sample (default 10000)
+    --detail M      instructions measured per sample (default 10000)
+    The detailed windows run the in-order pipeline model with --issue, --units, --l2,
+    --prefetch and --tlb (warmed up too); --ooo and --decoupled cannot be sampled.
+
+  picking simulation points:
+    --bbv FILE      write basic-block vectors per interval to FILE and cluster them
+    --interval N    instructions per interval (default 100000)
+    --clusters K    number of k-means clusters (default 8)
+
+  design-space sweep (one execution, many timing models on worker threads):
+    --sweep GRID    evaluate every cache/predictor configuration of GRID, e.g.
+                    dsets=16,64,256:dways=1,2,4:bp=256,4096, or "default" (mips_sweep.h)
+    --sweep-out F   write the results of all configurations to the CSV file F
+    --sweep-trace F read the events from a --trace file instead of running the program
+    --threads N     worker threads (default: one per host core)
+
+  miss-ratio curves (every cache size from one run):
+    --mrc FILE      profile LRU reuse distances of instruction fetches and data accesses,
+                    print the miss ratio of every power-of-two capacity and write them to
+                    the CSV file FILE (mips_reuse.h)
+    --mrc-line W    words per cache line (default 4)
+    --mrc-sample R  SHARDS: track only a fraction R of the lines (e.g. 0.01)
+    --mrc-max-lines N  SHARDS with a fixed size: track at most N lines per curve
+
+  differential execution (mips_lockstep.h):
+    --lockstep E    run engine E (cpu, no-idioms, superblocks or all of them) side by side
+                    with a reference executor and stop at the first difference in pc,
+                    registers, HI/LO, counters or memory; with --replay-log both get the
+                    logged input. The exit status is 1 if they diverged
+    --check-every N compare the states every N instructions (default 1) or at the end of
+                    every block ("block"); coarser checks let the engines take their fast
+                    paths (whole superblocks, bulk loops)
+    --random-programs K  check K random programs instead of one program (default engines: all),
+                    each for up to 1000000 instructions or --max
+    --seed S        random number seed for --random-programs (default 1)
+
+  time series:
+    --metrics FILE  run the pipeline model and write one CSV row of IPC, miss rates,
+                    mispredict rate, loads/stores and footprint per --interval
+    --interval-cycles  measure --interval in cycles instead of instructions
+
+Programs can use the SPIM/MARS syscalls (print_int, print_string, read_int,
+read_string, sbrk, exit, ...; see mips_syscall.h) to print results, grow the
+heap and exit; the matmul and sort kernels do.
+
+With no program and no kernel, mipssim asks for the instructions the same way
+the classroom programs do and runs them verbosely.
+================================================================================
+*/
+
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <type_traits>
+#include "mips_cpu.h"
+#include "mips_programs.h"
+#include "mips_syscall.h"
+#include "mips_sampling.h"
+#include "mips_bbv.h"
+#include "mips_metrics.h"
+#include "mips_ooo.h"
+#include "mips_multicore.h"
+#include "mips_sweep.h"
+#include "mips_replay.h"
+#include "mips_record.h"
+#include "mips_reverse.h"
+#include "mips_perf.h"
+#include "mips_decoupled.h"
+#include "mips_superblock.h"
+#include "mips_reuse.h"
+#include "mips_harts.h"
+#include "mips_lockstep.h"
+
+using namespace std;
+
+// Command line settings
+struct Options {
+    string programFile;
+    string kernel;
+    string traceFile;
+    string replayFile;
+    string recordFile;
+    string replayLogFile;
+    RunLog* log = nullptr;            // set up by main for --record / --replay-log
+    size_t memWords = 256;
+    bool hugePages = true;
+    bool numa = true;
+    uint64_t maxInstructions = 1000000000;
+    bool unchecked = false;
+    bool noIdioms = false;
+    bool superblocks = false;
+    bool timing = false;
+    bool decoupled = false;
+    int issueWidth = 1;
+    int aluUnits = 2, memUnits = 1, branchUnits = 1;
+    bool l2 = false;
+    HierarchyConfig hierarchy;
+    bool tlb = false;
+    MmuConfig mmu;
+    MulticoreConfig multicore;
+    int harts = 0;
+    vector<SweepConfig> sweep;
+    string sweepOut;
+    string sweepTrace;
+    unsigned threads = 0;
+    bool ooo = false;
+    OooConfig oooConfig;
+    bool verbose = false;
+    bool debug = false;
+    uint64_t checkpointSpacing = 100000;
+    bool bench = false;
+    bool perf = false;
+    bool sampled = false;
+    SamplingConfig sampling;
+    string bbvFile;
+    uint64_t interval = 100000;
+    size_t clusters = 8;
+    string metricsFile;
+    string mrcFile;
+    ReuseConfig reuse;
+    bool intervalCycles = false;
+    string lockstep;                  // engines to check against the reference ("" = none)
+    uint64_t checkEvery = 1;          // 0 = every block
+    uint64_t randomPrograms = 0;
+    uint64_t seed = 1;
+};
+
+// HELPER FUNCTION: Prints the usage message
+void printUsage() {
+    cout << "usage: mipssim [--kernel NAME] [--mem-words N] [--max N] [--unchecked] [--no-idioms] [--timing]" << endl;
+    cout << "               [--no-huge-pages] [--no-numa]" << endl;
+    cout << "               [--superblocks] [--issue N] [--units A,M,B] [--l2] [--prefetch next|stride]" << endl;
+    cout << "               [--cores N] [--quantum Q] [--private-l2] [--ooo] [--width N] [--rob N]" << endl;
+    cout << "               [--latencies A,L,M,D] [--decoupled] [--harts N]" << endl;
+    cout << "               [--tlb] [--page-kb N] [--tlb-entries L1,L2]" << endl;
+    cout << "               [--trace FILE | --replay FILE] [--verbose] [--bench] [--perf] [program.hex]" << endl;
+    cout << "               [--record LOG | --replay-log LOG] [--debug] [--checkpoint-every N]" << endl;
+    cout << "               [--sample P | --simpoints start[:weight],...] [--warmup W] [--detail M]" << endl;
+    cout << "               [--bbv FILE] [--interval N] [--clusters K]" << endl;
+    cout << "               [--metrics FILE] [--interval-cycles]" << endl;
+    cout << "               [--mrc FILE] [--mrc-line W] [--mrc-sample R] [--mrc-max-lines N]" << endl;
+    cout << "               [--sweep GRID] [--sweep-out FILE] [--sweep-trace FILE] [--threads N]" << endl;
+    cout << "               [--lockstep cpu|no-idioms|superblocks|all] [--check-every N|block]" << endl;
+    cout << "               [--random-programs K] [--seed S]" << endl;
+    cout << "kernels:";
+    for (const string& name : kernelNames()) {
+        cout << " " << name;
+    }
+    cout << endl;
+}
+
+// HELPER FUNCTION: Reads a simulation point list such as "100000:0.25,900000:0.75"
+bool parseSimPoints(const string& text, vector<SamplePoint>& points) {
+    stringstream list(text);
+    string item;
+    while (getline(list, item, ',')) {
+        size_t colon = item.find(':');
+        SamplePoint p;
+        p.start = stoull(item.substr(0, colon));
+        p.weight = colon == string::npos ? 1.0 : stod(item.substr(colon + 1));
+        points.push_back(p);
+    }
+    sort(points.begin(), points.end(), [](const SamplePoint& a, const SamplePoint& b) { return a.start < b.start; });
+    return !points.empty();
+}
+
+// HELPER FUNCTION: Reads the command line into an Options struct
+bool parseOptions(int argc, char* argv[], Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        // Options that take a value must have one
+        bool hasValue = i + 1 < argc;
+        if (arg == "--kernel" && hasValue) opt.kernel = argv[++i];
+        else if (arg == "--mem-words" && hasValue) opt.memWords = stoull(argv[++i]);
+        else if (arg == "--no-huge-pages") opt.hugePages = false;
+        else if (arg == "--no-numa") opt.numa = false;
+        else if (arg == "--max" && hasValue) opt.maxInstructions = stoull(argv[++i]);
+        else if (arg == "--trace" && hasValue) opt.traceFile = argv[++i];
+        else if (arg == "--replay" && hasValue) opt.replayFile = argv[++i];
+        else if (arg == "--record" && hasValue) opt.recordFile = argv[++i];
+        else if (arg == "--replay-log" && hasValue) opt.replayLogFile = argv[++i];
+        else if (arg == "--unchecked") opt.unchecked = true;
+        else if (arg == "--superblocks") opt.superblocks = true;
+        else if (arg == "--no-idioms") opt.noIdioms = true;
+        else if (arg == "--timing") opt.timing = true;
+        else if (arg == "--issue" && hasValue) opt.issueWidth = stoi(argv[++i]);
+        else if (arg == "--units" && hasValue) {
+            if (sscanf(argv[++i], "%d,%d,%d", &opt.aluUnits, &opt.memUnits, &opt.branchUnits) != 3) return false;
+        }
+        else if (arg == "--l2") opt.l2 = true;
+        else if (arg == "--prefetch" && hasValue) {
+            string kind = argv[++i];
+            if (kind == "next") opt.hierarchy.prefetch = PREFETCH_NEXT_LINE;
+            else if (kind == "stride") opt.hierarchy.prefetch = PREFETCH_STRIDE;
+            else return false;
+            opt.l2 = true;
+        }
+        else if (arg == "--cores" && hasValue) opt.multicore.cores = stoi(argv[++i]);
+        else if (arg == "--quantum" && hasValue) opt.multicore.quantum = stoull(argv[++i]);
+        else if (arg == "--private-l2") opt.multicore.sharedL2 = false;
+        else if (arg == "--tlb") opt.tlb = true;
+        else if (arg == "--page-kb" && hasValue) {
+            uint32_t kb = stoul(argv[++i]);
+            if (kb == 0 || (kb & (kb - 1)) != 0) return false;
+            opt.mmu.pageWords = kb * 256;
+            opt.tlb = true;
+        }
+        else if (arg == "--tlb-entries" && hasValue) {
+            if (sscanf(argv[++i], "%u,%u", &opt.mmu.l1Entries, &opt.mmu.l2Entries) != 2) return false;
+            if (opt.mmu.l1Entries == 0 || opt.mmu.l2Entries == 0) return false;
+            opt.tlb = true;
+        }
+        else if (arg == "--sweep" && hasValue) {
+            if (!parseSweepGrid(argv[++i], opt.sweep)) return false;
+        }
+        else if (arg == "--sweep-out" && hasValue) opt.sweepOut = argv[++i];
+        else if (arg == "--sweep-trace" && hasValue) opt.sweepTrace = argv[++i];
+        else if (arg == "--threads" && hasValue) opt.threads = stoul(argv[++i]);
+        else if (arg == "--harts" && hasValue) opt.harts = stoi(argv[++i]);
+        else if (arg == "--ooo") opt.ooo = true;
+        else if (arg == "--decoupled") opt.decoupled = true;
+        else if (arg == "--width" && hasValue) opt.oooConfig.width = stoi(argv[++i]);
+        else if (arg == "--rob" && hasValue) opt.oooConfig.robSize = stoi(argv[++i]);
+        else if (arg == "--latencies" && hasValue) {
+            OooConfig& c = opt.oooConfig;
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &c.aluLatency, &c.loadLatency, &c.multLatency, &c.divLatency) != 4 ||
+                c.aluLatency < 1 || c.loadLatency < 1 || c.multLatency < 1 || c.divLatency < 1) {
+                return false;
+            }
+        }
+        else if (arg == "--verbose") opt.verbose = true;
+        else if (arg == "--debug") opt.debug = true;
+        else if (arg == "--checkpoint-every" && hasValue) opt.checkpointSpacing = stoull(argv[++i]);
+        else if (arg == "--bench") opt.bench = true;
+        else if (arg == "--perf") opt.perf = true;
+        else if (arg == "--sample" && hasValue) { opt.sampled = true; opt.sampling.period = stoull(argv[++i]); }
+        else if (arg == "--simpoints" && hasValue) {
+            opt.sampled = true;
+            if (!parseSimPoints(argv[++i], opt.sampling.points)) return false;
+        }
+        else if (arg == "--warmup" && hasValue) opt.sampling.warmup = stoull(argv[++i]);
+        else if (arg == "--detail" && hasValue) opt.sampling.detail = stoull(argv[++i]);
+        else if (arg == "--bbv" && hasValue) opt.bbvFile = argv[++i];
+        else if (arg == "--interval" && hasValue) opt.interval = stoull(argv[++i]);
+        else if (arg == "--clusters" && hasValue) opt.clusters = stoull(argv[++i]);
+        else if (arg == "--metrics" && hasValue) opt.metricsFile = argv[++i];
+        else if (arg == "--interval-cycles") opt.intervalCycles = true;
+        else if (arg == "--mrc" && hasValue) opt.mrcFile = argv[++i];
+        else if (arg == "--mrc-line" && hasValue) opt.reuse.lineWords = stoul(argv[++i]);
+        else if (arg == "--mrc-sample" && hasValue) opt.reuse.rate = stod(argv[++i]);
+        else if (arg == "--mrc-max-lines" && hasValue) opt.reuse.maxLines = stoull(argv[++i]);
+        else if (arg == "--lockstep" && hasValue) {
+            opt.lockstep = argv[++i];
+            if (opt.lockstep != "cpu" && opt.lockstep != "no-idioms" && opt.lockstep != "superblocks" &&
+                opt.lockstep != "all") {
+                return false;
+            }
+        }
+        else if (arg == "--check-every" && hasValue) {
+            string every = argv[++i];
+            opt.checkEvery = every == "block" ? 0 : stoull(every);
+            if (every != "block" && opt.checkEvery == 0) return false;
+        }
+        else if (arg == "--random-programs" && hasValue) opt.randomPrograms = stoull(argv[++i]);
+        else if (arg == "--seed" && hasValue) opt.seed = stoull(argv[++i]);
+        else if (!arg.empty() && arg[0] != '-' && opt.programFile.empty()) opt.programFile = arg;
+        else return false;
+    }
+    // The state display always shows M[0..15]
+    if (opt.memWords < 16) {
+        opt.memWords = 16;
+    }
+    // A sample needs at least one detailed instruction, and must fit in its period
+    if (opt.interval == 0 || opt.clusters == 0 || opt.oooConfig.width < 1 || opt.oooConfig.robSize < 1 ||
+        opt.issueWidth < 1 || opt.aluUnits < 1 || opt.memUnits < 1 || opt.branchUnits < 1 ||
+        opt.multicore.cores < 1 || opt.multicore.cores > CoherentCaches::MAX_CORES || opt.multicore.quantum == 0 ||
+        opt.harts < 0 || opt.reuse.lineWords == 0 || !(opt.reuse.rate > 0 && opt.reuse.rate <= 1)) {
+        return false;
+    }
+    if (opt.sampled && (opt.sampling.detail == 0 ||
+                        (opt.sampling.period > 0 && opt.sampling.period < opt.sampling.detail))) {
+        return false;
+    }
+    // Samples are measured on the in-order pipeline model, run on one thread
+    if (opt.sampled && (opt.ooo || opt.decoupled)) {
+        return false;
+    }
+    return true;
+}
+
+// HELPER FUNCTION: Loads a program file with one 8-digit hex instruction per line
+bool loadHexFile(const string& path, vector<uint32_t>& program) {
+    ifstream in(path);
+    if (!in) {
+        cout << "Error: cannot open " << path << endl;
+        return false;
+    }
+    string line;
+    int lineNumber = 0;
+    while (getline(in, line)) {
+        lineNumber++;
+        // Drop comments and surrounding spaces
+        size_t hash = line.find('#');
+        if (hash != string::npos) {
+            line = line.substr(0, hash);
+        }
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos) {
+            continue;
+        }
+        size_t last = line.find_last_not_of(" \t\r");
+        string hexText = line.substr(first, last - first + 1);
+
+        uint32_t word;
+        if (!parseHexWord(hexText, word)) {
+            cout << "Error: line " << lineNumber << ": input must be exactly 8 hex characters." << endl;
+            return false;
+        }
+        program.push_back(word);
+    }
+    return true;
+}
+
+// HELPER FUNCTION: Asks the user for the instructions, like the classroom programs
+void readInteractive(vector<uint32_t>& program) {
+    int numInstructions = 0;
+    cout << "How many instructions do you want to run? (Enter a number) ";
+    cin >> numInstructions;
+    for (int k = 0; k < numInstructions; k++) {
+        string hexInput;
+        cout << "\nEnter 8-digit Hex instruction (e.g. 00642820): ";
+        if (!(cin >> hexInput)) {
+            break;
+        }
+        uint32_t word;
+        if (!parseHexWord(hexInput, word)) {
+            // Invalid attempts do not count toward numInstructions
+            cout << "Error: Input must be exactly 8 hex characters." << endl;
+            k--;
+            continue;
+        }
+        program.push_back(word);
+    }
+}
+
+// HELPER FUNCTION: Prints what the run did
+void printSummary(const Machine& m, double seconds) {
+    cout << "Instructions executed: " << m.instructions << (m.halted ? " (program finished)" : " (stopped at limit)") << endl;
+    if (m.exitCode) {
+        cout << "Exit code: " << m.exitCode << endl;
+    }
+    if (m.idiomInstructions) {
+        cout << "Run as bulk copy/clear/scan loops: " << m.idiomInstructions << " instructions (" << fixed
+             << setprecision(1) << 100.0 * m.idiomInstructions / m.instructions << "%)" << defaultfloat << endl;
+    }
+    if (m.unknown) {
+        cout << "Unknown instructions skipped: " << m.unknown << endl;
+    }
+    if (m.faults) {
+        cout << "Error: " << m.faults << " load/store addresses out of range (last: " << m.lastFault << ")" << endl;
+    }
+    cout << "Host time: " << fixed << setprecision(3) << seconds << " s";
+    if (seconds > 0) {
+        cout << "  (" << setprecision(1) << m.instructions / seconds / 1e6 << " million instructions/s)";
+    }
+    cout << defaultfloat << endl;
+}
+
+// The memory system behind a timing model: L2/DRAM and the MMU, used when --l2 / --tlb ask for them
+struct TimingMemory {
+    MemoryHierarchy hierarchy;
+    PageTables tables;
+    Mmu mmu;
+    explicit TimingMemory(const Options& opt)
+        : hierarchy(opt.hierarchy), tables(opt.mmu.pageWords), mmu(opt.mmu, &tables) {}
+};
+
+// Hands the command line settings (and the L2/DRAM, if any) to timing models that have any
+template <class Timing>
+void configureTiming(Timing&, const Options&, TimingMemory&) {}
+
+void configureTiming(PipelineTiming& timing, const Options& opt, TimingMemory& backing) {
+    timing.memory = opt.l2 ? &backing.hierarchy : nullptr;
+    timing.mmu = opt.tlb ? &backing.mmu : nullptr;
+    timing.issueWidth = opt.issueWidth;
+    timing.aluUnits = opt.aluUnits;
+    timing.memUnits = opt.memUnits;
+    timing.branchUnits = opt.branchUnits;
+}
+
+void configureTiming(OooTiming& timing, const Options& opt, TimingMemory& backing) {
+    timing.memory = opt.l2 ? &backing.hierarchy : nullptr;
+    timing.mmu = opt.tlb ? &backing.mmu : nullptr;
+    timing.config = opt.oooConfig;
+    timing.setup();
+}
+
+// RECORD / REPLAY: ends the log with the run's result, or checks the run against the log
+void finishRunLog(const Options& opt, const vector<const Machine*>& state, uint64_t instructions, uint64_t cycles) {
+    if (!opt.log) return;
+    if (opt.log->mode == RunLog::RECORD) {
+        opt.log->recordEnd(instructions, cycles, RunLog::stateHash(state));
+        if (opt.log->save(opt.recordFile)) {
+            cout << "Recorded the run to " << opt.recordFile << " (" << opt.log->bytes() << " bytes)" << endl;
+        } else {
+            cout << "Error: cannot write " << opt.recordFile << endl;
+        }
+    } else if (opt.log->mode == RunLog::REPLAY) {
+        opt.log->checkEnd(instructions, cycles, RunLog::stateHash(state), cout);
+    }
+}
+
+// Runs an engine for --max instructions; with --decoupled its timing model runs on a thread of its own,
+// with --superblocks the plain engine is replaced by SuperblockCpu (whose report goes to stats, if given).
+// engine is set to the name of what ran, with the options that changed how it ran.
+template <class Memory, class Trace, class Timing>
+uint64_t runCpu(Cpu<Trace, Memory, Timing>& cpu, Machine& m, const Options& opt, string& engine,
+                ostream* stats = nullptr) {
+    engine = cpu.name();
+    if constexpr (is_same_v<Trace, NoTrace> && !Timing::enabled) {
+        if (opt.superblocks) engine = SuperblockCpu<Memory>::name();
+        if (opt.noIdioms) engine += " --no-idioms";
+    }
+    if (!opt.hugePages && m.memory.size() * sizeof(int) >= HostMemory::HUGE_PAGE) engine += " --no-huge-pages";
+    if constexpr (is_same_v<Trace, NoTrace> && Timing::enabled) {
+        if (opt.decoupled) {
+            engine += " --decoupled";
+            return runDecoupled<Memory>(m, cpu.timing, opt.maxInstructions);
+        }
+    }
+    if constexpr (is_same_v<Trace, NoTrace> && !Timing::enabled) {
+        if (opt.superblocks) {
+            SuperblockCpu<Memory> blocks(m);
+            uint64_t executed = blocks.run(opt.maxInstructions);
+            if (stats) blocks.report(*stats);
+            return executed;
+        }
+    }
+    return cpu.run(opt.maxInstructions);
+}
+
+// Runs the loaded program on one engine configuration and reports the results
+template <class Trace, class Memory, class Timing>
+void runEngine(Machine& m, const Options& opt) {
+    Cpu<Trace, Memory, Timing> cpu(m);
+    TimingMemory backing(opt);
+    configureTiming(cpu.timing, opt, backing);
+    if constexpr (is_same_v<Trace, BinaryTrace>) {
+        if (!cpu.trace.open(opt.traceFile)) {
+            cout << "Error: cannot write trace file " << opt.traceFile << endl;
+            return;
+        }
+    }
+
+    HostCounters counters;
+    stringstream stats;
+    string engine;
+    auto start = chrono::steady_clock::now();
+    if (opt.perf) counters.start();
+    uint64_t executed = runCpu<Memory>(cpu, m, opt, engine, &stats);
+    if (opt.perf) counters.stop();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (!opt.verbose) {
+        displayState(m);
+    }
+    printSummary(m, seconds);
+    cpu.timing.report(cout);
+    cout << stats.str();
+    if (opt.perf) {
+        HostCounters::reportHeader(cout);
+        counters.report(cout, engine, executed);
+        HostMemory::report(cout);
+    }
+    finishRunLog(opt, {&m}, m.instructions, cpu.timing.cycles());
+}
+
+// Times one engine configuration on a program; returns the best of three runs in seconds and
+// the engine's name. With counters, one more run is made with the host counters on and reported to perfOut.
+template <class Trace, class Memory, class Timing>
+double timeEngine(const vector<uint32_t>& program, const Options& opt, uint64_t& executed, string& engine,
+                  HostCounters* counters, ostream& perfOut) {
+    double best = 0;
+    HostMemory::hugePages = opt.hugePages;
+    for (int rep = 0; rep < (counters ? 4 : 3); rep++) {
+        Machine m;
+        m.reset(opt.memWords);
+        m.idioms = !opt.noIdioms;
+        m.load(program);
+        SpimSyscalls os(nullptr);
+        m.os = &os;
+        Cpu<Trace, Memory, Timing> cpu(m);
+        TimingMemory backing(opt);
+        configureTiming(cpu.timing, opt, backing);
+        if constexpr (is_same_v<Trace, BinaryTrace>) {
+            cpu.trace.open("/dev/null");
+        }
+        if (rep == 3) {
+            counters->start();
+            executed = runCpu<Memory>(cpu, m, opt, engine);
+            counters->stop();
+            counters->report(perfOut, engine, executed);
+            break;
+        }
+        auto start = chrono::steady_clock::now();
+        executed = runCpu<Memory>(cpu, m, opt, engine);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (rep == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+/*
+PROFILING RUN: collects basic-block vectors, writes them out and clusters
+them into simulation points for --simpoints.
+*/
+template <class Memory>
+void runBbvProfile(Machine& m, const Options& opt) {
+    Cpu<BbvTrace, Memory, NoTiming> cpu(m);
+    cpu.trace.interval = opt.interval;
+    cpu.trace.setup(m);
+
+    auto start = chrono::steady_clock::now();
+    cpu.run(opt.maxInstructions);
+    cpu.trace.finish();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printSummary(m, seconds);
+
+    if (!writeBbvFile(opt.bbvFile, cpu.trace.vectors)) {
+        cout << "Error: cannot write " << opt.bbvFile << endl;
+        return;
+    }
+    cout << "Wrote " << cpu.trace.vectors.size() << " basic-block vectors (" << cpu.trace.blocks()
+         << " basic blocks) to " << opt.bbvFile << endl;
+    printSimPoints(clusterBbvs(cpu.trace.vectors, cpu.trace.blocks(), opt.clusters), opt.interval, cout);
+}
+
+// MISS-RATIO CURVES: reuse distances of every fetch and data access, for every cache size at once
+template <class Memory>
+void runReuseProfile(Machine& m, const Options& opt) {
+    ReuseProfiler fetch(opt.reuse), data(opt.reuse);
+    Cpu<ReuseTrace, Memory, NoTiming> cpu(m);
+    cpu.trace.fetch = &fetch;
+    cpu.trace.data = &data;
+
+    auto start = chrono::steady_clock::now();
+    cpu.run(opt.maxInstructions);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printSummary(m, seconds);
+
+    printMissRatioCurves(fetch, data, cout);
+    if (!writeMissRatioCsv(opt.mrcFile, fetch, data)) {
+        cout << "Error: cannot write " << opt.mrcFile << endl;
+        return;
+    }
+    cout << "Wrote the miss-ratio curves to " << opt.mrcFile << endl;
+}
+
+// TIME SERIES RUN: the pipeline model with a CSV row per interval
+template <class Memory>
+void runMetrics(Machine& m, const Options& opt) {
+    Cpu<NoTrace, Memory, IntervalTiming> cpu(m);
+    TimingMemory backing(opt);
+    configureTiming((PipelineTiming&)cpu.timing, opt, backing);
+    cpu.timing.interval = opt.interval;
+    cpu.timing.byCycles = opt.intervalCycles;
+    if (!cpu.timing.open(opt.metricsFile)) {
+        cout << "Error: cannot write " << opt.metricsFile << endl;
+        return;
+    }
+
+    auto start = chrono::steady_clock::now();
+    cpu.run(opt.maxInstructions);
+    cpu.timing.finish();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    displayState(m);
+    printSummary(m, seconds);
+    cpu.timing.report(cout);
+    cout << "Wrote " << cpu.timing.rows << " interval rows to " << opt.metricsFile << endl;
+}
+
+// MULTI-CORE RUN: the program on --cores cores sharing the memory
+template <class Memory>
+void runMulticore(Machine& m, const Options& opt) {
+    MulticoreConfig config = opt.multicore;
+    config.l2 = opt.l2;
+    config.hierarchy = opt.hierarchy;
+    config.tlb = opt.tlb;
+    config.mmu = opt.mmu;
+    Multicore<Memory> cores(m, config);
+    cores.log = opt.log;
+    for (auto& cpu : cores.cpus) {
+        cpu->timing.issueWidth = opt.issueWidth;
+        cpu->timing.aluUnits = opt.aluUnits;
+        cpu->timing.memUnits = opt.memUnits;
+        cpu->timing.branchUnits = opt.branchUnits;
+    }
+
+    auto start = chrono::steady_clock::now();
+    cores.run(opt.maxInstructions);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Core 0's registers with the shared memory, then the totals over all cores
+    displayState(cores.machines[0]);
+    Machine total;
+    total.halted = true;
+    for (const Machine& core : cores.machines) {
+        total.instructions += core.instructions;
+        total.unknown += core.unknown;
+        total.faults += core.faults;
+        if (core.faults) total.lastFault = core.lastFault;
+        total.halted = total.halted && core.halted;
+        total.exitCode = total.exitCode ? total.exitCode : core.exitCode;
+    }
+    printSummary(total, seconds);
+    cores.report(cout);
+    finishRunLog(opt, cores.state(), total.instructions, cores.cycles());
+}
+
+// HART RUN: --harts copies of the program as coroutines on a pool of worker threads
+template <class Memory>
+void runHarts(Machine& m, const Options& opt) {
+    HartConfig config;
+    config.harts = opt.harts;
+    config.workers = opt.threads;
+    config.quantum = opt.multicore.quantum;
+    HartPool<Memory> pool(m, config);
+
+    auto start = chrono::steady_clock::now();
+    pool.run(opt.maxInstructions);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Hart 0's state, then the totals over all harts
+    displayState(pool.harts[0]->machine);
+    Machine total;
+    total.halted = true;
+    for (const auto& hart : pool.harts) {
+        const Machine& h = hart->machine;
+        total.instructions += h.instructions;
+        total.unknown += h.unknown;
+        total.faults += h.faults;
+        if (h.faults) total.lastFault = h.lastFault;
+        total.halted = total.halted && h.halted;
+        total.exitCode = total.exitCode ? total.exitCode : h.exitCode;
+    }
+    printSummary(total, seconds);
+    pool.report(cout);
+}
+
+// LOCKSTEP RUN: one engine against the reference executor (mips_lockstep.h); false if they diverged
+template <class Engine>
+bool lockstepEngine(const Machine& m, const vector<uint32_t>& program, bool idioms, const string& name,
+                    const Options& opt, bool quiet, uint64_t& checked) {
+    Machine reference = m, candidate = m;
+    candidate.idioms = idioms;
+    candidate.load(program);
+    // Both sides get the same syscalls: quiet ones, and a replayed log's input each
+    SpimSyscalls referenceOs(nullptr, nullptr), candidateOs(nullptr, nullptr);
+    RunLog referenceLog = opt.log ? *opt.log : RunLog(), candidateLog = referenceLog;
+    LoggedSyscalls referenceLogged(referenceOs, referenceLog), candidateLogged(candidateOs, candidateLog);
+    reference.os = opt.log ? (SyscallHandler*)&referenceLogged : &referenceOs;
+    candidate.os = opt.log ? (SyscallHandler*)&candidateLogged : &candidateOs;
+
+    LockstepConfig config;
+    config.every = opt.checkEvery;
+    config.maxInstructions = opt.maxInstructions;
+    Lockstep<Engine> lockstep(reference, candidate, program, config);
+    auto start = chrono::steady_clock::now();
+    bool same = lockstep.run();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!same || !quiet) lockstep.report(cout, name, seconds);
+    checked += lockstep.result.instructions;
+    return same;
+}
+
+// Every engine picked by --lockstep on one program; checked counts the instructions compared
+bool lockstepEngines(const Machine& m, const vector<uint32_t>& program, const Options& opt, bool quiet,
+                     uint64_t& checked) {
+    bool all = opt.lockstep == "all";
+    bool same = true;
+    if (all || opt.lockstep == "cpu") {
+        same = lockstepEngine<Cpu<NoTrace, CheckedMemory, NoTiming>>(m, program, true, "Cpu", opt, quiet, checked) && same;
+    }
+    if (all || opt.lockstep == "no-idioms") {
+        same = lockstepEngine<Cpu<NoTrace, CheckedMemory, NoTiming>>(m, program, false, "Cpu --no-idioms", opt, quiet, checked) &&
+               same;
+    }
+    if (all || opt.lockstep == "superblocks") {
+        same = lockstepEngine<SuperblockCpu<CheckedMemory>>(m, program, true, "SuperblockCpu", opt, quiet, checked) && same;
+    }
+    return same;
+}
+
+// --random-programs: K random programs on a fresh machine each, stopping at the first that diverges
+bool runRandomLockstep(const Machine& m, Options opt) {
+    // Random programs often loop forever
+    opt.maxInstructions = min<uint64_t>(opt.maxInstructions, 1000000);
+    mt19937_64 rng(opt.seed);
+    uint64_t checked = 0;
+    auto start = chrono::steady_clock::now();
+    for (uint64_t k = 0; k < opt.randomPrograms; k++) {
+        vector<uint32_t> program = randomProgram(rng, 40 + rng() % 200);
+        Machine fresh = m;
+        fresh.idioms = !opt.noIdioms;
+        fresh.load(program);
+        if (!lockstepEngines(fresh, program, opt, true, checked)) {
+            cout << "Random program " << k << " of seed " << opt.seed << " (save as a .hex file to run it again):"
+                 << endl;
+            for (uint32_t word : program) {
+                cout << hex << setw(8) << setfill('0') << word << dec << setfill(' ') << endl;
+            }
+            return false;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Lockstep: " << opt.randomPrograms << " random programs (seed " << opt.seed << "), " << checked
+         << " instructions checked, same state throughout (" << fixed << setprecision(2) << seconds << " s)"
+         << defaultfloat << endl;
+    return true;
+}
+
+// DEBUG RUN: moves through the program forwards and backwards on commands from stdin
+template <class Memory>
+void runDebugger(Machine& m, const Options& opt) {
+    ReverseDebugger<Memory> debugger(m, opt.checkpointSpacing);
+    const History& h = debugger.history;
+    auto where = [&]() {
+        cout << "At instruction " << debugger.position() << ", pc " << m.pc;
+        if (m.halted) cout << " (program finished)";
+        else cout << ": " << disassemble(m.text[m.pc]);
+        cout << endl;
+    };
+    cout << "Reverse debugger (checkpoint every " << h.spacing << " instructions); commands: step [N], back [N], "
+         << "goto I, run, state, info, quit" << endl;
+    where();
+
+    string line;
+    while (cout << "(mipssim) " << flush, getline(cin, line)) {
+        stringstream words(line);
+        string command;
+        uint64_t n = 1;
+        if (!(words >> command)) continue;
+        bool hasNumber = (bool)(words >> n);
+        uint64_t restores = h.restores;
+        uint64_t reexecuted = h.reexecuted;
+        auto start = chrono::steady_clock::now();
+        if (command == "step" || command == "s") {
+            debugger.forward(n);
+        } else if (command == "back" || command == "b") {
+            debugger.backward(n);
+        } else if ((command == "goto" || command == "g") && hasNumber) {
+            debugger.seek(n);
+        } else if (command == "run" || command == "c") {
+            debugger.seek(opt.maxInstructions);
+        } else if (command == "state" || command == "p") {
+            displayState(m);
+            continue;
+        } else if (command == "info") {
+            cout << h.checkpoints.size() << " checkpoints (" << h.checkpointBytes() / 1024 << " KB), undo log "
+                 << h.undo.size() << " instructions, furthest instruction " << h.frontier << ", "
+                 << h.undone << " undone and " << h.reexecuted << " re-executed so far, " << h.pagesRestored
+                 << " memory pages restored" << endl;
+            continue;
+        } else if (command == "quit" || command == "q") {
+            break;
+        } else {
+            cout << "commands: step [N], back [N], goto I, run, state, info, quit" << endl;
+            continue;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        where();
+        if (h.restores != restores) {
+            cout << "  (restored a checkpoint and re-executed " << h.reexecuted - reexecuted << " instructions in "
+                 << fixed << setprecision(3) << seconds * 1000 << " ms)" << defaultfloat << endl;
+        }
+    }
+    if (m.os) m.os->flush();
+}
+
+// REPLAY RUN: a timing model fed straight from a trace file
+template <class Timing>
+void runReplay(const Options& opt) {
+    TraceFile trace;
+    if (!trace.open(opt.replayFile)) {
+        cout << "Error: cannot read trace file " << opt.replayFile << endl;
+        return;
+    }
+    Timing timing;
+    TimingMemory backing(opt);
+    configureTiming(timing, opt, backing);
+
+    HostCounters counters;
+    auto start = chrono::steady_clock::now();
+    if (opt.perf) counters.start();
+    uint64_t replayed = replayTrace(trace, timing, opt.maxInstructions);
+    if (opt.perf) counters.stop();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Replayed " << replayed << " instructions from " << opt.replayFile << " in " << fixed << setprecision(3)
+         << seconds << " s";
+    if (seconds > 0) {
+        cout << "  (" << setprecision(1) << replayed / seconds / 1e6 << " million instructions/s)";
+    }
+    cout << defaultfloat << endl;
+    timing.report(cout);
+    if (opt.perf) {
+        HostCounters::reportHeader(cout);
+        counters.report(cout, string("replay ") + Timing::name, replayed);
+    }
+}
+
+// SWEEP RUN: every --sweep configuration from one execution (or one trace)
+template <class Memory>
+void runSweepMode(Machine& m, const Options& opt) {
+    auto start = chrono::steady_clock::now();
+    bool traceOk = true;
+    vector<SweepResult> results = runSweep(opt.sweep, opt.threads, [&](EventFanout& fanout) {
+        if (!opt.sweepTrace.empty()) {
+            traceOk = produceFromTrace(opt.sweepTrace, fanout);
+            return;
+        }
+        Cpu<SweepTrace, Memory, NoTiming> cpu(m);
+        cpu.trace.fanout = &fanout;
+        cpu.run(opt.maxInstructions);
+    });
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!traceOk) {
+        cout << "Error: cannot read trace file " << opt.sweepTrace << endl;
+        return;
+    }
+
+    uint64_t instructions = results.empty() ? 0 : results[0].instructions;
+    cout << "Swept " << results.size() << " configurations over " << instructions << " instructions in "
+         << fixed << setprecision(3) << seconds << " s (" << setprecision(1)
+         << results.size() * (double)instructions / seconds / 1e6 << " million model-instructions/s)" << endl;
+    vector<SweepResult> best = results;
+    stable_sort(best.begin(), best.end(), [](const SweepResult& a, const SweepResult& b) { return a.cycles < b.cycles; });
+    if (best.size() > 10) best.resize(10);
+    cout << "Fastest configurations:" << endl;
+    cout << "     L1I sets/ways/line    L1D sets/ways/line   predictor      CPI  L1D miss  mispredict" << endl;
+    for (const SweepResult& r : best) {
+        const SweepConfig& c = r.config;
+        cout << setw(12) << c.icache.sets << "/" << c.icache.ways << "/" << left << setw(6) << c.icache.lineWords
+             << right << setw(12) << c.dcache.sets << "/" << c.dcache.ways << "/" << left << setw(6)
+             << c.dcache.lineWords << right << setw(9) << c.predictorEntries << setprecision(3) << setw(9)
+             << (r.instructions ? (double)r.cycles / r.instructions : 0.0) << setw(9) << r.dcacheMissRate * 100
+             << "%" << setw(10) << r.mispredictRate * 100 << "%" << endl;
+    }
+    cout << defaultfloat;
+    if (!opt.sweepOut.empty()) {
+        ofstream csv(opt.sweepOut);
+        if (!csv) {
+            cout << "Error: cannot write " << opt.sweepOut << endl;
+            return;
+        }
+        writeSweepCsv(csv, results);
+        cout << "Wrote " << results.size() << " rows to " << opt.sweepOut << endl;
+    }
+}
+
+/*
+BENCHMARK: runs the same program on several engine configurations and shows
+how much faster the stripped-down Cpu<NoTrace, UncheckedMemory, NoTiming>
+is than the ones with checking, timing and tracing compiled in.
+*/
+void runBench(const Options& opt) {
+    vector<uint32_t> program;
+    string name = opt.kernel.empty() ? "sum" : opt.kernel;
+    if (!opt.programFile.empty()) {
+        name = opt.programFile;
+        if (!loadHexFile(opt.programFile, program)) return;
+    } else if (!kernelProgram(name, program)) {
+        cout << "Error: unknown kernel " << name << endl;
+        return;
+    }
+
+    struct Row {
+        string engine;
+        double seconds;
+        uint64_t executed;
+    };
+    vector<Row> rows;
+    uint64_t n = 0;
+    double t;
+    string engine;
+    HostCounters hostCounters;
+    HostCounters* counters = opt.perf ? &hostCounters : nullptr;
+    stringstream perfTable;
+    t = timeEngine<NoTrace, UncheckedMemory, NoTiming>(program, opt, n, engine, counters, perfTable);
+    rows.push_back({engine, t, n});
+    if (!opt.noIdioms) {
+        Options plain = opt;
+        plain.noIdioms = true;
+        t = timeEngine<NoTrace, UncheckedMemory, NoTiming>(program, plain, n, engine, counters, perfTable);
+        rows.push_back({engine, t, n});
+    }
+    if (!opt.superblocks) {
+        Options blocks = opt;
+        blocks.superblocks = true;
+        t = timeEngine<NoTrace, UncheckedMemory, NoTiming>(program, blocks, n, engine, counters, perfTable);
+        rows.push_back({engine, t, n});
+    }
+    if (opt.hugePages && opt.memWords * sizeof(int) >= HostMemory::HUGE_PAGE) {
+        Options small = opt;
+        small.hugePages = false;
+        t = timeEngine<NoTrace, UncheckedMemory, NoTiming>(program, small, n, engine, counters, perfTable);
+        rows.push_back({engine, t, n});
+    }
+    t = timeEngine<NoTrace, CheckedMemory, NoTiming>(program, opt, n, engine, counters, perfTable);
+    rows.push_back({engine, t, n});
+    t = timeEngine<NoTrace, CheckedMemory, PipelineTiming>(program, opt, n, engine, counters, perfTable);
+    rows.push_back({engine, t, n});
+    if (!opt.decoupled) {
+        Options split = opt;
+        split.decoupled = true;
+        t = timeEngine<NoTrace, CheckedMemory, PipelineTiming>(program, split, n, engine, counters, perfTable);
+        rows.push_back({engine, t, n});
+    }
+    t = timeEngine<BinaryTrace, CheckedMemory, PipelineTiming>(program, opt, n, engine, counters, perfTable);
+    rows.push_back({engine, t, n});
+    t = timeEngine<NoTrace, CheckedMemory, OooTiming>(program, opt, n, engine, counters, perfTable);
+    rows.push_back({engine, t, n});
+
+    cout << "Benchmark: " << name << " (" << rows[0].executed << " instructions, best of 3)" << endl;
+    for (const Row& r : rows) {
+        cout << "  " << left << setw(62) << r.engine << right << fixed << setprecision(1)
+             << setw(8) << r.executed / r.seconds / 1e6 << " MIPS"
+             << "   unchecked speedup x" << setprecision(2) << r.seconds / rows[0].seconds << endl;
+    }
+    cout << defaultfloat;
+    if (counters) {
+        if (!hostCounters.anyAvailable()) {
+            cout << "Host counters: not available on this system (perf_event_open failed)" << endl;
+        }
+        HostCounters::reportHeader(cout);
+        cout << perfTable.str();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parseOptions(argc, argv, opt)) {
+        printUsage();
+        return 1;
+    }
+    if (opt.bench) {
+        runBench(opt);
+        return 0;
+    }
+
+    // A replayed run takes its options (and below its program) from the log
+    RunLog log;
+    if (!opt.replayLogFile.empty()) {
+        string logFile = opt.replayLogFile;
+        if (!log.load(logFile)) {
+            cout << "Error: cannot read run log " << logFile << endl;
+            return 1;
+        }
+        vector<char*> recorded = {argv[0]};
+        for (string& a : log.args) recorded.push_back(&a[0]);
+        Options given = opt;
+        opt = Options();
+        if (!parseOptions((int)recorded.size(), recorded.data(), opt)) {
+            cout << "Error: bad options in run log " << logFile << endl;
+            return 1;
+        }
+        opt.replayLogFile = logFile;
+        // Checking the recorded run against the reference is up to this command line
+        opt.lockstep = given.lockstep;
+        opt.checkEvery = given.checkEvery;
+    }
+    if (!opt.lockstep.empty() || opt.randomPrograms > 0) {
+        if (!opt.recordFile.empty() || opt.multicore.cores > 1 || opt.harts > 0) {
+            cout << "Error: --lockstep checks single-core runs and does not record them" << endl;
+            return 1;
+        }
+    }
+    vector<string> commandLine;
+    if (!opt.recordFile.empty()) {
+        for (int i = 1; i < argc; i++) {
+            if (string(argv[i]) == "--record") i++;
+            else commandLine.push_back(argv[i]);
+        }
+        log.mode = RunLog::RECORD;
+    }
+    if (log.mode != RunLog::OFF) {
+        if (!opt.bbvFile.empty() || !opt.metricsFile.empty() || !opt.mrcFile.empty() || !opt.sweep.empty() ||
+            opt.sampled || !opt.replayFile.empty() || opt.harts > 0) {
+            cout << "Error: --record and --replay-log work with single and multi-core runs only" << endl;
+            return 1;
+        }
+        opt.log = &log;
+    }
+
+    // Create the machine with the classroom start values (R[i] = i, M[i] = i)
+    HostMemory::hugePages = opt.hugePages;
+    HostMemory::numa = opt.numa;
+    Machine m;
+    m.reset(opt.memWords);
+
+    // Random programs bring their own
+    if (opt.randomPrograms > 0) {
+        if (opt.lockstep.empty()) opt.lockstep = "all";
+        return runRandomLockstep(m, opt) ? 0 : 1;
+    }
+
+    // Replays and sweeps over a recorded trace do not need the program
+    if (!opt.replayFile.empty()) {
+        if (opt.ooo) runReplay<OooTiming>(opt);
+        else runReplay<PipelineTiming>(opt);
+        return 0;
+    }
+    if (!opt.sweep.empty() && !opt.sweepTrace.empty()) {
+        runSweepMode<CheckedMemory>(m, opt);
+        return 0;
+    }
+
+    // Get the program: a file, a built-in kernel, or typed in by the user
+    vector<uint32_t> program;
+    if (log.mode == RunLog::REPLAY) {
+        program = log.program;
+    } else if (!opt.programFile.empty()) {
+        if (!loadHexFile(opt.programFile, program)) return 1;
+    } else if (!opt.kernel.empty()) {
+        if (!kernelProgram(opt.kernel, program)) {
+            cout << "Error: unknown kernel " << opt.kernel << endl;
+            printUsage();
+            return 1;
+        }
+    } else {
+        cout << "WELCOME TO THE MIPS PROCESSOR!" << endl;
+        displayState(m);
+        readInteractive(program);
+        opt.verbose = true;
+        commandLine.push_back("--verbose");
+    }
+    m.idioms = !opt.noIdioms;
+    m.load(program);
+    SpimSyscalls os;
+    LoggedSyscalls loggedOs(os, log);
+    m.os = log.mode == RunLog::OFF ? (SyscallHandler*)&os : &loggedOs;
+    if (log.mode == RunLog::RECORD) {
+        log.startRecording(commandLine, program, m);
+    } else if (log.mode == RunLog::REPLAY && RunLog::stateHash({&m}) != log.initialHash) {
+        cout << "Warning: the initial state differs from the recorded run" << endl;
+    }
+
+    if (!opt.lockstep.empty()) {
+        uint64_t checked = 0;
+        return lockstepEngines(m, program, opt, false, checked) ? 0 : 1;
+    }
+
+    if (!opt.bbvFile.empty()) {
+        if (opt.unchecked) runBbvProfile<UncheckedMemory>(m, opt);
+        else runBbvProfile<CheckedMemory>(m, opt);
+        return 0;
+    }
+
+    if (!opt.mrcFile.empty()) {
+        if (opt.unchecked) runReuseProfile<UncheckedMemory>(m, opt);
+        else runReuseProfile<CheckedMemory>(m, opt);
+        return 0;
+    }
+
+    if (!opt.metricsFile.empty()) {
+        if (opt.unchecked) runMetrics<UncheckedMemory>(m, opt);
+        else runMetrics<CheckedMemory>(m, opt);
+        return 0;
+    }
+
+    if (!opt.sweep.empty()) {
+        if (opt.unchecked) runSweepMode<UncheckedMemory>(m, opt);
+        else runSweepMode<CheckedMemory>(m, opt);
+        return 0;
+    }
+
+    if (opt.debug) {
+        if (opt.unchecked) runDebugger<UncheckedMemory>(m, opt);
+        else runDebugger<CheckedMemory>(m, opt);
+        return 0;
+    }
+
+    if (opt.harts > 0) {
+        if (opt.unchecked) runHarts<UncheckedMemory>(m, opt);
+        else runHarts<CheckedMemory>(m, opt);
+        return 0;
+    }
+
+    if (opt.multicore.cores > 1) {
+        if (opt.unchecked) runMulticore<UncheckedMemory>(m, opt);
+        else runMulticore<CheckedMemory>(m, opt);
+        return 0;
+    }
+
+    // Sampled runs switch between the fast, warming and detailed engines themselves
+    if (opt.sampled) {
+        TimingMemory backing(opt);
+        auto setup = [&](PipelineTiming& timing) { configureTiming(timing, opt, backing); };
+        auto start = chrono::steady_clock::now();
+        SamplingReport report = opt.unchecked ? runSampled<UncheckedMemory>(m, opt.sampling, opt.maxInstructions, setup)
+                                              : runSampled<CheckedMemory>(m, opt.sampling, opt.maxInstructions, setup);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        displayState(m);
+        printSummary(m, seconds);
+        printSamplingReport(report, cout);
+        return 0;
+    }
+
+    // Pick the engine: each branch below is a different compiled instantiation of Cpu.
+    // Verbose and traced runs are debugging runs, so they always check addresses.
+    if (opt.verbose) {
+        runEngine<ConsoleTrace, CheckedMemory, NoTiming>(m, opt);
+    } else if (!opt.traceFile.empty()) {
+        if (opt.timing) runEngine<BinaryTrace, CheckedMemory, PipelineTiming>(m, opt);
+        else runEngine<BinaryTrace, CheckedMemory, NoTiming>(m, opt);
+    } else if (opt.ooo) {
+        if (opt.unchecked) runEngine<NoTrace, UncheckedMemory, OooTiming>(m, opt);
+        else runEngine<NoTrace, CheckedMemory, OooTiming>(m, opt);
+    } else if (opt.timing) {
+        if (opt.unchecked) runEngine<NoTrace, UncheckedMemory, PipelineTiming>(m, opt);
+        else runEngine<NoTrace, CheckedMemory, PipelineTiming>(m, opt);
+    } else {
+        if (opt.unchecked) runEngine<NoTrace, UncheckedMemory, NoTiming>(m, opt);
+        else runEngine<NoTrace, CheckedMemory, NoTiming>(m, opt);
+    }
+    return 0;
+}